@@ -0,0 +1,121 @@
+#ifndef _ARENA_HPP_
+#define _ARENA_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Monotonic memory arena
+ *
+ * Memory is handed out from large chunks and released all at once by
+ * reset(). Chunks are kept for reuse, so a connection which handles
+ * requests of similar size stops calling malloc after the first few.
+ * Objects created in an arena are never destroyed, so they must be
+ * trivially destructible.
+ */
+class Arena
+{
+public:
+  /**
+   * @brief Construct a new Arena object
+   *
+   * @param chunk_size Size of the first chunk in bytes
+   */
+  explicit Arena(std::size_t chunk_size = 4096)
+  : chunk_size(chunk_size), current(0), offset(0) {}
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  ~Arena()
+  {
+    for (auto& chunk : chunks) {
+      delete[] chunk.data;
+    }
+  }
+
+  /**
+   * @brief Allocate memory
+   *
+   * @param size Size in bytes
+   * @param align Alignment in bytes (power of two)
+   * @return Pointer to allocated memory
+   */
+  void *allocate(std::size_t size, std::size_t align = alignof(std::max_align_t))
+  {
+    for (;;) {
+      if (current < chunks.size()) {
+        auto& chunk = chunks[current];
+        const std::size_t start = (offset + align - 1) & ~(align - 1);
+        if (start + size <= chunk.size) {
+          offset = start + size;
+          return chunk.data + start;
+        }
+        if (current + 1 < chunks.size()) {
+          ++current;
+          offset = 0;
+          continue;
+        }
+      }
+      std::size_t next_size = chunks.empty() ? chunk_size : chunks.back().size * 2;
+      while (next_size < size + align) {
+        next_size *= 2;
+      }
+      chunks.push_back(Chunk{new char[next_size], next_size});
+      current = chunks.size() - 1;
+      offset = 0;
+    }
+  }
+
+  /**
+   * @brief Create an object in the arena
+   */
+  template <class T, class... Args>
+  T *create(Args&&... args)
+  {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Release all memory allocated from the arena
+   *
+   * Chunks beyond retain_size bytes in total are freed, so that one
+   * huge request does not pin its memory forever.
+   */
+  void reset()
+  {
+    std::size_t total = 0;
+    std::size_t keep = 0;
+    while ((keep < chunks.size()) && (total + chunks[keep].size <= retain_size)) {
+      total += chunks[keep++].size;
+    }
+    if (keep == 0) {
+      keep = 1;
+    }
+    while (chunks.size() > keep) {
+      delete[] chunks.back().data;
+      chunks.pop_back();
+    }
+    current = 0;
+    offset = 0;
+  }
+
+private:
+  static const std::size_t retain_size = 1024 * 1024;
+
+  struct Chunk
+  {
+    char *data;
+    std::size_t size;
+  };
+
+  std::size_t chunk_size;
+  std::vector<Chunk> chunks;
+  std::size_t current;
+  std::size_t offset;
+};
+
+#endif /* _ARENA_HPP_ */
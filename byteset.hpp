@@ -0,0 +1,146 @@
+#ifndef _BYTESET_HPP_
+#define _BYTESET_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BYTESET_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define BYTESET_AVX2
+#define BYTESET_AVX2_TARGET
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Compiled for AVX2 separately and selected at run time
+#define BYTESET_AVX2
+#define BYTESET_AVX2_TARGET __attribute__((target("avx2")))
+#define BYTESET_AVX2_RUNTIME
+#include <immintrin.h>
+#endif
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * @brief Set of bytes to search for in blocks of 32 (AVX2) or 16 (SSE2)
+ *
+ * @tparam Controls true to match control characters (0x00-0x1f) as well
+ * @tparam Chars Bytes to match
+ *
+ * Without SSE2, or at the tail shorter than a block, bytes are tested
+ * one at a time.
+ */
+template <bool Controls, char... Chars>
+class ByteSet
+{
+public:
+  /**
+   * @brief Test if a byte is in the set
+   */
+  static bool contains(char ch)
+  {
+    if (Controls && ((unsigned char)ch < 0x20)) {
+      return true;
+    }
+    const char chars[] = { Chars... };
+    for (const char c : chars) {
+      if (ch == c) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief Find the first byte in the set
+   *
+   * @param ptr Pointer to the first byte to test
+   * @param end Pointer to the end of bytes
+   * @return Pointer to the byte found (end if not found)
+   */
+  static const char *find(const char *ptr, const char *end)
+  {
+#if defined(BYTESET_AVX2)
+#if defined(BYTESET_AVX2_RUNTIME)
+    if (has_avx2())
+#endif
+    {
+      ptr = find_avx2(ptr, end);
+    }
+#endif
+#if defined(BYTESET_SSE2)
+    for (; end - ptr >= 16; ptr += 16) {
+      const __m128i block = _mm_loadu_si128((const __m128i *)ptr);
+      __m128i match = _mm_setzero_si128();
+      if (Controls) {
+        match = _mm_cmpeq_epi8(_mm_max_epu8(block, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+      }
+      const char chars[] = { Chars... };
+      for (const char c : chars) {
+        match = _mm_or_si128(match, _mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+      }
+      const unsigned mask = (unsigned)_mm_movemask_epi8(match);
+      if (mask != 0) {
+        return ptr + first_bit(mask);
+      }
+    }
+#endif
+    for (; ptr < end; ++ptr) {
+      if (contains(*ptr)) {
+        return ptr;
+      }
+    }
+    return end;
+  }
+
+private:
+  static unsigned first_bit(unsigned mask)
+  {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+  }
+
+#if defined(BYTESET_AVX2)
+#if defined(BYTESET_AVX2_RUNTIME)
+  static bool has_avx2()
+  {
+    static const bool value = __builtin_cpu_supports("avx2");
+    return value;
+  }
+#endif
+
+  /**
+   * @brief Skip blocks of 32 bytes which have no byte in the set
+   *
+   * @return Pointer to the block which has a byte in the set, or to the
+   *         tail shorter than a block
+   */
+  BYTESET_AVX2_TARGET static const char *find_avx2(const char *ptr, const char *end)
+  {
+    for (; end - ptr >= 32; ptr += 32) {
+      const __m256i block = _mm256_loadu_si256((const __m256i *)ptr);
+      __m256i match = _mm256_setzero_si256();
+      if (Controls) {
+        match = _mm256_cmpeq_epi8(_mm256_max_epu8(block, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(0x1f));
+      }
+      const char chars[] = { Chars... };
+      for (const char c : chars) {
+        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+      }
+      if (!_mm256_testz_si256(match, match)) {
+        break;
+      }
+    }
+    return ptr;
+  }
+#endif
+};
+
+#endif /* _BYTESET_HPP_ */
@@ -0,0 +1,216 @@
+#include "catalog.hpp"
+#include <algorithm>
+#include "log.hpp"
+
+/**
+ * @brief Interval in milliseconds to enumerate ports without notification of devices
+ */
+static const int enumerate_interval = 2000;
+
+/**
+ * @brief Create a monitor to wait for addition and removal of ports
+ *
+ * The default implementation lets ports be enumerated periodically.
+ *
+ * @return A unique pointer to DeviceMonitor object
+ */
+DeviceMonitor::unique_ptr OsPort::create_device_monitor()
+{
+  return DeviceMonitor::unique_ptr(new PollingDeviceMonitor(enumerate_interval));
+}
+
+/**
+ * @brief Match text with a pattern of "*" and "?"
+ */
+static bool match_pattern(const char *pattern, const char *text)
+{
+  const char *star = nullptr;
+  const char *resume = nullptr;
+  while (*text) {
+    if ((*pattern == '?') || ((*pattern != '*') && (*pattern == *text))) {
+      ++pattern;
+      ++text;
+    } else if (*pattern == '*') {
+      star = pattern++;
+      resume = text;
+    } else if (star) {
+      pattern = star + 1;
+      text = ++resume;
+    } else {
+      return false;
+    }
+  }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return !*pattern;
+}
+
+/**
+ * @brief Test if a port meets the filter
+ *
+ * @param info A reference to port information
+ * @return true if all conditions are met
+ */
+bool PortFilter::matches(const SerialPortInfo& info) const
+{
+  return ((vendor_id < 0) || (info.vendor_id == vendor_id)) &&
+    ((product_id < 0) || (info.product_id == product_id)) &&
+    (serial_number.empty() || (info.serial_number == serial_number)) &&
+    (driver.empty() || (info.driver == driver)) &&
+    (path.empty() || match_pattern(path.c_str(), info.path.c_str())) &&
+    (location.empty() || match_pattern(location.c_str(), info.location.c_str()));
+}
+
+/**
+ * @brief Select ports which meet a filter
+ *
+ * With a vendor ID, only USB ports of the vendor are looked up by the
+ * index, instead of testing all ports.
+ *
+ * @param filter A reference to filter
+ * @param result A reference to vector to store ports in order
+ */
+void PortCatalog::Snapshot::select(const PortFilter& filter, std::vector<const SerialPortInfo*>& result) const
+{
+  result.clear();
+  if (filter.vendor_id < 0) {
+    for (const auto& info : ports) {
+      if (filter.matches(info)) {
+        result.push_back(&info);
+      }
+    }
+    return;
+  }
+  const std::uint32_t key = (std::uint32_t)filter.vendor_id << 16;
+  const auto first = std::lower_bound(usb_index.begin(), usb_index.end(),
+    std::make_pair(key | ((filter.product_id < 0) ? 0 : filter.product_id), (std::size_t)0));
+  const auto last = std::lower_bound(first, usb_index.end(),
+    std::make_pair((filter.product_id < 0) ? (key + 0x10000) : (key | (filter.product_id + 1)), (std::size_t)0));
+  for (auto iter = first; iter != last; ++iter) {
+    if (filter.matches(ports[iter->second])) {
+      result.push_back(&ports[iter->second]);
+    }
+  }
+  std::sort(result.begin(), result.end());
+}
+
+PortCatalog::PortCatalog(OsPort& os)
+: os(os), generation(0)
+{
+}
+
+PortCatalog::~PortCatalog()
+{
+  stop();
+}
+
+/**
+ * @brief Enumerate ports and start watching them
+ *
+ * Pseudo ports must have been created before.
+ */
+void PortCatalog::start()
+{
+  if (thread.joinable()) {
+    return;
+  }
+  monitor = os.create_device_monitor();
+  refresh();
+  thread = std::thread([this]{ run(); });
+}
+
+/**
+ * @brief Stop watching ports (the latest snapshot stays available)
+ */
+void PortCatalog::stop()
+{
+  if (!thread.joinable()) {
+    return;
+  }
+  monitor->interrupt();
+  thread.join();
+}
+
+/**
+ * @brief Get the latest snapshot (thread-safe)
+ *
+ * @return A shared pointer to snapshot
+ */
+PortCatalog::snapshot_ptr PortCatalog::get_snapshot() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return snapshot;
+}
+
+/**
+ * @brief Wake up a poller when a new snapshot is published (thread-safe)
+ *
+ * @param poller Poller to wake up
+ */
+void PortCatalog::add_poller(const Poller::shared_ptr& poller)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  pollers.push_back(poller);
+}
+
+/**
+ * @brief Stop waking up a poller (thread-safe)
+ *
+ * @param poller Poller added by add_poller()
+ */
+void PortCatalog::remove_poller(const Poller::shared_ptr& poller)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  pollers.erase(std::remove(pollers.begin(), pollers.end(), poller), pollers.end());
+}
+
+void PortCatalog::run()
+{
+  while (monitor->wait()) {
+    if (!refresh()) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& poller : pollers) {
+      poller->wakeup();
+    }
+  }
+}
+
+/**
+ * @brief Enumerate ports and publish them if they have changed
+ *
+ * @return true if a new snapshot has been published
+ */
+bool PortCatalog::refresh()
+{
+  std::shared_ptr<Snapshot> next(new Snapshot);
+  try {
+    next->ports = os.enumerate();
+  } catch (const std::exception& e) {
+    Log(LOG_WARNING, "cannot enumerate ports").add("error", e.what());
+    return false;
+  }
+  std::stable_sort(next->ports.begin(), next->ports.end(), [](const SerialPortInfo& a, const SerialPortInfo& b){
+    return a.order < b.order;
+  });
+  const auto current = get_snapshot();
+  if (current && (current->ports == next->ports)) {
+    return false;
+  }
+  for (std::size_t index = 0; index < next->ports.size(); ++index) {
+    const auto& info = next->ports[index];
+    if ((info.vendor_id >= 0) && (info.product_id >= 0)) {
+      next->usb_index.emplace_back(((std::uint32_t)info.vendor_id << 16) | info.product_id, index);
+    }
+  }
+  std::sort(next->usb_index.begin(), next->usb_index.end());
+  next->generation = current ? (current->generation + 1) : 1;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshot = next;
+  }
+  generation = next->generation;
+  return true;
+}
@@ -0,0 +1,96 @@
+#ifndef _CATALOG_HPP_
+#define _CATALOG_HPP_
+
+#include "osport.hpp"
+#include "poller.hpp"
+#include "hotplug.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Condition to select ports
+ *
+ * Patterns of path and location may contain "*" (any characters) and
+ * "?" (any one character).
+ */
+struct PortFilter
+{
+  PortFilter() : vendor_id(-1), product_id(-1) {}
+
+  bool matches(const SerialPortInfo& info) const;
+
+  int vendor_id;              ///< USB vendor ID to match (-1 for any)
+  int product_id;             ///< USB product ID to match (-1 for any)
+  std::string serial_number;  ///< Serial number to match (empty for any)
+  std::string driver;         ///< Driver name to match (empty for any)
+  std::string path;           ///< Pattern of path (empty for any)
+  std::string location;       ///< Pattern of location (empty for any)
+};
+
+/**
+ * @brief Cache of enumerated ports
+ *
+ * Ports are enumerated by a thread of the catalog when the device
+ * monitor of the OS tells that they may have changed, and the result is
+ * published as an immutable snapshot. Reactors read the snapshot without
+ * any I/O, and their pollers are woken up when a new snapshot has been
+ * published, so that they can push the differences.
+ */
+class PortCatalog
+{
+public:
+  /**
+   * @brief Result of one enumeration
+   */
+  struct Snapshot
+  {
+    void select(const PortFilter& filter, std::vector<const SerialPortInfo*>& result) const;
+
+    std::uint64_t generation;         ///< Serial number (increases on every change)
+    std::vector<SerialPortInfo> ports;  ///< Ports in order of SerialPortInfo::order
+    std::vector<std::pair<std::uint32_t, std::size_t>> usb_index;  ///< (VID << 16 | PID, index of port) in order
+  };
+
+  /**
+   * @brief Type alias definition for shared pointer to snapshot
+   */
+  using snapshot_ptr = std::shared_ptr<const Snapshot>;
+
+  PortCatalog(OsPort& os);
+  ~PortCatalog();
+
+  void start();
+  void stop();
+
+  /**
+   * @brief Get generation of the latest snapshot (thread-safe)
+   */
+  std::uint64_t get_generation() const
+  {
+    return generation;
+  }
+
+  snapshot_ptr get_snapshot() const;
+  void add_poller(const Poller::shared_ptr& poller);
+  void remove_poller(const Poller::shared_ptr& poller);
+
+private:
+  void run();
+  bool refresh();
+
+  OsPort& os;
+  DeviceMonitor::unique_ptr monitor;
+  std::thread thread;
+  snapshot_ptr snapshot;
+  std::atomic<std::uint64_t> generation;
+  mutable std::mutex mutex;
+  std::vector<Poller::shared_ptr> pollers;
+};
+
+#endif /* _CATALOG_HPP_ */
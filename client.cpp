@@ -1,123 +1,1238 @@
 #include "client.hpp"
 #include "server.hpp"
+#include "reactor.hpp"
 #include "osport.hpp"
+#include "options.hpp"
+#include "codec.hpp"
+#include "log.hpp"
+
+/**
+ * @brief Number of pending reply bytes to stop receiving requests
+ */
+static const std::size_t pending_limit = 256 * 1024;
+
+/**
+ * @brief Number of completed reply bytes to send before the whole batch
+ */
+static const std::size_t flush_threshold = 64 * 1024;
+
+/**
+ * @brief Default number of bytes to push without waiting for latency
+ */
+static const std::size_t default_push_size = 4096;
+
+/**
+ * @brief Default milliseconds to wait for more bytes before pushing
+ */
+static const int default_push_latency = 2;
+
+/**
+ * @brief Default credit given by subscribing
+ */
+static const std::size_t default_push_credit = 64 * 1024;
+
+/**
+ * @brief Default size of receive ring backed by spill file
+ */
+static const std::size_t default_spill_size = 16 * 1024 * 1024;
+
+/**
+ * @brief Maximum size of receive ring backed by spill file
+ */
+static const std::size_t max_spill_size = 1024 * 1024 * 1024;
+
+/**
+ * @brief Number of bytes queued to transmit on a port to let more writes wait
+ */
+static const std::size_t tx_buffer_limit = 64 * 1024;
+
+/**
+ * @brief Maximum number of requests waiting on one session
+ */
+static const std::size_t max_pending_requests = 1024;
+
+/**
+ * @brief Size of the first chunk of arena which holds a waiting request
+ */
+static const std::size_t request_arena_size = 256;
+
+/**
+ * @brief Hash operation name (FNV-1a)
+ *
+ * Used as case labels in Client::find_operation(), so that a collision
+ * between operation names is detected at compile time.
+ */
+static constexpr std::uint32_t hash_name(const char *name, std::uint32_t hash = 2166136261u)
+{
+  return *name ? hash_name(name + 1, (hash ^ (unsigned char)*name) * 16777619u) : hash;
+}
+
+/**
+ * @brief Hash operation name which is not null-terminated
+ *
+ * Gives the same hash as hash_name(const char*, std::uint32_t).
+ */
+static std::uint32_t hash_name(const JsonString& name)
+{
+  std::uint32_t hash = 2166136261u;
+  for (std::size_t index = 0; index < name.size(); ++index) {
+    hash = (hash ^ (unsigned char)name.data()[index]) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Get time elapsed since a time point
+ *
+ * @param start Time point
+ * @return Elapsed time in nanoseconds
+ */
+static std::uint64_t get_elapsed_time(TimerQueue::clock::time_point start)
+{
+  return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    TimerQueue::clock::now() - start).count();
+}
+
+/**
+ * @brief Get session ID targeted by a request
+ *
+ * @param input A reference to input JSON value
+ * @param session Session ID given by frame header (0 if none)
+ * @return Session ID (0 if the request does not target a session)
+ */
+static int get_request_session(const Client::jvalue& input, int session)
+{
+  if (session > 0) {
+    return session;
+  }
+  const auto& value = input.at("session");
+  return value.is_number() ? (int)value.as_integer() : 0;
+}
+
+/**
+ * @brief Get encoding of data selected by a request
+ *
+ * @param input A reference to input JSON value
+ * @return Encoding ("encoding" member, ENCODING_NONE if omitted)
+ */
+static PayloadEncoding get_request_encoding(const Client::jvalue& input)
+{
+  const auto& value = input.at("encoding");
+  if (value.is_null()) {
+    return ENCODING_NONE;
+  }
+  const auto name = value.as_string();
+  if (name == "base64") {
+    return ENCODING_BASE64;
+  } else if (name == "hex") {
+    return ENCODING_HEX;
+  }
+  throw std::invalid_argument("invalid encoding: " + name.str());
+}
+
+/**
+ * @brief Get framing selected by a request
+ *
+ * "framing" is "none", "slip", "cobs", or an object with "mode":
+ * - "delimiter" with "delimiter" (a byte number or a one-character string),
+ * - "fixed" with "length",
+ * - "length" with "offset" and "size" (1, 2 or 4 bytes) of the length
+ *   field, "endian" ("big" or "little") and "adjust" (added to the field
+ *   to get the number of bytes after it).
+ *
+ * @param value A reference to "framing" member
+ * @return Framer
+ */
+static Framer get_request_framer(const Client::jvalue& value)
+{
+  Framer framer = {};
+  const auto mode = (value.is_object() ? value.at("mode") : value).as_string();
+  if (mode == "none") {
+    framer.mode = Framer::FRAMING_NONE;
+  } else if (mode == "slip") {
+    framer.mode = Framer::FRAMING_SLIP;
+  } else if (mode == "cobs") {
+    framer.mode = Framer::FRAMING_COBS;
+  } else if (mode == "delimiter") {
+    framer.mode = Framer::FRAMING_DELIMITER;
+    const auto& delimiter = value.at("delimiter");
+    if (delimiter.is_string()) {
+      const auto ch = delimiter.as_string();
+      if (ch.size() != 1) {
+        throw std::invalid_argument("invalid delimiter: " + ch.str());
+      }
+      framer.delimiter = ch.data()[0];
+    } else {
+      const auto ch = delimiter.as_integer();
+      if ((ch < 0) || (ch > 255)) {
+        throw std::invalid_argument("invalid delimiter: " + std::to_string(ch));
+      }
+      framer.delimiter = (char)ch;
+    }
+  } else if (mode == "fixed") {
+    framer.mode = Framer::FRAMING_FIXED;
+    const auto length = value.at("length").as_integer();
+    if (length <= 0) {
+      throw std::invalid_argument("invalid frame length: " + std::to_string(length));
+    }
+    framer.frame_length = length;
+  } else if (mode == "length") {
+    framer.mode = Framer::FRAMING_LENGTH;
+    const auto& offset = value.at("offset");
+    const auto field_offset = offset.is_null() ? 0 : offset.as_integer();
+    if (field_offset < 0) {
+      throw std::invalid_argument("invalid field offset: " + std::to_string(field_offset));
+    }
+    framer.field_offset = field_offset;
+    const auto& size = value.at("size");
+    framer.field_size = size.is_null() ? 1 : size.as_integer();
+    if ((framer.field_size != 1) && (framer.field_size != 2) && (framer.field_size != 4)) {
+      throw std::invalid_argument("invalid field size: " + std::to_string(framer.field_size));
+    }
+    const auto& endian = value.at("endian");
+    framer.big_endian = true;
+    if (!endian.is_null()) {
+      const auto name = endian.as_string();
+      if (name == "little") {
+        framer.big_endian = false;
+      } else if (name != "big") {
+        throw std::invalid_argument("invalid endian: " + name.str());
+      }
+    }
+    const auto& adjust = value.at("adjust");
+    framer.field_adjust = adjust.is_null() ? 0 : adjust.as_integer();
+  } else {
+    throw std::invalid_argument("invalid framing mode: " + mode.str());
+  }
+  return framer;
+}
+
+/**
+ * @brief Names of modem lines in order of ModemLine bits
+ */
+static const char* const modem_line_names[] = { "dtr", "rts", "cts", "dsr", "dcd", "ri", "break" };
+
+/**
+ * @brief Get modem output lines to change by a request
+ *
+ * @param input A reference to object with "dtr", "rts" and "break"
+ * @param mask A reference to store lines to change
+ * @return Lines to activate among mask
+ */
+static int get_request_modem_lines(const Client::jvalue& input, int& mask)
+{
+  int lines = 0;
+  mask = 0;
+  for (std::size_t index = 0; index < sizeof(modem_line_names) / sizeof(*modem_line_names); ++index) {
+    const int line = (1 << index);
+    if (!(line & MODEM_OUTPUTS)) {
+      continue;
+    }
+    const auto& value = input.at(modem_line_names[index]);
+    if (!value.is_null()) {
+      mask |= line;
+      lines |= value.as_boolean() ? line : 0;
+    }
+  }
+  return lines;
+}
+
+/**
+ * @brief Put modem lines into an object
+ *
+ * @param lines Lines which are active (combination of MODEM_*)
+ * @param mask Lines to put
+ * @param output A reference to output JSON value (object)
+ */
+static void put_modem_lines(int lines, int mask, Client::jvalue& output)
+{
+  for (std::size_t index = 0; index < sizeof(modem_line_names) / sizeof(*modem_line_names); ++index) {
+    if (mask & (1 << index)) {
+      output[modem_line_names[index]] = (bool)(lines & (1 << index));
+    }
+  }
+}
+
+/**
+ * @brief Put information of a port into an object
+ *
+ * @param info A reference to port information
+ * @param item A reference to output JSON value (object)
+ */
+static void put_port_info(const SerialPortInfo& info, Client::jvalue& item)
+{
+  item["path"] = info.path;
+  item["name"] = info.name;
+  if (info.vendor_id >= 0) {
+    item["vid"] = info.vendor_id;
+  }
+  if (info.product_id >= 0) {
+    item["pid"] = info.product_id;
+  }
+  if (!info.serial_number.empty()) {
+    item["serial"] = info.serial_number;
+  }
+  if (!info.location.empty()) {
+    item["location"] = info.location;
+  }
+  if (!info.driver.empty()) {
+    item["driver"] = info.driver;
+  }
+}
+
+/**
+ * @brief Get USB ID given by a filter
+ *
+ * @param value A reference to number, or string of hexadecimal digits
+ * @return ID (-1 if omitted)
+ */
+static int get_filter_id(const Client::jvalue& value)
+{
+  if (value.is_null()) {
+    return -1;
+  }
+  int id;
+  if (value.is_string()) {
+    const auto text = value.as_string().str();
+    char *end;
+    id = (int)std::strtol(text.c_str(), &end, 16);
+    if (text.empty() || *end) {
+      throw std::invalid_argument("invalid ID: " + text);
+    }
+  } else {
+    id = value.as_integer();
+  }
+  if ((id < 0) || (id > 0xffff)) {
+    throw std::invalid_argument("invalid ID: " + std::to_string(id));
+  }
+  return id;
+}
+
+/**
+ * @brief Get filter of ports given by a request
+ *
+ * "filter" has "vid" and "pid" (numbers, or strings of hexadecimal
+ * digits), "serial" and "driver" to match exactly, and "path" and
+ * "location" to match patterns of "*" and "?".
+ *
+ * @param value A reference to "filter" member
+ * @return Filter
+ */
+static PortFilter get_request_filter(const Client::jvalue& value)
+{
+  PortFilter filter;
+  filter.vendor_id = get_filter_id(value.at("vid"));
+  filter.product_id = get_filter_id(value.at("pid"));
+  for (const auto& item : { std::make_pair("serial", &filter.serial_number),
+                            std::make_pair("driver", &filter.driver),
+                            std::make_pair("path", &filter.path),
+                            std::make_pair("location", &filter.location) }) {
+    const auto& member = value.at(item.first);
+    if (!member.is_null()) {
+      *item.second = member.as_string().str();
+    }
+  }
+  return filter;
+}
+
+/**
+ * @brief Operations in order of FrameHeader::Opcode
+ */
+const Client::Operation Client::operations[] = {
+  { "list", &Client::list, false },
+  { "open", &Client::open, false },
+  { "config", &Client::config, true },
+  { "modem", &Client::modem, true },
+  { "write", &Client::write, true },
+  { "read", &Client::read, true },
+  { "close", &Client::close, false },
+  { "subscribe", &Client::subscribe, true },
+  { "stats", &Client::stats, false },
+  { "log", &Client::log, false },
+};
+
+/**
+ * @brief Get name of operation
+ *
+ * @param index Index of operation (opcode - 1)
+ * @return Name of operation (nullptr if out of range)
+ */
+const char *Client::get_operation_name(std::size_t index)
+{
+  return (index < operation_count) ? operations[index].name : nullptr;
+}
+
+/**
+ * @brief Find operation by name
+ *
+ * @param name Name of operation
+ * @return Pointer to operation (nullptr if not found)
+ */
+const Client::Operation *Client::find_operation(const JsonString& name)
+{
+  int opcode;
+  switch (hash_name(name)) {
+  case hash_name("list"):       opcode = FrameHeader::OP_LIST; break;
+  case hash_name("open"):       opcode = FrameHeader::OP_OPEN; break;
+  case hash_name("config"):     opcode = FrameHeader::OP_CONFIG; break;
+  case hash_name("modem"):      opcode = FrameHeader::OP_MODEM; break;
+  case hash_name("write"):      opcode = FrameHeader::OP_WRITE; break;
+  case hash_name("read"):       opcode = FrameHeader::OP_READ; break;
+  case hash_name("close"):      opcode = FrameHeader::OP_CLOSE; break;
+  case hash_name("subscribe"):  opcode = FrameHeader::OP_SUBSCRIBE; break;
+  case hash_name("stats"):      opcode = FrameHeader::OP_STATS; break;
+  case hash_name("log"):        opcode = FrameHeader::OP_LOG; break;
+  default:
+    return nullptr;
+  }
+  const auto operation = &operations[opcode - 1];
+  return (name == operation->name) ? operation : nullptr;
+}
 
 /**
  * @brief Construct a new Client object
  * 
- * @param server A reference to Server object
+ * @param reactor A reference to Reactor object which owns this client
+ * @param socket A socket to client
+ */
+Client::Client(Reactor& reactor, const Socket::shared_ptr& socket)
+: reactor(reactor), server(reactor.server), socket(socket), state(STATE_RECEIVING), protocol(PROTOCOL_UNKNOWN),
+  last_request_id(0), deferred(false), request_expired(false), defer_timeout(-1), list_watch(false),
+  completed_requests(0), received_bytes(0), pushed_bytes(0)
+{
+}
+
+/**
+ * @brief Destroy the Client object
  */
-Client::Client(Server& server)
-: server(server)
+Client::~Client()
 {
+  socket->close();
 }
 
 /**
  * @brief Start conversation with client
- * 
- * @param socket A socket to client
  */
-void Client::run(const Socket::shared_ptr& socket)
-{
-  static struct {
-    const char* name;
-    void (Client::*func)(const jvalue& input, jvalue::object_type& output, int session);
-  } const operations[] = {
-    { "list", &Client::list },
-    { "open", &Client::open },
-    { "config", &Client::config },
-    { "modem", &Client::modem },
-    { "write", &Client::write },
-    { "read", &Client::read },
-    { "close", &Client::close },
-    { nullptr }
-  };
-
-  std::istream in(socket.get());
+void Client::start()
+{
+  reactor.poller->add_socket(*socket, Poller::POLL_IN, [this](int events){
+    handle_event(events);
+  });
+}
+
+/**
+ * @brief Push received bytes of a subscribed session
+ *
+ * @param session Session ID
+ * @param data Pointer to bytes
+ * @param length Number of bytes
+ */
+void Client::push(int session, const char *data, std::size_t length)
+{
+  if ((state != STATE_RECEIVING) && (state != STATE_SENDING)) {
+    return;
+  }
   std::ostream out(socket.get());
-  for (;;) {
-    auto input_value = json5pp::parse(in, false);
-    const auto& input_object = input_value.as_object();
+  if (protocol == PROTOCOL_BINARY) {
+    FrameHeader header = { (std::uint32_t)length, FrameHeader::OP_PUSH, 0, (std::uint32_t)session, 0 };
+    char encoded[FrameHeader::size];
+    header.encode(encoded);
+    out.write(encoded, sizeof(encoded));
+    out.write(data, length);
+  } else {
+    reply_text.assign("{\"push\":{\"session\":");
+    reply_text.append(std::to_string(session));
+    reply_text.append(",\"data\":");
+    jvalue::bytes(data, length).stringify(reply_text);
+    reply_text.append("}}");
+    out.write(reply_text.data(), reply_text.size());
+  }
+  out.flush();
+  pushed_bytes += length;
+  try {
+    socket->flush_pending();
+  } catch (const std::exception&) {
+    // Reported by the next socket event
+  }
+  update_state();
+}
 
-    auto output_value = json5pp::object({});
-    auto& output_object = output_value.as_object();
+/**
+ * @brief Push a change of modem lines of a session
+ *
+ * The event carries "time" (microseconds since the Unix epoch), input
+ * lines after the change, and "changed" (names of lines which changed;
+ * a line may have pulsed and be back to its previous level).
+ *
+ * @param session Session ID
+ * @param event A reference to event
+ */
+void Client::push_modem(int session, const ModemEvent& event)
+{
+  if ((state != STATE_RECEIVING) && (state != STATE_SENDING)) {
+    return;
+  }
+  jvalue event_value(arena);
+  event_value.set_object();
+  event_value["time"] = (double)event.time;
+  put_modem_lines(event.lines, MODEM_INPUTS, event_value);
+  auto& changed = event_value["changed"].set_array();
+  for (std::size_t index = 0; index < sizeof(modem_line_names) / sizeof(*modem_line_names); ++index) {
+    if (event.changed & (1 << index)) {
+      changed.push_back(modem_line_names[index]);
+    }
+  }
+  std::ostream out(socket.get());
+  reply_text.clear();
+  if (protocol == PROTOCOL_BINARY) {
+    event_value.stringify(reply_text);
+    FrameHeader header = { (std::uint32_t)reply_text.size(), FrameHeader::OP_MODEM_EVENT, 0, (std::uint32_t)session, 0 };
+    char encoded[FrameHeader::size];
+    header.encode(encoded);
+    out.write(encoded, sizeof(encoded));
+  } else {
+    reply_text.assign("{\"push\":{\"session\":");
+    reply_text.append(std::to_string(session));
+    reply_text.append(",\"modem\":");
+    event_value.stringify(reply_text);
+    reply_text.append("}}");
+  }
+  out.write(reply_text.data(), reply_text.size());
+  out.flush();
+  arena.reset();
+  try {
+    socket->flush_pending();
+  } catch (const std::exception&) {
+    // Reported by the next socket event
+  }
+  update_state();
+}
+
+/**
+ * @brief Push ports added to and removed from the port list
+ *
+ * Sent only if the client watches the list. The change carries "added"
+ * (ports as listed by "list") and "removed" (paths of ports). A port
+ * whose information has changed is listed as added again.
+ *
+ * @param added Ports added
+ * @param removed Ports removed
+ */
+void Client::push_ports(const std::vector<const SerialPortInfo*>& added,
+                        const std::vector<const SerialPortInfo*>& removed)
+{
+  if (!list_watch || ((state != STATE_RECEIVING) && (state != STATE_SENDING))) {
+    return;
+  }
+  jvalue change_value(arena);
+  change_value.set_object();
+  auto& added_array = change_value["added"].set_array();
+  for (const auto info : added) {
+    put_port_info(*info, added_array.append().set_object());
+  }
+  auto& removed_array = change_value["removed"].set_array();
+  for (const auto info : removed) {
+    removed_array.push_back(info->path);
+  }
+  std::ostream out(socket.get());
+  reply_text.clear();
+  if (protocol == PROTOCOL_BINARY) {
+    change_value.stringify(reply_text);
+    FrameHeader header = { (std::uint32_t)reply_text.size(), FrameHeader::OP_LIST_EVENT, 0, 0, 0 };
+    char encoded[FrameHeader::size];
+    header.encode(encoded);
+    out.write(encoded, sizeof(encoded));
+  } else {
+    reply_text.assign("{\"push\":{\"list\":");
+    change_value.stringify(reply_text);
+    reply_text.append("}}");
+  }
+  out.write(reply_text.data(), reply_text.size());
+  out.flush();
+  arena.reset();
+  try {
+    socket->flush_pending();
+  } catch (const std::exception&) {
+    // Reported by the next socket event
+  }
+  update_state();
+}
 
-    for (auto operation = operations;; ++operation) {
-      auto name = operation->name;
-      auto func = operation->func;
-      if (!name || !func) {
+/**
+ * @brief Handle socket events
+ *
+ * @param events Combination of Poller::POLL_*
+ */
+void Client::handle_event(int events)
+{
+  try {
+    if ((events & (Poller::POLL_IN | Poller::POLL_ERROR)) &&
+        ((state == STATE_RECEIVING) || (state == STATE_SENDING))) {
+      receive();
+    }
+    socket->flush_pending();
+    update_state();
+  } catch (const std::exception& e) {
+    Log(LOG_ERROR, "connection failed").add("reactor", reactor.index).add("error", e.what());
+    disconnect();
+  }
+}
+
+/**
+ * @brief Receive and process requests
+ *
+ * Replies to all requests received in one call are sent together by the
+ * caller, so a burst of requests costs one send.
+ */
+void Client::receive()
+{
+  while (socket->get_pending_size() < pending_limit) {
+    int len;
+    try {
+      len = socket->receive();
+    } catch (const std::length_error& e) {
+      reject(e.what());
+      return;
+    }
+    if (len < 0) {
+      state = STATE_CLOSING;
+      return;
+    }
+    if (len == 0) {
+      return;
+    }
+    received_bytes += len;
+    if (protocol == PROTOCOL_UNKNOWN) {
+      select_protocol();
+    }
+    if (protocol == PROTOCOL_BINARY) {
+      receive_frames();
+    } else {
+      receive_documents();
+    }
+    if (state == STATE_CLOSING) {
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Answer a request which cannot be processed, and close after replies
+ *
+ * @param error Error message
+ */
+void Client::reject(const char *error)
+{
+  jvalue output_value(arena);
+  output_value.set_object()["error"] = error;
+  std::ostream out(socket.get());
+  if (protocol == PROTOCOL_BINARY) {
+    put_frame(FrameHeader(), output_value, out);
+  } else {
+    reply_text.clear();
+    output_value.stringify(reply_text);
+    out.write(reply_text.data(), reply_text.size()).flush();
+  }
+  arena.reset();
+  state = STATE_CLOSING;
+}
+
+/**
+ * @brief Select protocol by the first byte received
+ */
+void Client::select_protocol()
+{
+  if ((unsigned char)socket->get_read_data()[0] != FrameHeader::magic) {
+    protocol = PROTOCOL_JSON;
+    return;
+  }
+  socket->consume(1);
+  protocol = PROTOCOL_BINARY;
+  std::ostream out(socket.get());
+  out.put((char)FrameHeader::magic) << std::flush;
+  Log(LOG_DEBUG, "binary protocol selected").add("reactor", reactor.index);
+}
+
+/**
+ * @brief Process JSON5 documents received completely
+ *
+ * A document which is not a valid request is answered with an error,
+ * and the connection is closed because the rest cannot be delimited.
+ */
+void Client::receive_documents()
+{
+  std::ostream out(socket.get());
+
+  for (;;) {
+    std::size_t length;
+    jvalue input_value(arena);
+    try {
+      length = scanner.scan(socket->get_read_data(), socket->get_read_size());
+      if (length == 0) {
         break;
       }
-      auto iter = input_object.find(name);
-      if ((iter != input_object.end()) && (iter->second)) {
-        const auto& input_item = iter->second;
-        auto& output_item = (output_object[name] = json5pp::object({})).as_object();
-        const auto& input_sequence = input_item["sequence"];
-        if (!input_sequence.is_null()) {
-          output_item["sequence"] = input_sequence;
+      // Input refers to the receive buffer until the document is consumed
+      const auto parse_start = TimerQueue::clock::now();
+      input_value = jvalue::parse(arena, socket->get_read_data(), length);
+      reactor.metrics.parse_time.record(get_elapsed_time(parse_start));
+    } catch (const std::invalid_argument& e) {
+      reject(e.what());
+      return;
+    }
+    jvalue output_value(arena);
+    output_value.set_object();
+    if (process(input_value, output_value)) {
+      reply_text.clear();
+      output_value.stringify(reply_text);
+      out.write(reply_text.data(), reply_text.size()).flush();
+    }
+    socket->consume(length);
+    arena.reset();
+    if (socket->get_committed_size() >= flush_threshold) {
+      socket->flush_pending(true);
+    }
+  }
+}
+
+/**
+ * @brief Process binary frames received completely
+ */
+void Client::receive_frames()
+{
+  std::ostream out(socket.get());
+
+  while (socket->get_read_size() >= FrameHeader::size) {
+    FrameHeader header;
+    header.decode(socket->get_read_data());
+    if (header.length > FrameHeader::max_length) {
+      throw std::invalid_argument("frame too long: " + std::to_string(header.length));
+    }
+    const std::size_t length = FrameHeader::size + header.length;
+    if (socket->get_read_size() < length) {
+      break;
+    }
+    process_frame(header, socket->get_read_data() + FrameHeader::size, out);
+    socket->consume(length);
+    if (socket->get_committed_size() >= flush_threshold) {
+      socket->flush_pending(true);
+    }
+  }
+}
+
+/**
+ * @brief Process a request
+ *
+ * @param input_value A reference to input JSON value
+ * @param output_value A reference to output JSON value
+ * @return false if no reply is needed now (all operations are waiting)
+ */
+bool Client::process(const jvalue& input_value, jvalue& output_value)
+{
+  bool waiting = false;
+
+  // Operations present run in the order of the table
+  const jvalue *input_items[operation_count] = { nullptr };
+  for (const auto& item : input_value.as_object()) {
+    auto operation = find_operation(item.key);
+    if (operation && item.value) {
+      input_items[operation - operations] = &item.value;
+    }
+  }
+
+  for (std::size_t index = 0; index < operation_count; ++index) {
+    if (input_items[index]) {
+      const auto operation = &operations[index];
+      const auto name = operation->name;
+      const auto& input_item = *input_items[index];
+      const int session = get_request_session(input_item, 0);
+      auto& output_item = output_value[name].set_object();
+      const auto& input_sequence = input_item["sequence"];
+      if (!input_sequence.is_null()) {
+        output_item["sequence"] = input_sequence;
+      }
+      if ((session > 0) && operation->ordered && pending_requests.count(session)) {
+        if (enqueue(session, *operation, input_item, FrameHeader(), false)) {
+          output_value.erase(name);
+          waiting = true;
+        } else {
+          output_item["error"] = "too many pending requests";
         }
-        (this->*func)(input_item, output_item, 0);
+      } else if (!execute(*operation, input_item, output_item, 0, false)) {
+        output_value.erase(name);
+        enqueue(session, *operation, input_item, FrameHeader(), true);
+        waiting = true;
+      }
+    }
+  }
+  return !(waiting && output_value.empty());
+}
+
+/**
+ * @brief Process a binary frame and put its reply
+ *
+ * @param header A reference to request header
+ * @param payload Pointer to request payload (header.length bytes)
+ * @param out Stream to put reply
+ */
+void Client::process_frame(const FrameHeader& header, const char *payload, std::ostream& out)
+{
+  jvalue output_item(arena);
+  output_item.set_object();
+  try {
+    if ((header.opcode < 1) || (header.opcode > operation_count)) {
+      throw std::invalid_argument("invalid opcode: " + std::to_string(header.opcode));
+    }
+    jvalue input_item(arena);
+    if (header.opcode == FrameHeader::OP_WRITE) {
+      input_item.set_object()["data"] = jvalue::view(payload, header.length);
+      if (header.flags & FrameHeader::FLAG_ACK_DRAINED) {
+        input_item["ack"] = "drained";
+      } else if (header.flags & FrameHeader::FLAG_ACK_SENT) {
+        input_item["ack"] = "sent";
       }
+    } else if (header.length == 0) {
+      input_item.set_object();
+    } else {
+      const auto parse_start = TimerQueue::clock::now();
+      input_item = jvalue::parse(arena, payload, header.length);
+      reactor.metrics.parse_time.record(get_elapsed_time(parse_start));
+    }
+    const auto& operation = operations[header.opcode - 1];
+    const int session = get_request_session(input_item, header.session);
+    if ((session > 0) && operation.ordered && pending_requests.count(session)) {
+      if (!enqueue(session, operation, input_item, header, false)) {
+        throw std::runtime_error("too many pending requests");
+      }
+      return;
+    }
+    if (!execute(operation, input_item, output_item, header.session, false)) {
+      enqueue(session, operation, input_item, header, true);
+      return;
     }
+  } catch (const std::exception& e) {
+    output_item["error"] = e.what();
+  }
+  put_frame(header, output_item, out);
+}
 
-    out << output_value;
+/**
+ * @brief Run an operation
+ *
+ * @param operation A reference to operation
+ * @param input A reference to input JSON value
+ * @param output A reference to output JSON value (object)
+ * @param session Session ID given by frame header (0 if none)
+ * @param expired true if the timeout of waiting has expired
+ * @return true if completed, false if the operation waits (see defer())
+ */
+bool Client::execute(const Operation& operation, const jvalue& input, jvalue& output,
+                     int session, bool expired)
+{
+  static_assert(operation_count <= ReactorMetrics::max_operations, "too many operations for metrics");
+  const std::size_t index = &operation - operations;
+  deferred = false;
+  request_expired = expired;
+  try {
+    (this->*operation.func)(input, output, session);
+  } catch (const std::exception& e) {
+    deferred = false;
+    output["error"] = e.what();
+    reactor.metrics.errors[index].add();
   }
+  if (deferred) {
+    return false;
+  }
+  reactor.metrics.requests[index].add();
+  ++completed_requests;
+  return true;
+}
+
+/**
+ * @brief Let the running operation wait for its session
+ *
+ * Called by an operation instead of producing output, after it has told
+ * the reactor what to wait for (Reactor::wait_session() or
+ * Reactor::wait_transmit()). The operation is run again when the reactor
+ * resumes it or the timeout expires.
+ *
+ * @param timeout Timeout in milliseconds (-1 for none)
+ */
+void Client::defer(int timeout)
+{
+  deferred = true;
+  defer_timeout = timeout;
+}
+
+/**
+ * @brief Keep a request in the queue of its session
+ *
+ * @param session Session ID
+ * @param operation A reference to operation
+ * @param input A reference to input of operation (copied)
+ * @param header A reference to request header (binary protocol)
+ * @param waiting true if the request has been run and is waiting
+ * @return false if the queue is full
+ */
+bool Client::enqueue(int session, const Operation& operation, const jvalue& input, const FrameHeader& header, bool waiting)
+{
+  auto& queue = pending_requests[session];
+  if (queue.size() >= max_pending_requests) {
+    return false;
+  }
+  std::unique_ptr<Arena> request_arena(new Arena(request_arena_size));
+  const auto copied_input = input.clone(*request_arena);
+  queue.push_back(Request{&operation, std::move(request_arena), copied_input, header, ++last_request_id, false, false});
+  if (waiting) {
+    start_timeout(session, queue.back());
+  }
+  return true;
+}
+
+/**
+ * @brief Start timer for the request which has just deferred
+ *
+ * @param session Session ID
+ * @param request A reference to request at the head of queue
+ */
+void Client::start_timeout(int session, Request& request)
+{
+  if (request.timer_running || (defer_timeout < 0)) {
+    return;
+  }
+  const auto id = request.id;
+  request.timer = reactor.timers.add(std::chrono::milliseconds(defer_timeout), [this, session, id](){
+    auto iter = pending_requests.find(session);
+    if ((iter == pending_requests.end()) || (iter->second.front().id != id)) {
+      return;
+    }
+    iter->second.front().timer_running = false;
+    iter->second.front().expired = true;
+    resume(session);
+  });
+  request.timer_running = true;
+}
+
+/**
+ * @brief Run requests waiting on a session as far as they complete
+ *
+ * @param session Session ID
+ */
+void Client::resume(int session)
+{
+  auto iter = pending_requests.find(session);
+  if ((iter == pending_requests.end()) ||
+      ((state != STATE_RECEIVING) && (state != STATE_SENDING))) {
+    return;
+  }
+  auto& queue = iter->second;
+  std::ostream out(socket.get());
+  while (!queue.empty()) {
+    auto& request = queue.front();
+    jvalue output_value(arena);
+    output_value.set_object();
+    const bool completed = execute(*request.operation, request.input, output_value,
+                                   request.header.session, request.expired);
+    if (!completed) {
+      arena.reset();
+      start_timeout(session, request);
+      break;
+    }
+    if (request.timer_running) {
+      reactor.timers.cancel(request.timer);
+    }
+    put_reply(request, output_value, out);
+    arena.reset();
+    queue.pop_front();
+  }
+  if (queue.empty()) {
+    pending_requests.erase(iter);
+  }
+  try {
+    socket->flush_pending();
+  } catch (const std::exception&) {
+    // Reported by the next socket event
+  }
+  update_state();
+}
+
+/**
+ * @brief Answer requests waiting on a session with an error
+ *
+ * Called before the session is closed, so that requests which would
+ * wait for it forever are not left unanswered.
+ *
+ * @param session Session ID
+ * @param error Error message
+ */
+void Client::fail_requests(int session, const std::string& error)
+{
+  auto iter = pending_requests.find(session);
+  if (iter == pending_requests.end()) {
+    return;
+  }
+  const bool connected = (state == STATE_RECEIVING) || (state == STATE_SENDING);
+  std::ostream out(socket.get());
+  for (auto& request : iter->second) {
+    if (request.timer_running) {
+      reactor.timers.cancel(request.timer);
+    }
+    if (connected) {
+      jvalue output_value(arena);
+      output_value.set_object()["error"] = error;
+      put_reply(request, output_value, out);
+    }
+    reactor.metrics.errors[request.operation - operations].add();
+  }
+  pending_requests.erase(iter);
+  if (!connected) {
+    return;
+  }
+  try {
+    socket->flush_pending();
+  } catch (const std::exception&) {
+    // Reported by the next socket event
+  }
+  update_state();
+}
+
+/**
+ * @brief Put reply of a request completed later
+ *
+ * @param request A reference to request
+ * @param output_value A reference to output JSON value of operation
+ * @param out Stream to put reply
+ */
+void Client::put_reply(const Request& request, jvalue& output_value, std::ostream& out)
+{
+  if (protocol == PROTOCOL_BINARY) {
+    put_frame(request.header, output_value, out);
+    return;
+  }
+  const auto& input_sequence = request.input["sequence"];
+  if (!input_sequence.is_null()) {
+    output_value["sequence"] = input_sequence;
+  }
+  jvalue reply(arena);
+  reply.set_object()[request.operation->name] = output_value;
+  reply_text.clear();
+  reply.stringify(reply_text);
+  out.write(reply_text.data(), reply_text.size()).flush();
+}
+
+/**
+ * @brief Put a reply frame
+ *
+ * @param header A reference to request header
+ * @param output_value A reference to output JSON value of operation
+ * @param out Stream to put reply
+ */
+void Client::put_frame(const FrameHeader& header, const jvalue& output_value, std::ostream& out)
+{
+  JsonString reply_payload;
+  FrameHeader reply = header;
+  reply.flags = 0;
+
+  const auto& error = output_value.at("error");
+  if (!error.is_null()) {
+    reply.flags |= FrameHeader::FLAG_ERROR;
+    reply_payload = error.as_string();
+  } else if (header.opcode == FrameHeader::OP_READ) {
+    reply_payload = output_value.at("result").as_string();
+  } else if (!output_value.empty()) {
+    reply_text.clear();
+    output_value.stringify(reply_text);
+    reply_payload = JsonString(reply_text.data(), reply_text.size());
+  }
+
+  char encoded[FrameHeader::size];
+  reply.length = reply_payload.size();
+  reply.encode(encoded);
+  out.write(encoded, sizeof(encoded));
+  out.write(reply_payload.data(), reply_payload.size());
+  out.flush();
+}
+
+/**
+ * @brief Update state and events to watch
+ */
+void Client::update_state()
+{
+  const bool pending = (socket->get_pending_size() > 0);
+  int events = 0;
+  switch (state) {
+  case STATE_RECEIVING:
+  case STATE_SENDING:
+    state = pending ? STATE_SENDING : STATE_RECEIVING;
+    if (socket->get_pending_size() < pending_limit) {
+      events |= Poller::POLL_IN;
+    }
+    break;
+  case STATE_CLOSING:
+    if (!pending) {
+      disconnect();
+      return;
+    }
+    break;
+  case STATE_CLOSED:
+    return;
+  }
+  if (pending) {
+    events |= Poller::POLL_OUT;
+  }
+  reactor.poller->modify_socket(*socket, events);
+}
+
+/**
+ * @brief Close connection
+ */
+void Client::disconnect()
+{
+  if (state == STATE_CLOSED) {
+    return;
+  }
+  state = STATE_CLOSED;
+  for (auto& item : pending_requests) {
+    for (auto& request : item.second) {
+      if (request.timer_running) {
+        reactor.timers.cancel(request.timer);
+      }
+    }
+  }
+  pending_requests.clear();
+  reactor.poller->remove_socket(*socket);
+  reactor.remove_client(*this);
 }
 
 /**
  * @brief Process "list" operation
- * 
+ *
+ * Ports are taken from the snapshot of the port catalog, so listing
+ * costs no device I/O. Each port has "path" and "name", and "vid",
+ * "pid", "serial", "location" and "driver" where known. "filter"
+ * selects ports (see get_request_filter()). "watch" (boolean) starts or
+ * stops pushing ports added and removed after this reply (see
+ * push_ports()); pushes are not filtered.
+ *
  * @param input A reference to input JSON value
- * @param output A reference to object container for output JSON value
+ * @param output A reference to output JSON value (object)
  * @param session Not used
  */
-void Client::list(const jvalue& input, jvalue::object_type& output, int session)
+void Client::list(const jvalue& input, jvalue& output, int session)
 {
   (void)session;
-  auto ports = server.os.enumerate();
-  std::sort(ports.begin(), ports.end(), [](const auto& a, const auto& b){
-    return b.order > a.order;
-  });
-  auto& array = (output["result"] = json5pp::array({})).as_array();
-  for (const auto& i : ports) {
-    array.push_back(json5pp::object({{"path", i.path}, {"name", i.name}}));
+  const auto& watch = input.at("watch");
+  if (!watch.is_null()) {
+    list_watch = watch.as_boolean();
+  }
+  const auto& snapshot = *reactor.get_port_snapshot();
+  const auto& filter = input.at("filter");
+  if (filter.is_null()) {
+    auto& array = output["result"].set_array();
+    for (const auto& info : snapshot.ports) {
+      put_port_info(info, array.append().set_object());
+    }
+    return;
+  }
+  std::vector<const SerialPortInfo*> selected;
+  snapshot.select(get_request_filter(filter), selected);
+  auto& array = output["result"].set_array();
+  for (const auto info : selected) {
+    put_port_info(*info, array.append().set_object());
   }
 }
 
 /**
  * @brief Process "open" operation
+ *
+ * Opening a permanent port which has no sessions re-attaches to it, and
+ * "offset" selects the first byte to read among the bytes it has kept.
+ * "spill" names a new file to create in the spill directory of the
+ * server (-s) to back the receive ring.
  * 
  * @param input A reference to input JSON value
- * @param output A reference to object container for output JSON value
+ * @param output A reference to output JSON value (object)
  * @param session Not used
  */
-void Client::open(const jvalue& input, jvalue::object_type& output, int session)
+void Client::open(const jvalue& input, jvalue& output, int session)
 {
   (void)session;
   static const jvalue true_value(true);
 
-  const std::string& path = input.at("path").as_string();
-  const bool readable = input.at("read", true_value);
-  const bool writable = input.at("write", true_value);
-  const bool shared = input.at("shared");
-  const bool port = input.at("port");
-  const bool permanent = input.at("permanent");
+  const std::string path = input.at("path").as_string().str();
+  SessionOptions options;
+  options.readable = input.at("read", true_value);
+  options.writable = input.at("write", true_value);
+  options.shared = input.at("shared");
+  options.permanent = input.at("permanent");
+  options.spill_size = default_spill_size;
+  options.offset = -1;
+
+  const auto& spill = input.at("spill");
+  if (!spill.is_null()) {
+    const std::string name = spill.as_string().str();
+    const char *dir = server.opt.get_spill_dir();
+    if (!dir) {
+      throw std::runtime_error("cannot spill: not allowed by server");
+    }
+    if (name.empty() || (name[0] == '.') || (name.find_first_of(std::string("/\\\0", 3)) != std::string::npos)) {
+      throw std::invalid_argument("invalid spill name: " + name);
+    }
+    options.spill_path = std::string(dir) + "/" + name;
+  }
+  const auto& spill_size = input.at("spill_size");
+  if (!spill_size.is_null()) {
+    const auto value = spill_size.as_integer();
+    if ((value <= 0) || ((std::size_t)value > max_spill_size)) {
+      throw std::invalid_argument("invalid spill size: " + std::to_string(value));
+    }
+    options.spill_size = value;
+  }
+  const auto& offset = input.at("offset");
+  if (!offset.is_null()) {
+    const auto value = offset.as_number();
+    if (value < 0) {
+      throw std::invalid_argument("invalid offset: " + std::to_string(value));
+    }
+    options.offset = (std::int64_t)value;
+  }
+
+  const int new_session = reactor.open_session(*this, path, options);
+  try {
+    configure(input, new_session, nullptr);
+  } catch (...) {
+    reactor.close_session(*this, new_session);
+    throw;
+  }
+  output["session"] = new_session;
+  output["offset"] = (double)reactor.get_session(*this, new_session).rx_cursor;
 }
 
 /**
  * @brief Process "config" operation
  * 
  * @param input A reference to input JSON value
- * @param output A reference to object container for output JSON value
- * @param session Not used
+ * @param output A reference to output JSON value (object)
+ * @param session Session ID given by frame header (0 to take it from input)
  */
-void Client::config(const jvalue& input, jvalue::object_type& output, int session)
+void Client::config(const jvalue& input, jvalue& output, int session)
 {
-  bool no_result = true;
   if (session <= 0) {
-    no_result = false;
     session = input.at("session").as_integer();
   }
+  configure(input, session, &output);
+}
+
+/**
+ * @brief Apply configuration to a session
+ *
+ * @param input A reference to input JSON value
+ * @param session Session ID
+ * @param output Pointer to output JSON value (object) to store current
+ *               configuration (nullptr if not needed)
+ */
+void Client::configure(const jvalue& input, int session, jvalue* output)
+{
+  const bool no_result = (output == nullptr);
   SerialPortConfig config_change = {0};
   const auto& baud = input.at("baud");
   if (!baud.is_null()) {
@@ -148,7 +1263,7 @@ void Client::config(const jvalue& input, jvalue::object_type& output, int sessio
     } else if (value == "space") {
       config_change.parity = SerialPortConfig::SP_PARITY_SPACE;
     } else {
-      throw std::invalid_argument("invalid parity mode: " + value);
+      throw std::invalid_argument("invalid parity mode: " + value.str());
     }
     config_change.field_mask |= SerialPortConfig::SP_FIELD_PARITY;
   }
@@ -176,67 +1291,547 @@ void Client::config(const jvalue& input, jvalue::object_type& output, int sessio
     } else if (value == "dtr/dsr") {
       config_change.flow_control = SerialPortConfig::SP_FLOWCONTROL_DTR_DSR;
     } else {
-      throw std::invalid_argument("invalid flow control: " + value);
+      throw std::invalid_argument("invalid flow control: " + value.str());
     }
     config_change.field_mask |= SerialPortConfig::SP_FIELD_FLOW_CONTROL;
   }
+  const auto& framing = input.at("framing");
+  if (!framing.is_null()) {
+    reactor.set_framer(*this, session, get_request_framer(framing));
+  }
+
+  if (no_result && (config_change.field_mask == 0)) {
+    return;
+  }
+  SerialPortConfig config_current = {0};
+  reactor.configure_session(*this, session, config_change, config_current);
+  if (no_result) {
+    return;
+  }
 
-  Server::handle_type handle;
-  auto lock = server.get_session_handle(session, handle);
+  static const char* const parity_names[] = { "none", "odd", "even", "mark", "space" };
+  static const double stop_values[] = { 1.0, 1.5, 2.0 };
+  static const char* const flow_names[] = { "none", "rts/cts", "dtr/dsr" };
+  auto& result = (*output)["result"].set_object();
+  result["baud"] = config_current.baud_rate;
+  result["bits"] = (int)config_current.data_bits;
+  result["parity"] = parity_names[config_current.parity];
+  result["stop"] = stop_values[config_current.stop_bits];
+  result["flow"] = flow_names[config_current.flow_control];
+  static const char* const framing_names[] = { "none", "delimiter", "fixed", "length", "slip", "cobs" };
+  result["framing"] = framing_names[reactor.get_session(*this, session).framer.mode];
 }
 
 /**
  * @brief Process "modem" operation
- * 
+ *
+ * "dtr", "rts" and "break" (booleans) set output lines. "steps" is an
+ * array of objects with the same members and "delay" (milliseconds to
+ * wait after the step), which the server runs in order before replying,
+ * so that reset sequences keep their timing regardless of the network.
+ * Delays are measured from the start of the sequence, so they do not
+ * accumulate the latency of each step. "watch" (boolean) starts or stops
+ * pushing changes of input lines (see push_modem()).
+ *
+ * The result has the lines after all steps.
+ *
  * @param input A reference to input JSON value
- * @param output A reference to object container for output JSON value
- * @param session Not used
+ * @param output A reference to output JSON value (object)
+ * @param session Session ID given by frame header (0 to take it from input)
  */
-void Client::modem(const jvalue& input, jvalue::object_type& output, int session)
+void Client::modem(const jvalue& input, jvalue& output, int session)
 {
   if (session <= 0) {
     session = input.at("session").as_integer();
   }
+  auto& s = reactor.get_session(*this, session);
+  const auto& steps = input.at("steps");
+  if (s.modem_step == 0) {
+    int mask;
+    const int lines = get_request_modem_lines(input, mask);
+    if (mask) {
+      reactor.set_modem_lines(*this, session, mask, lines);
+    }
+    const auto& watch = input.at("watch");
+    if (!watch.is_null()) {
+      reactor.watch_modem(*this, session, watch.as_boolean());
+    }
+    s.modem_time = TimerQueue::clock::now();
+  }
+  if (!steps.is_null()) {
+    try {
+      const auto step_values = steps.as_array();
+      for (;;) {
+        const auto now = TimerQueue::clock::now();
+        if (s.modem_time > now) {
+          reactor.schedule_resume(session, s.modem_time - now);
+          defer(-1);
+          return;
+        }
+        if (s.modem_step >= steps.size()) {
+          break;
+        }
+        const auto& step = step_values.begin()[s.modem_step++];
+        int mask;
+        const int lines = get_request_modem_lines(step, mask);
+        if (mask) {
+          reactor.set_modem_lines(*this, session, mask, lines);
+        }
+        const auto& delay = step.at("delay");
+        if (!delay.is_null()) {
+          const auto value = delay.as_integer();
+          if (value < 0) {
+            throw std::invalid_argument("invalid delay: " + std::to_string(value));
+          }
+          s.modem_time += std::chrono::milliseconds(value);
+        }
+      }
+    } catch (...) {
+      s.modem_step = 0;
+      throw;
+    }
+    s.modem_step = 0;
+  }
+  const int lines = reactor.get_modem_lines(*this, session);
+  put_modem_lines(lines, MODEM_DTR | MODEM_RTS | MODEM_INPUTS, output["result"].set_object());
 }
 
 /**
  * @brief Process "write" operation
  * 
+ * "data" is a string or an array of byte values. With "encoding"
+ * ("base64" or "hex"), a string is decoded before being transmitted.
+ *
+ * Bytes of all writes to a port are queued together and transmitted by
+ * large writes to the port. While the queue holds too many bytes (the
+ * port is slow or stopped by flow control), the request waits for room
+ * up to "timeout" milliseconds. "ack" selects when to reply:
+ * - "queued" (default): when bytes have been queued,
+ * - "sent": when bytes have been written to the driver,
+ * - "drained": when bytes have left the port (as tcdrain()).
+ *
  * @param input A reference to input JSON value
- * @param output A reference to object container for output JSON value
- * @param session Not used
+ * @param output A reference to output JSON value (object)
+ * @param session Session ID given by frame header (0 to take it from input)
  */
-void Client::write(const jvalue& input, jvalue::object_type& output, int session)
+void Client::write(const jvalue& input, jvalue& output, int session)
 {
   if (session <= 0) {
     session = input.at("session").as_integer();
   }
+  bool sent = false;
+  bool drained = false;
+  const auto& ack = input.at("ack");
+  if (!ack.is_null()) {
+    const auto name = ack.as_string();
+    if (name == "sent") {
+      sent = true;
+    } else if (name == "drained") {
+      sent = drained = true;
+    } else if (name != "queued") {
+      throw std::invalid_argument("invalid ack: " + name.str());
+    }
+  }
+  const auto& timeout = input.at("timeout");
+  auto& s = reactor.get_session(*this, session);
+  auto& port = *s.port;
+  if (s.tx_ack_offset == 0) {
+    if (port.get_tx_size() >= tx_buffer_limit) {
+      if (request_expired) {
+        throw std::runtime_error("transmit queue is full");
+      }
+      reactor.wait_transmit(*this, session, port.get_tx_end() - tx_buffer_limit + 1, false);
+      defer(timeout.is_null() ? -1 : timeout.as_integer());
+      return;
+    }
+    const std::size_t length = queue_write(input, session);
+    if (!sent) {
+      output["result"] = (double)length;
+      return;
+    }
+    s.tx_ack_offset = port.get_tx_end();
+    s.tx_ack_length = length;
+  }
+  if (!reactor.check_transmit(*this, session, s.tx_ack_offset, drained)) {
+    if (!request_expired) {
+      reactor.wait_transmit(*this, session, s.tx_ack_offset, drained);
+      defer(timeout.is_null() ? -1 : timeout.as_integer());
+      return;
+    }
+    s.tx_ack_offset = 0;
+    throw std::runtime_error("transmission has not completed in time");
+  }
+  s.tx_ack_offset = 0;
+  output["result"] = (double)s.tx_ack_length;
+}
+
+/**
+ * @brief Queue bytes of "write" operation
+ *
+ * @param input A reference to input JSON value
+ * @param session Session ID
+ * @return Number of bytes queued
+ */
+std::size_t Client::queue_write(const jvalue& input, int session)
+{
+  const auto& data = input.at("data");
+  const auto encoding = get_request_encoding(input);
+  if (data.is_string()) {
+    const auto text = data.as_string();
+    if (encoding == ENCODING_NONE) {
+      return reactor.write_session(*this, session, text.data(), text.size());
+    }
+    // Decode straight into the transmit buffer
+    const std::size_t reserved = get_decoded_length(encoding, text.size());
+    char *bytes = reactor.reserve_write(*this, session, reserved);
+    std::size_t length;
+    try {
+      length = decode_payload(encoding, text.data(), text.size(), bytes);
+    } catch (...) {
+      reactor.commit_write(*this, session, reserved, 0);
+      throw;
+    }
+    return reactor.commit_write(*this, session, reserved, length);
+  }
+  const auto items = data.as_array();
+  char *bytes = reactor.reserve_write(*this, session, data.size());
+  try {
+    for (const auto& item : items) {
+      const auto value = item.as_integer();
+      if ((value < 0) || (255 < value)) {
+        throw std::invalid_argument("invalid byte: " + std::to_string(value));
+      }
+      *bytes++ = (char)value;
+    }
+  } catch (...) {
+    reactor.commit_write(*this, session, data.size(), 0);
+    throw;
+  }
+  return reactor.commit_write(*this, session, data.size(), data.size());
 }
 
 /**
  * @brief Process "read" operation
+ *
+ * The request completes when any of these is met:
+ * - "length" bytes have arrived (also the maximum to read),
+ * - the byte "delimiter" (a number or a one-character string) has
+ *   arrived (read up to and including it),
+ * - bytes have arrived and then the port has been silent for "gap"
+ *   milliseconds or "gap_chars" character times (e.g. 3.5 for
+ *   Modbus RTU) at the current baud rate, whichever is longer,
+ * - "timeout" milliseconds have passed (read what has arrived).
+ *
+ * Without "timeout" and "gap", the request completes immediately with
+ * bytes already received. With only "timeout", any byte completes it.
+ * With "framing" set by "config", the request completes with the
+ * payload of one whole frame instead ("length", "delimiter" and "gap"
+ * are ignored).
+ * With "encoding" ("base64" or "hex"), the result is a string.
  * 
  * @param input A reference to input JSON value
- * @param output A reference to object container for output JSON value
- * @param session Not used
+ * @param output A reference to output JSON value (object)
+ * @param session Session ID given by frame header (0 to take it from input)
  */
-void Client::read(const jvalue& input, jvalue::object_type& output, int session)
+void Client::read(const jvalue& input, jvalue& output, int session)
 {
   if (session <= 0) {
     session = input.at("session").as_integer();
   }
+  ReadCondition condition = { 0, -1, TimerQueue::clock::duration::zero() };
+  const auto& length = input.at("length");
+  if (!length.is_null()) {
+    const int value = length.as_integer();
+    if (value < 0) {
+      throw std::invalid_argument("invalid length: " + std::to_string(value));
+    }
+    condition.length = value;
+  }
+  const auto& delimiter = input.at("delimiter");
+  if (delimiter.is_string()) {
+    const auto value = delimiter.as_string();
+    if (value.size() != 1) {
+      throw std::invalid_argument("invalid delimiter: " + value.str());
+    }
+    condition.delimiter = (unsigned char)value.data()[0];
+  } else if (!delimiter.is_null()) {
+    const int value = delimiter.as_integer();
+    if ((value < 0) || (value > 255)) {
+      throw std::invalid_argument("invalid delimiter: " + std::to_string(value));
+    }
+    condition.delimiter = value;
+  }
+  const auto& gap = input.at("gap");
+  if (!gap.is_null()) {
+    condition.gap = std::chrono::duration_cast<TimerQueue::clock::duration>(
+      std::chrono::duration<double, std::milli>(gap.as_number()));
+  }
+  const auto& gap_chars = input.at("gap_chars");
+  if (!gap_chars.is_null()) {
+    const auto char_time = reactor.get_char_time(*this, session);
+    if (char_time == TimerQueue::clock::duration::zero()) {
+      throw std::runtime_error("cannot get baud rate of port");
+    }
+    condition.gap = std::max(condition.gap, std::chrono::duration_cast<TimerQueue::clock::duration>(
+      char_time * gap_chars.as_number()));
+  }
+  const auto& timeout = input.at("timeout");
+  const bool wait = !timeout.is_null() || (condition.gap > TimerQueue::clock::duration::zero());
+  std::size_t limit;
+  if (!reactor.check_read(*this, session, condition, !wait || request_expired, limit)) {
+    reactor.wait_session(*this, session, condition);
+    defer(timeout.is_null() ? -1 : timeout.as_integer());
+    return;
+  }
+  const auto encoding = get_request_encoding(input);
+  const auto& s = reactor.get_session(*this, session);
+  if (s.framer.mode != Framer::FRAMING_NONE) {
+    if (!read_frame(s, session, limit, !wait || request_expired, encoding, output)) {
+      reactor.wait_session(*this, session, condition);
+      defer(timeout.is_null() ? -1 : timeout.as_integer());
+    }
+    return;
+  }
+  if (encoding != ENCODING_NONE) {
+    // Encode straight out of the receive ring
+    char *text = (char *)output.get_arena()->allocate(get_encoded_length(encoding, limit), 1);
+    const std::size_t size = encode_payload(encoding, s.get_unread_data(), limit, text);
+    reactor.consume_session(*this, session, limit);
+    output["result"] = jvalue::view(text, size);
+    return;
+  }
+  char *bytes = (char *)output.get_arena()->allocate(limit, 1);
+  const std::size_t size = reactor.read_session(*this, session, bytes, limit);
+  if (protocol == PROTOCOL_BINARY) {
+    output["result"] = jvalue::view(bytes, size);
+  } else {
+    output["result"] = jvalue::bytes(bytes, size);
+  }
+}
+
+/**
+ * @brief Put a frame found by "read" as its result
+ *
+ * Broken frames and empty frames are skipped.
+ *
+ * @param s A reference to session
+ * @param session Session ID
+ * @param length Length of the first frame (0 if none)
+ * @param expired true to put an empty result if no frame is left
+ * @param encoding Encoding of result
+ * @param output A reference to output JSON value (object)
+ * @return false if no frame is left and not expired (nothing is put)
+ */
+bool Client::read_frame(const Session& s, int session, std::size_t length, bool expired,
+                        PayloadEncoding encoding, jvalue& output)
+{
+  static const ReadCondition any_frame = { 0, -1, TimerQueue::clock::duration::zero() };
+  auto& arena = *output.get_arena();
+  const char *payload = nullptr;
+  std::size_t size = 0;
+  while (length > 0) {
+    char *buffer = s.framer.is_encoded() ? (char *)arena.allocate(length, 1) : nullptr;
+    payload = s.framer.get_payload(s.get_unread_data(), length, buffer, size);
+    if (payload && (size > 0)) {
+      break;
+    }
+    reactor.consume_session(*this, session, length);
+    reactor.check_read(*this, session, any_frame, true, length);
+    size = 0;
+  }
+  if ((length == 0) && !expired) {
+    return false;
+  }
+  if (encoding != ENCODING_NONE) {
+    char *text = (char *)arena.allocate(get_encoded_length(encoding, size), 1);
+    output["result"] = jvalue::view(text, encode_payload(encoding, payload, size, text));
+  } else if (protocol == PROTOCOL_BINARY) {
+    output["result"] = jvalue::view(payload, size);
+  } else {
+    output["result"] = jvalue::bytes(payload, size);
+  }
+  reactor.consume_session(*this, session, length);
+  return true;
 }
 
 /**
  * @brief Process "close" operation
- * 
+ *
+ * A permanent port is kept open unless "release" is true. Requests
+ * still waiting on the session are answered with an error first.
+ *
  * @param input A reference to input JSON value
- * @param output A reference to object container for output JSON value
- * @param session Not used
+ * @param output Not used
+ * @param session Session ID given by frame header (0 to take it from input)
  */
-void Client::close(const jvalue& input, jvalue::object_type& output, int session)
+void Client::close(const jvalue& input, jvalue& output, int session)
 {
+  (void)output;
   if (session <= 0) {
     session = input.at("session").as_integer();
   }
+  auto& s = reactor.get_session(*this, session);
+  if (input.at("release")) {
+    s.port->permanent = false;
+  }
+  fail_requests(session, "session closed");
+  reactor.close_session(*this, session);
+}
+
+/**
+ * @brief Process "subscribe" operation
+ *
+ * Received bytes are pushed as soon as "size" bytes are ready or
+ * "latency" milliseconds have passed since the first of them arrived.
+ * At most "credit" bytes are pushed; subscribing again adds credit.
+ *
+ * @param input A reference to input JSON value
+ * @param output A reference to output JSON value (object)
+ * @param session Session ID given by frame header (0 to take it from input)
+ */
+void Client::subscribe(const jvalue& input, jvalue& output, int session)
+{
+  static const jvalue true_value(true);
+
+  if (session <= 0) {
+    session = input.at("session").as_integer();
+  }
+  auto& s = reactor.get_session(*this, session);
+  if (!s.readable) {
+    throw std::logic_error("session is not readable");
+  }
+  if (!input.at("enable", true_value)) {
+    s.subscribed = false;
+    s.push_credit = 0;
+    output["result"].set_object()["credit"] = 0;
+    return;
+  }
+  if (!s.subscribed) {
+    s.subscribed = true;
+    s.push_size = default_push_size;
+    s.push_latency = default_push_latency;
+    s.push_credit = input.at("credit").is_null() ? default_push_credit : 0;
+  }
+  const auto& size = input.at("size");
+  if (!size.is_null()) {
+    const auto value = size.as_integer();
+    if (value <= 0) {
+      throw std::invalid_argument("invalid size: " + std::to_string(value));
+    }
+    s.push_size = value;
+  }
+  const auto& latency = input.at("latency");
+  if (!latency.is_null()) {
+    const auto value = latency.as_integer();
+    if (value < 0) {
+      throw std::invalid_argument("invalid latency: " + std::to_string(value));
+    }
+    s.push_latency = value;
+  }
+  const auto& credit = input.at("credit");
+  if (!credit.is_null()) {
+    const auto value = credit.as_integer();
+    if (value < 0) {
+      throw std::invalid_argument("invalid credit: " + std::to_string(value));
+    }
+    s.push_credit += value;
+  }
+  const std::size_t unread = s.get_unread_size();
+  if ((unread > 0) && (s.push_credit > 0)) {
+    reactor.schedule_push(session, (unread >= s.push_size) ? 0 : s.push_latency);
+  }
+  output["result"].set_object()["credit"] = (double)s.push_credit;
+}
+
+/**
+ * @brief Put a summary of a histogram in microseconds
+ *
+ * @param histogram A reference to histogram
+ * @param output A reference to output JSON value (object)
+ */
+static void put_histogram(const Histogram::Snapshot& histogram, Client::jvalue& output)
+{
+  output["count"] = (double)histogram.count;
+  output["mean"] = histogram.count ? (histogram.sum / 1e3 / histogram.count) : 0.0;
+  output["p50"] = histogram.get_percentile(50) / 1e3;
+  output["p90"] = histogram.get_percentile(90) / 1e3;
+  output["p99"] = histogram.get_percentile(99) / 1e3;
+  output["p999"] = histogram.get_percentile(99.9) / 1e3;
+  output["max"] = histogram.max / 1e3;
+}
+
+/**
+ * @brief Process "stats" operation
+ *
+ * Counters are summed over all reactors. "operations" has numbers of
+ * requests completed and failed per operation, "parse_time" and
+ * "delivery_time" have percentiles in microseconds of parsing JSON
+ * requests and of handing received bytes to clients, and "ports" has
+ * byte counts and queue depths of opened ports. "connection" has
+ * counts of this connection.
+ *
+ * @param input Not used
+ * @param output A reference to output JSON value (object)
+ * @param session Not used
+ */
+void Client::stats(const jvalue& input, jvalue& output, int session)
+{
+  (void)input;
+  (void)session;
+  MetricsReport report;
+  server.collect_metrics(report);
+  auto& result = output["result"].set_object();
+  result["connections"] = (double)report.connections;
+  auto& operations = result["operations"].set_object();
+  for (const auto& operation : report.operations) {
+    auto& item = operations[operation.name].set_object();
+    item["requests"] = (double)operation.requests;
+    item["errors"] = (double)operation.errors;
+  }
+  put_histogram(report.parse_time, result["parse_time"].set_object());
+  put_histogram(report.delivery_time, result["delivery_time"].set_object());
+  auto& ports = result["ports"].set_array();
+  for (const auto& port : report.ports) {
+    auto& item = ports.append().set_object();
+    item["path"] = port.path;
+    item["reactor"] = port.reactor;
+    item["rx_bytes"] = (double)port.rx_bytes;
+    item["tx_bytes"] = (double)port.tx_bytes;
+    item["dropped_bytes"] = (double)port.dropped_bytes;
+    item["rx_queue"] = (double)port.rx_queue;
+    item["tx_queue"] = (double)port.tx_queue;
+  }
+  auto& connection = result["connection"].set_object();
+  connection["requests"] = (double)completed_requests;
+  connection["received_bytes"] = (double)received_bytes;
+  connection["pushed_bytes"] = (double)pushed_bytes;
+  connection["pending_bytes"] = (double)socket->get_pending_size();
+}
+
+/**
+ * @brief Process "log" operation
+ *
+ * "level" ("error", "warning", "info" or "debug") changes the level of
+ * log records written by the server, only if the server allows it (-l).
+ * The result has the level in effect.
+ *
+ * @param input A reference to input JSON value
+ * @param output A reference to output JSON value (object)
+ * @param session Not used
+ */
+void Client::log(const jvalue& input, jvalue& output, int session)
+{
+  (void)session;
+  const auto& level = input.at("level");
+  if (!level.is_null()) {
+    if (!server.opt.get_log_control()) {
+      throw std::runtime_error("cannot change log level: not allowed by server");
+    }
+    const auto new_level = Log::find_level(level.as_string().str());
+    if (new_level != Log::get_level()) {
+      Log::set_level(new_level);
+      Log(LOG_INFO, "log level changed").add("level", Log::get_level_name(new_level));
+    }
+  }
+  output["result"].set_object()["level"] = Log::get_level_name(Log::get_level());
 }
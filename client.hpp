@@ -2,31 +2,155 @@
 #define _CLIENT_HPP_
 
 #include "socket.hpp"
+#include "scanner.hpp"
+#include "frame.hpp"
+#include "timer.hpp"
+#include "arena.hpp"
+#include "json.hpp"
+#include "codec.hpp"
+#include "modem.hpp"
+#include <cstdint>
+#include <deque>
 #include <iostream>
-#include "json5pp/json5pp.hpp"
+#include <map>
+#include <memory>
+#include <vector>
 
 class Server;
+class Reactor;
+struct ReadCondition;
+struct Session;
+struct SerialPortInfo;
 
+/**
+ * @brief Connection to a client
+ *
+ * The connection is driven by socket events from the reactor's poller.
+ * Requests are processed as soon as each document has been received
+ * completely, and replies are sent as far as the socket accepts them.
+ * The protocol (JSON5 text or binary frames) is selected by the first
+ * byte received.
+ *
+ * An operation may wait for its session (e.g. "read" with "timeout").
+ * Such a request and later requests on the same session are kept in a
+ * per-session queue and answered in order when they complete, while
+ * requests on other sessions are answered immediately. Operations which
+ * do not depend on order ("close", "list", "stats", etc.) skip the
+ * queue, and "close" answers the queued requests with an error.
+ *
+ * Each request is parsed into an arena which is reset after its reply
+ * has been written, and strings without escape sequences refer to the
+ * receive buffer, so a request costs no heap allocation in steady state.
+ */
 class Client
 {
 public:
-  using jvalue = json5pp::value;
+  using jvalue = JsonValue;
 
-  Client(Server& server);
+  Client(Reactor& reactor, const Socket::shared_ptr& socket);
+  ~Client();
 
-  void run(const Socket::shared_ptr& socket);
+  void start();
+  void push(int session, const char *data, std::size_t length);
+  void push_modem(int session, const ModemEvent& event);
+  void push_ports(const std::vector<const SerialPortInfo*>& added,
+                  const std::vector<const SerialPortInfo*>& removed);
+  void resume(int session);
+  void fail_requests(int session, const std::string& error);
+
+  static const char *get_operation_name(std::size_t index);
 
 private:
-  void list(const jvalue& input, jvalue::object_type& output, int session);
-  void open(const jvalue& input, jvalue::object_type& output, int session);
-  void config(const jvalue& input, jvalue::object_type& output, int session);
-  void modem(const jvalue& input, jvalue::object_type& output, int session);
-  void write(const jvalue& input, jvalue::object_type& output, int session);
-  void read(const jvalue& input, jvalue::object_type& output, int session);
-  void close(const jvalue& input, jvalue::object_type& output, int session);
+  enum State
+  {
+    STATE_RECEIVING,          ///< Waiting for requests
+    STATE_SENDING,            ///< Waiting for socket to accept replies
+    STATE_CLOSING,            ///< Peer closed; sending remaining replies
+    STATE_CLOSED,             ///< Connection closed
+  };
+
+  enum Protocol
+  {
+    PROTOCOL_UNKNOWN,         ///< Nothing received yet
+    PROTOCOL_JSON,            ///< JSON5 documents
+    PROTOCOL_BINARY,          ///< Binary frames (see FrameHeader)
+  };
+
+  struct Operation
+  {
+    const char* name;
+    void (Client::*func)(const jvalue& input, jvalue& output, int session);
+    bool ordered;                 ///< Waits for earlier requests on the same session
+  };
+
+  static const std::size_t operation_count = 10;
+  static const Operation operations[operation_count];
+
+  static const Operation *find_operation(const JsonString& name);
+
+  struct Request
+  {
+    const Operation *operation;   ///< Operation to run
+    std::unique_ptr<Arena> arena; ///< Arena which holds input
+    jvalue input;                 ///< Input of operation
+    FrameHeader header;           ///< Header of request frame (binary protocol)
+    std::uint64_t id;             ///< Serial number of request
+    bool expired;                 ///< Timeout of waiting has expired
+    bool timer_running;           ///< Timeout timer is running
+    TimerQueue::key_type timer;   ///< Key of timeout timer
+  };
+
+  void handle_event(int events);
+  void receive();
+  void select_protocol();
+  void receive_documents();
+  void receive_frames();
+  void reject(const char *error);
+  bool process(const jvalue& input_value, jvalue& output_value);
+  void process_frame(const FrameHeader& header, const char *payload, std::ostream& out);
+  bool execute(const Operation& operation, const jvalue& input, jvalue& output,
+               int session, bool expired);
+  bool enqueue(int session, const Operation& operation, const jvalue& input, const FrameHeader& header, bool waiting);
+  void start_timeout(int session, Request& request);
+  void put_reply(const Request& request, jvalue& output_value, std::ostream& out);
+  void put_frame(const FrameHeader& header, const jvalue& output_value, std::ostream& out);
+  void defer(int timeout);
+  void update_state();
+  void disconnect();
+
+  void list(const jvalue& input, jvalue& output, int session);
+  void open(const jvalue& input, jvalue& output, int session);
+  void config(const jvalue& input, jvalue& output, int session);
+  void configure(const jvalue& input, int session, jvalue* output);
+  void modem(const jvalue& input, jvalue& output, int session);
+  void write(const jvalue& input, jvalue& output, int session);
+  std::size_t queue_write(const jvalue& input, int session);
+  void read(const jvalue& input, jvalue& output, int session);
+  bool read_frame(const Session& s, int session, std::size_t length, bool expired,
+                  PayloadEncoding encoding, jvalue& output);
+  void close(const jvalue& input, jvalue& output, int session);
+  void subscribe(const jvalue& input, jvalue& output, int session);
+  void stats(const jvalue& input, jvalue& output, int session);
+  void log(const jvalue& input, jvalue& output, int session);
 
 private:
+  Reactor& reactor;
   Server& server;
+  Socket::shared_ptr socket;
+  DocumentScanner scanner;
+  State state;
+  Protocol protocol;
+  std::map<int, std::deque<Request>> pending_requests;
+  std::uint64_t last_request_id;
+  bool deferred;
+  bool request_expired;
+  int defer_timeout;
+  bool list_watch;
+  std::uint64_t completed_requests;
+  std::uint64_t received_bytes;
+  std::uint64_t pushed_bytes;
+  Arena arena;
+  std::string reply_text;
 };
 
 #endif  /* _CLIENT_HPP_ */
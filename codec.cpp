@@ -0,0 +1,345 @@
+#include "codec.hpp"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CODEC_SSE2
+#include <emmintrin.h>
+#if defined(__SSSE3__) || defined(__AVX__)
+#define CODEC_SSSE3
+#define CODEC_SSSE3_TARGET
+#include <tmmintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Compiled for SSSE3 separately and selected at run time
+#define CODEC_SSSE3
+#define CODEC_SSSE3_TARGET __attribute__((target("ssse3")))
+#define CODEC_SSSE3_RUNTIME
+#include <tmmintrin.h>
+#endif
+#endif
+
+static const char base64_chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char hex_chars[] = "0123456789abcdef";
+
+/**
+ * @brief Table to decode base64 characters (-1 for invalid ones)
+ */
+struct Base64Table
+{
+  Base64Table()
+  {
+    std::memset(values, -1, sizeof(values));
+    for (int index = 0; index < 64; ++index) {
+      values[(unsigned char)base64_chars[index]] = (signed char)index;
+    }
+  }
+
+  signed char values[256];
+};
+
+static const Base64Table base64_table;
+
+static int hex_value(char ch)
+{
+  if ((ch >= '0') && (ch <= '9')) {
+    return ch - '0';
+  }
+  ch |= 0x20;
+  if ((ch >= 'a') && (ch <= 'f')) {
+    return ch - 'a' + 10;
+  }
+  return -1;
+}
+
+[[noreturn]] static void throw_invalid(const char *name, std::size_t offset)
+{
+  throw std::invalid_argument(std::string("invalid ") + name + " data at " + std::to_string(offset));
+}
+
+#if defined(CODEC_SSSE3)
+#if defined(CODEC_SSSE3_RUNTIME)
+static bool has_ssse3()
+{
+  static const bool value = __builtin_cpu_supports("ssse3");
+  return value;
+}
+#else
+static bool has_ssse3()
+{
+  return true;
+}
+#endif
+
+/**
+ * @brief Encode blocks of 12 bytes into 16 characters
+ *
+ * Reads 16 bytes per block, so stops 4 bytes before the end at least.
+ *
+ * @return Number of bytes encoded
+ */
+CODEC_SSSE3_TARGET static std::size_t base64_encode_blocks(const char *data, std::size_t length, char *out)
+{
+  std::size_t offset = 0;
+  for (; offset + 16 <= length; offset += 12, out += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(data + offset));
+    // Spread 3 bytes into each 32-bit lane, then split into 4 sextets
+    block = _mm_shuffle_epi8(block, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(block, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(block, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t1, t3);
+
+    // Map sextets to characters by adding an offset chosen per range
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    const __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+    _mm_storeu_si128((__m128i *)out, chars);
+  }
+  return offset;
+}
+
+/**
+ * @brief Decode blocks of 16 characters into 12 bytes
+ *
+ * Stops at the block which has an invalid character (including '=').
+ *
+ * @return Number of characters decoded
+ */
+CODEC_SSSE3_TARGET static std::size_t base64_decode_blocks(const char *text, std::size_t length, char *out)
+{
+  std::size_t offset = 0;
+  for (; offset + 16 <= length; offset += 16, out += 12) {
+    const __m128i block = _mm_loadu_si128((const __m128i *)(text + offset));
+    const auto in_range = [&block](char first, char last) {
+      const __m128i diff = _mm_sub_epi8(block, _mm_set1_epi8(first));
+      return _mm_cmpeq_epi8(_mm_min_epu8(diff, _mm_set1_epi8((char)(last - first))), diff);
+    };
+    const __m128i upper = in_range('A', 'Z');
+    const __m128i lower = in_range('a', 'z');
+    const __m128i digit = in_range('0', '9');
+    const __m128i plus = _mm_cmpeq_epi8(block, _mm_set1_epi8('+'));
+    const __m128i slash = _mm_cmpeq_epi8(block, _mm_set1_epi8('/'));
+    const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+    if (_mm_movemask_epi8(valid) != 0xffff) {
+      break;
+    }
+    __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+    shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+    shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+    const __m128i values = _mm_add_epi8(block, shift);
+
+    // Join 4 sextets into 3 bytes in each 32-bit lane, then pack lanes
+    const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const __m128i lanes = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    const __m128i bytes = _mm_shuffle_epi8(lanes, _mm_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    char packed[16];
+    _mm_storeu_si128((__m128i *)packed, bytes);
+    std::memcpy(out, packed, 12);
+  }
+  return offset;
+}
+#endif
+
+static std::size_t base64_encode(const char *data, std::size_t length, char *out)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  char *start = out;
+  std::size_t offset = 0;
+#if defined(CODEC_SSSE3)
+  if (has_ssse3()) {
+    offset = base64_encode_blocks(data, length, out);
+    out += offset / 3 * 4;
+  }
+#endif
+  for (; offset + 3 <= length; offset += 3) {
+    const std::uint32_t bits = (p[offset] << 16) | (p[offset + 1] << 8) | p[offset + 2];
+    *out++ = base64_chars[bits >> 18];
+    *out++ = base64_chars[(bits >> 12) & 0x3f];
+    *out++ = base64_chars[(bits >> 6) & 0x3f];
+    *out++ = base64_chars[bits & 0x3f];
+  }
+  if (offset < length) {
+    const bool two = (offset + 2 == length);
+    const std::uint32_t bits = (p[offset] << 16) | (two ? (p[offset + 1] << 8) : 0);
+    *out++ = base64_chars[bits >> 18];
+    *out++ = base64_chars[(bits >> 12) & 0x3f];
+    *out++ = two ? base64_chars[(bits >> 6) & 0x3f] : '=';
+    *out++ = '=';
+  }
+  return out - start;
+}
+
+static std::size_t base64_decode(const char *text, std::size_t length, char *out)
+{
+  if ((length % 4) == 0) {
+    for (int pad = 0; (pad < 2) && (length > 0) && (text[length - 1] == '='); ++pad) {
+      --length;
+    }
+  }
+  if ((length % 4) == 1) {
+    throw_invalid("base64", length);
+  }
+  char *start = out;
+  std::size_t offset = 0;
+#if defined(CODEC_SSSE3)
+  if (has_ssse3()) {
+    offset = base64_decode_blocks(text, length, out);
+    out += offset / 4 * 3;
+  }
+#endif
+  std::uint32_t bits = 0;
+  int count = 0;
+  for (; offset < length; ++offset) {
+    const int value = base64_table.values[(unsigned char)text[offset]];
+    if (value < 0) {
+      throw_invalid("base64", offset);
+    }
+    bits = (bits << 6) | value;
+    if (++count == 4) {
+      *out++ = (char)(bits >> 16);
+      *out++ = (char)(bits >> 8);
+      *out++ = (char)bits;
+      bits = 0;
+      count = 0;
+    }
+  }
+  if (count == 3) {
+    *out++ = (char)(bits >> 10);
+    *out++ = (char)(bits >> 2);
+  } else if (count == 2) {
+    *out++ = (char)(bits >> 4);
+  }
+  return out - start;
+}
+
+static std::size_t hex_encode(const char *data, std::size_t length, char *out)
+{
+  std::size_t offset = 0;
+#if defined(CODEC_SSE2)
+  for (; offset + 16 <= length; offset += 16) {
+    const __m128i block = _mm_loadu_si128((const __m128i *)(data + offset));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i high = _mm_and_si128(_mm_srli_epi16(block, 4), mask);
+    const __m128i low = _mm_and_si128(block, mask);
+    const auto to_chars = [](__m128i nibbles) {
+      const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+      return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+    };
+    const __m128i high_chars = to_chars(high);
+    const __m128i low_chars = to_chars(low);
+    _mm_storeu_si128((__m128i *)(out + offset * 2), _mm_unpacklo_epi8(high_chars, low_chars));
+    _mm_storeu_si128((__m128i *)(out + offset * 2 + 16), _mm_unpackhi_epi8(high_chars, low_chars));
+  }
+#endif
+  for (; offset < length; ++offset) {
+    const unsigned char byte = data[offset];
+    out[offset * 2] = hex_chars[byte >> 4];
+    out[offset * 2 + 1] = hex_chars[byte & 0x0f];
+  }
+  return length * 2;
+}
+
+static std::size_t hex_decode(const char *text, std::size_t length, char *out)
+{
+  if ((length % 2) != 0) {
+    throw_invalid("hex", length);
+  }
+  std::size_t offset = 0;
+#if defined(CODEC_SSE2)
+  const auto to_nibbles = [](__m128i block, __m128i& valid) {
+    const __m128i digit = _mm_sub_epi8(block, _mm_set1_epi8('0'));
+    const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    const __m128i letter = _mm_sub_epi8(_mm_or_si128(block, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+    valid = _mm_or_si128(is_digit, is_letter);
+    return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                        _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+  };
+  const auto join = [](__m128i nibbles) {
+    // Each 16-bit lane holds the high nibble in its low byte
+    const __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4);
+    const __m128i low = _mm_srli_epi16(nibbles, 8);
+    return _mm_or_si128(high, low);
+  };
+  for (; offset + 32 <= length; offset += 32) {
+    __m128i valid0, valid1;
+    const __m128i nibbles0 = to_nibbles(_mm_loadu_si128((const __m128i *)(text + offset)), valid0);
+    const __m128i nibbles1 = to_nibbles(_mm_loadu_si128((const __m128i *)(text + offset + 16)), valid1);
+    if (_mm_movemask_epi8(_mm_and_si128(valid0, valid1)) != 0xffff) {
+      break;
+    }
+    _mm_storeu_si128((__m128i *)(out + offset / 2), _mm_packus_epi16(join(nibbles0), join(nibbles1)));
+  }
+#endif
+  for (; offset < length; offset += 2) {
+    const int high = hex_value(text[offset]);
+    const int low = hex_value(text[offset + 1]);
+    if ((high < 0) || (low < 0)) {
+      throw_invalid("hex", (high < 0) ? offset : offset + 1);
+    }
+    out[offset / 2] = (char)((high << 4) | low);
+  }
+  return length / 2;
+}
+
+std::size_t get_encoded_length(PayloadEncoding encoding, std::size_t length)
+{
+  switch (encoding) {
+  case ENCODING_BASE64:
+    return (length + 2) / 3 * 4;
+  case ENCODING_HEX:
+    return length * 2;
+  default:
+    return length;
+  }
+}
+
+std::size_t get_decoded_length(PayloadEncoding encoding, std::size_t length)
+{
+  switch (encoding) {
+  case ENCODING_BASE64:
+    return (length + 3) / 4 * 3;
+  case ENCODING_HEX:
+    return length / 2;
+  default:
+    return length;
+  }
+}
+
+std::size_t encode_payload(PayloadEncoding encoding, const char *data, std::size_t length, char *out)
+{
+  switch (encoding) {
+  case ENCODING_BASE64:
+    return base64_encode(data, length, out);
+  case ENCODING_HEX:
+    return hex_encode(data, length, out);
+  default:
+    std::memcpy(out, data, length);
+    return length;
+  }
+}
+
+std::size_t decode_payload(PayloadEncoding encoding, const char *text, std::size_t length, char *out)
+{
+  switch (encoding) {
+  case ENCODING_BASE64:
+    return base64_decode(text, length, out);
+  case ENCODING_HEX:
+    return hex_decode(text, length, out);
+  default:
+    std::memcpy(out, text, length);
+    return length;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef _CODEC_HPP_
+#define _CODEC_HPP_
+
+#include <cstddef>
+
+/**
+ * @brief Text encodings of port data
+ *
+ * Encoders and decoders work on caller-provided buffers, so that bytes
+ * are encoded straight out of a receive ring and decoded straight into a
+ * transmit buffer. Blocks of 12 (base64) or 16 (hex) bytes are converted
+ * with SSSE3/SSE2 where available.
+ */
+enum PayloadEncoding
+{
+  ENCODING_NONE,              ///< Bytes as they are (or an array of numbers)
+  ENCODING_BASE64,            ///< Base64 (RFC 4648) with padding
+  ENCODING_HEX,               ///< Two hexadecimal digits per byte
+};
+
+/**
+ * @brief Get number of characters to encode bytes
+ *
+ * @param encoding Encoding (other than ENCODING_NONE)
+ * @param length Number of bytes
+ */
+std::size_t get_encoded_length(PayloadEncoding encoding, std::size_t length);
+
+/**
+ * @brief Get maximum number of bytes decoded from text
+ *
+ * @param encoding Encoding (other than ENCODING_NONE)
+ * @param length Number of characters
+ */
+std::size_t get_decoded_length(PayloadEncoding encoding, std::size_t length);
+
+/**
+ * @brief Encode bytes
+ *
+ * @param encoding Encoding (other than ENCODING_NONE)
+ * @param data Pointer to bytes
+ * @param length Number of bytes
+ * @param out Buffer of get_encoded_length() characters
+ * @return Number of characters stored
+ */
+std::size_t encode_payload(PayloadEncoding encoding, const char *data, std::size_t length, char *out);
+
+/**
+ * @brief Decode text
+ *
+ * @param encoding Encoding (other than ENCODING_NONE)
+ * @param text Pointer to text
+ * @param length Number of characters
+ * @param out Buffer of get_decoded_length() bytes
+ * @return Number of bytes stored
+ */
+std::size_t decode_payload(PayloadEncoding encoding, const char *text, std::size_t length, char *out);
+
+#endif /* _CODEC_HPP_ */
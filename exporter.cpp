@@ -0,0 +1,116 @@
+#include "exporter.hpp"
+#include "server.hpp"
+#include "metrics.hpp"
+#include "log.hpp"
+#include <sstream>
+
+/**
+ * @brief Maximum size of request headers
+ */
+static const std::size_t max_request_size = 8192;
+
+/**
+ * @brief Construct a new MetricsExporter object
+ *
+ * @param server A reference to server to collect metrics from
+ * @param poller Poller of the reactor which runs the endpoint
+ * @param socket A listening socket
+ */
+MetricsExporter::MetricsExporter(Server& server, const Poller::shared_ptr& poller, const Socket::shared_ptr& socket)
+: server(server), poller(poller), server_socket(socket)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+  while (!connections.empty()) {
+    close(connections.begin()->second);
+  }
+  poller->remove_socket(*server_socket);
+}
+
+/**
+ * @brief Start accepting connections
+ */
+void MetricsExporter::start()
+{
+  poller->add_socket(*server_socket, Poller::POLL_IN, [this](int){
+    accept_clients();
+  });
+}
+
+void MetricsExporter::accept_clients()
+{
+  while (auto socket = server_socket->accept()) {
+    auto& connection = connections[socket.get()];
+    connection.socket = socket;
+    connection.responded = false;
+    poller->add_socket(*socket, Poller::POLL_IN, [this, &connection](int events){
+      handle_event(connection, events);
+    });
+  }
+}
+
+void MetricsExporter::handle_event(Connection& connection, int events)
+{
+  (void)events;
+  auto& socket = *connection.socket;
+  try {
+    if (!connection.responded) {
+      if (socket.receive() < 0) {
+        close(connection);
+        return;
+      }
+      const std::string request(socket.get_read_data(), socket.get_read_size());
+      if ((request.find("\r\n\r\n") == std::string::npos) && (request.find("\n\n") == std::string::npos)) {
+        if (request.size() >= max_request_size) {
+          close(connection);
+        }
+        return;
+      }
+      respond(connection);
+    }
+    if (socket.flush_pending()) {
+      close(connection);
+    }
+  } catch (const std::exception& e) {
+    Log(LOG_WARNING, "metrics request failed").add("error", e.what());
+    close(connection);
+  }
+}
+
+/**
+ * @brief Queue a response to the request received
+ *
+ * @param connection A reference to connection
+ */
+void MetricsExporter::respond(Connection& connection)
+{
+  auto& socket = *connection.socket;
+  const bool get = (socket.get_read_size() >= 4) && !std::memcmp(socket.get_read_data(), "GET ", 4);
+  socket.consume(socket.get_read_size());
+  connection.responded = true;
+  poller->modify_socket(socket, Poller::POLL_OUT);
+
+  std::ostream out(&socket);
+  if (!get) {
+    out << "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n" << std::flush;
+    return;
+  }
+  MetricsReport report;
+  server.collect_metrics(report);
+  std::ostringstream body;
+  report.write_prometheus(body);
+  const std::string text = body.str();
+  out << "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Content-Length: " << text.size() << "\r\n"
+    "Connection: close\r\n\r\n" << text << std::flush;
+}
+
+void MetricsExporter::close(Connection& connection)
+{
+  auto socket = connection.socket;
+  poller->remove_socket(*socket);
+  connections.erase(socket.get());
+}
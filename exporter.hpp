@@ -0,0 +1,46 @@
+#ifndef _EXPORTER_HPP_
+#define _EXPORTER_HPP_
+
+#include "socket.hpp"
+#include "poller.hpp"
+#include <map>
+#include <memory>
+#include <string>
+
+class Server;
+
+/**
+ * @brief Minimal HTTP endpoint which serves metrics to Prometheus
+ *
+ * Every GET request is answered with metrics of all reactors in the
+ * text exposition format, and the connection is closed after the
+ * response (HTTP/1.0). Sockets are watched by the poller of a reactor,
+ * so the endpoint runs in its thread without a thread of its own.
+ */
+class MetricsExporter
+{
+public:
+  MetricsExporter(Server& server, const Poller::shared_ptr& poller, const Socket::shared_ptr& socket);
+  ~MetricsExporter();
+
+  void start();
+
+private:
+  struct Connection
+  {
+    Socket::shared_ptr socket;
+    bool responded;
+  };
+
+  void accept_clients();
+  void handle_event(Connection& connection, int events);
+  void respond(Connection& connection);
+  void close(Connection& connection);
+
+  Server& server;
+  Poller::shared_ptr poller;
+  Socket::shared_ptr server_socket;
+  std::map<Socket*, Connection> connections;
+};
+
+#endif /* _EXPORTER_HPP_ */
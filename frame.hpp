@@ -0,0 +1,125 @@
+#ifndef _FRAME_HPP_
+#define _FRAME_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Header of a binary protocol frame
+ *
+ * A client selects the binary protocol by sending FrameHeader::magic as
+ * the first byte of the connection; the server echoes the byte back.
+ * After that, every request and reply is a frame: a fixed size header
+ * (all fields little-endian) followed by length bytes of payload.
+ *
+ * | Offset | Size | Field    |
+ * |--------|------|----------|
+ * | 0      | 4    | length   |
+ * | 4      | 1    | opcode   |
+ * | 5      | 1    | flags    |
+ * | 6      | 2    | reserved |
+ * | 8      | 4    | session  |
+ * | 12     | 4    | sequence |
+ *
+ * The payload of a "write" request, a "read" reply and a push (data of
+ * a subscribed session sent without request) is raw port data. Other
+ * payloads are JSON5 objects with the same members as the text protocol
+ * (an empty payload means an empty object). A reply with FLAG_ERROR
+ * carries an error message instead.
+ */
+struct FrameHeader
+{
+  /**
+   * @brief First byte to select binary protocol (never starts JSON5)
+   */
+  static const unsigned char magic = 0xff;
+
+  /**
+   * @brief Size of encoded header in bytes
+   */
+  static const std::size_t size = 16;
+
+  /**
+   * @brief Maximum payload length accepted
+   */
+  static const std::uint32_t max_length = 16 * 1024 * 1024;
+
+  /**
+   * @brief Operation codes
+   */
+  enum Opcode
+  {
+    OP_LIST       = 1,
+    OP_OPEN       = 2,
+    OP_CONFIG     = 3,
+    OP_MODEM      = 4,
+    OP_WRITE      = 5,
+    OP_READ       = 6,
+    OP_CLOSE      = 7,
+    OP_SUBSCRIBE  = 8,
+    OP_STATS      = 9,
+    OP_LOG        = 10,
+    OP_PUSH       = 128,          ///< Pushed data (server to client only)
+    OP_MODEM_EVENT = 129,         ///< Pushed change of modem lines (server to client only)
+    OP_LIST_EVENT = 130,          ///< Pushed change of port list (server to client only)
+  };
+
+  /**
+   * @brief Flag bits
+   */
+  enum Flags
+  {
+    FLAG_ERROR  = (1<<0),     ///< Payload is an error message (reply only)
+    FLAG_ACK_SENT     = (1<<1),   ///< Reply to "write" when bytes are sent (request only)
+    FLAG_ACK_DRAINED  = (1<<2),   ///< Reply to "write" when bytes have left the port (request only)
+  };
+
+  std::uint32_t length;       ///< Payload length
+  std::uint8_t opcode;        ///< Opcode
+  std::uint8_t flags;         ///< Combination of FLAG_*
+  std::uint32_t session;      ///< Session ID (0 to take it from payload)
+  std::uint32_t sequence;     ///< Echoed back in reply
+
+  /**
+   * @brief Decode header
+   *
+   * @param data Pointer to at least size bytes
+   */
+  void decode(const char *data)
+  {
+    const unsigned char *p = (const unsigned char *)data;
+    length = p[0] | (p[1] << 8) | (p[2] << 16) | ((std::uint32_t)p[3] << 24);
+    opcode = p[4];
+    flags = p[5];
+    session = p[8] | (p[9] << 8) | (p[10] << 16) | ((std::uint32_t)p[11] << 24);
+    sequence = p[12] | (p[13] << 8) | (p[14] << 16) | ((std::uint32_t)p[15] << 24);
+  }
+
+  /**
+   * @brief Encode header
+   *
+   * @param data Pointer to at least size bytes
+   */
+  void encode(char *data) const
+  {
+    unsigned char *p = (unsigned char *)data;
+    p[0] = length;
+    p[1] = length >> 8;
+    p[2] = length >> 16;
+    p[3] = length >> 24;
+    p[4] = opcode;
+    p[5] = flags;
+    p[6] = 0;
+    p[7] = 0;
+    p[8] = session;
+    p[9] = session >> 8;
+    p[10] = session >> 16;
+    p[11] = session >> 24;
+    p[12] = sequence;
+    p[13] = sequence >> 8;
+    p[14] = sequence >> 16;
+    p[15] = sequence >> 24;
+  }
+};
+
+#endif /* _FRAME_HPP_ */
@@ -0,0 +1,123 @@
+#include "framer.hpp"
+#include "byteset.hpp"
+#include <cstdint>
+#include <cstring>
+
+static const char slip_end = '\xc0';
+static const char slip_esc = '\xdb';
+static const char slip_esc_end = '\xdc';
+static const char slip_esc_esc = '\xdd';
+
+using SlipEndSet = ByteSet<false, slip_end>;
+using SlipEscSet = ByteSet<false, slip_esc>;
+using CobsEndSet = ByteSet<false, '\0'>;
+
+std::size_t Framer::find(const char *data, std::size_t length, std::size_t& scanned) const
+{
+  const char *end = data + length;
+  const char *found = end;
+  switch (mode) {
+  case FRAMING_DELIMITER:
+    if (scanned < length) {
+      // The delimiter is known at run time only; memchr is vectorized by libc
+      auto ptr = (const char *)std::memchr(data + scanned, (unsigned char)delimiter, length - scanned);
+      found = ptr ? ptr : end;
+    }
+    break;
+  case FRAMING_SLIP:
+    if (scanned < length) {
+      found = SlipEndSet::find(data + scanned, end);
+    }
+    break;
+  case FRAMING_COBS:
+    if (scanned < length) {
+      found = CobsEndSet::find(data + scanned, end);
+    }
+    break;
+  case FRAMING_FIXED:
+    return (length >= frame_length) ? frame_length : 0;
+  case FRAMING_LENGTH:
+    {
+      const std::size_t header = field_offset + field_size;
+      if (length < header) {
+        return 0;
+      }
+      const unsigned char *field = (const unsigned char *)data + field_offset;
+      std::uint32_t value = 0;
+      for (int index = 0; index < field_size; ++index) {
+        const int shift = 8 * (big_endian ? (field_size - 1 - index) : index);
+        value |= (std::uint32_t)field[index] << shift;
+      }
+      const std::int64_t total = (std::int64_t)header + value + field_adjust;
+      const std::size_t frame = (total < (std::int64_t)header) ? header : (std::size_t)total;
+      return (length >= frame) ? frame : 0;
+    }
+  default:
+    return 0;
+  }
+  if (found == end) {
+    scanned = length;
+    return 0;
+  }
+  scanned = found - data;
+  return scanned + 1;
+}
+
+const char *Framer::get_payload(const char *data, std::size_t length, char *buffer, std::size_t& size) const
+{
+  switch (mode) {
+  case FRAMING_DELIMITER:
+    size = length - 1;
+    return data;
+  case FRAMING_SLIP:
+    {
+      const char *ptr = data;
+      const char *end = data + length - 1;
+      char *out = buffer;
+      while (ptr < end) {
+        const char *esc = SlipEscSet::find(ptr, end);
+        std::memcpy(out, ptr, esc - ptr);
+        out += esc - ptr;
+        if (esc == end) {
+          break;
+        }
+        if (esc + 1 == end) {
+          return nullptr;
+        }
+        if (esc[1] == slip_esc_end) {
+          *out++ = slip_end;
+        } else if (esc[1] == slip_esc_esc) {
+          *out++ = slip_esc;
+        } else {
+          return nullptr;
+        }
+        ptr = esc + 2;
+      }
+      size = out - buffer;
+      return buffer;
+    }
+  case FRAMING_COBS:
+    {
+      const unsigned char *ptr = (const unsigned char *)data;
+      const unsigned char *end = ptr + length - 1;
+      char *out = buffer;
+      while (ptr < end) {
+        const unsigned code = *ptr++;
+        if ((code == 0) || ((std::size_t)(end - ptr) < code - 1)) {
+          return nullptr;
+        }
+        std::memcpy(out, ptr, code - 1);
+        out += code - 1;
+        ptr += code - 1;
+        if ((code < 0xff) && (ptr < end)) {
+          *out++ = '\0';
+        }
+      }
+      size = out - buffer;
+      return buffer;
+    }
+  default:
+    size = length;
+    return data;
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef _FRAMER_HPP_
+#define _FRAMER_HPP_
+
+#include <cstddef>
+
+/**
+ * @brief Splitter of received bytes into frames
+ *
+ * A framer finds the end of the next frame in the unread bytes of a
+ * session, and then extracts its payload. Frames of delimiter, fixed and
+ * length-prefix modes are taken as they are from the receive ring, and
+ * SLIP and COBS frames are decoded into a caller-provided buffer.
+ * The framing bytes (delimiter, SLIP END and COBS zero) are not part of
+ * the payload, while the header of length-prefix frames is.
+ *
+ * A value-initialized framer does not split bytes (FRAMING_NONE).
+ */
+struct Framer
+{
+  enum Mode
+  {
+    FRAMING_NONE,             ///< No framing
+    FRAMING_DELIMITER,        ///< Frames end with a delimiter byte
+    FRAMING_FIXED,            ///< Frames of a fixed length
+    FRAMING_LENGTH,           ///< Frames with a length field at an offset
+    FRAMING_SLIP,             ///< SLIP (RFC 1055) frames
+    FRAMING_COBS,             ///< COBS frames terminated by zero
+  };
+
+  Mode mode;                  ///< Framing mode
+  char delimiter;             ///< Delimiter byte (FRAMING_DELIMITER)
+  std::size_t frame_length;   ///< Length of frame (FRAMING_FIXED)
+  std::size_t field_offset;   ///< Offset of length field (FRAMING_LENGTH)
+  int field_size;             ///< Size of length field in bytes (1, 2 or 4)
+  bool big_endian;            ///< Length field is big endian
+  int field_adjust;           ///< Added to the length field to get bytes after it
+
+  /**
+   * @brief Test if frames end with a delimiter (which can resynchronize)
+   */
+  bool is_delimited() const
+  {
+    return (mode == FRAMING_DELIMITER) || (mode == FRAMING_SLIP) || (mode == FRAMING_COBS);
+  }
+
+  /**
+   * @brief Test if frames are decoded into a buffer
+   */
+  bool is_encoded() const
+  {
+    return (mode == FRAMING_SLIP) || (mode == FRAMING_COBS);
+  }
+
+  /**
+   * @brief Find the end of the first frame
+   *
+   * @param data Pointer to unread bytes
+   * @param length Number of unread bytes
+   * @param scanned Reference to number of bytes known to have no end of
+   *                frame, which is updated for the next call
+   * @return Length of the frame including framing bytes (0 if incomplete)
+   */
+  std::size_t find(const char *data, std::size_t length, std::size_t& scanned) const;
+
+  /**
+   * @brief Get the payload of a frame
+   *
+   * @param data Pointer to the frame
+   * @param length Length of the frame returned by find()
+   * @param buffer Buffer of length bytes to decode into (if is_encoded())
+   * @param size Reference to store the size of payload
+   * @return Pointer to the payload (nullptr if the frame is broken)
+   */
+  const char *get_payload(const char *data, std::size_t length, char *buffer, std::size_t& size) const;
+};
+
+#endif /* _FRAMER_HPP_ */
@@ -0,0 +1,86 @@
+#ifndef _HOTPLUG_HPP_
+#define _HOTPLUG_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+/**
+ * @brief An abstract class to wait for addition and removal of ports
+ *
+ * wait() blocks the thread of PortCatalog until ports may have been
+ * added or removed, and interrupt() (thread-safe) makes it return false
+ * from then on.
+ */
+class DeviceMonitor
+{
+protected:
+  /**
+   * @brief Construct a new DeviceMonitor object.
+   */
+  DeviceMonitor() = default;
+
+public:
+  /**
+   * @brief Type alias definition for unique pointer to this class
+   */
+  using unique_ptr = std::unique_ptr<DeviceMonitor>;
+
+  /**
+   * @brief Destroy the DeviceMonitor object.
+   */
+  virtual ~DeviceMonitor() = default;
+
+  /**
+   * @brief Wait until ports may have changed
+   *
+   * @return true if ports should be enumerated again, false if interrupted
+   */
+  virtual bool wait() = 0;
+
+  /**
+   * @brief Stop waiting (thread-safe)
+   */
+  virtual void interrupt() = 0;
+};
+
+/**
+ * @brief DeviceMonitor which lets ports be enumerated periodically
+ *
+ * Used where the OS has no notification of devices.
+ */
+class PollingDeviceMonitor : public DeviceMonitor
+{
+public:
+  /**
+   * @brief Construct a new PollingDeviceMonitor object.
+   *
+   * @param interval Interval in milliseconds to enumerate ports
+   */
+  PollingDeviceMonitor(int interval)
+  : interval(interval), interrupted(false) {}
+
+  virtual bool wait() override
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    return !condition.wait_for(lock, std::chrono::milliseconds(interval), [this]{ return interrupted; });
+  }
+
+  virtual void interrupt() override
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      interrupted = true;
+    }
+    condition.notify_all();
+  }
+
+private:
+  int interval;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool interrupted;
+};
+
+#endif /* _HOTPLUG_HPP_ */
@@ -0,0 +1,642 @@
+#include "json.hpp"
+#include "byteset.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * @brief Maximum nesting depth of parsed values
+ */
+static const int max_depth = 64;
+
+/**
+ * @brief Recursive descent parser of JSON5 text
+ */
+class JsonParser
+{
+public:
+  JsonParser(Arena& arena, const char *data, std::size_t length)
+  : arena(arena), ptr(data), end(data + length) {}
+
+  JsonValue parse()
+  {
+    JsonValue value = parse_value(0);
+    skip_spaces();
+    if (ptr != end) {
+      error("unexpected character after value");
+    }
+    return value;
+  }
+
+private:
+  [[noreturn]] void error(const char *message)
+  {
+    throw std::invalid_argument(std::string("invalid JSON5: ") + message);
+  }
+
+  int peek() const
+  {
+    return (ptr < end) ? (unsigned char)*ptr : -1;
+  }
+
+  void skip_spaces()
+  {
+    while (ptr < end) {
+      const unsigned char ch = *ptr;
+      if ((ch == ' ') || (ch == '\t') || (ch == '\n') || (ch == '\r') ||
+          (ch == '\v') || (ch == '\f')) {
+        ++ptr;
+      } else if ((ch == 0xc2) && (end - ptr >= 2) && ((unsigned char)ptr[1] == 0xa0)) {
+        ptr += 2;   // U+00A0
+      } else if ((ch == 0xef) && (end - ptr >= 3) &&
+                 ((unsigned char)ptr[1] == 0xbb) && ((unsigned char)ptr[2] == 0xbf)) {
+        ptr += 3;   // U+FEFF
+      } else if ((ch == 0xe2) && (end - ptr >= 3) && ((unsigned char)ptr[1] == 0x80) &&
+                 (((unsigned char)ptr[2] == 0xa8) || ((unsigned char)ptr[2] == 0xa9))) {
+        ptr += 3;   // U+2028, U+2029
+      } else if ((ch == '/') && (end - ptr >= 2) && (ptr[1] == '/')) {
+        ptr += 2;
+        while ((ptr < end) && (*ptr != '\n') && (*ptr != '\r')) {
+          ++ptr;
+        }
+      } else if ((ch == '/') && (end - ptr >= 2) && (ptr[1] == '*')) {
+        ptr += 2;
+        for (;;) {
+          if (end - ptr < 2) {
+            error("unterminated comment");
+          }
+          if ((ptr[0] == '*') && (ptr[1] == '/')) {
+            ptr += 2;
+            break;
+          }
+          ++ptr;
+        }
+      } else {
+        break;
+      }
+    }
+  }
+
+  bool consume_word(const char *word)
+  {
+    const std::size_t length = std::strlen(word);
+    if (((std::size_t)(end - ptr) < length) || (std::memcmp(ptr, word, length) != 0)) {
+      return false;
+    }
+    if (((std::size_t)(end - ptr) > length) && is_identifier_char(ptr[length])) {
+      return false;
+    }
+    ptr += length;
+    return true;
+  }
+
+  static bool is_identifier_start(char ch)
+  {
+    return ((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) ||
+      (ch == '_') || (ch == '$') || ((unsigned char)ch >= 0x80);
+  }
+
+  static bool is_identifier_char(char ch)
+  {
+    return is_identifier_start(ch) || ((ch >= '0') && (ch <= '9'));
+  }
+
+  JsonValue parse_value(int depth)
+  {
+    if (depth >= max_depth) {
+      error("nesting too deep");
+    }
+    skip_spaces();
+    JsonValue value(arena);
+    switch (peek()) {
+    case '{':
+      parse_object(value, depth);
+      break;
+    case '[':
+      parse_array(value, depth);
+      break;
+    case '"':
+    case '\'':
+      value = parse_string();
+      break;
+    case 't':
+      if (!consume_word("true")) {
+        error("unexpected identifier");
+      }
+      value = true;
+      break;
+    case 'f':
+      if (!consume_word("false")) {
+        error("unexpected identifier");
+      }
+      value = false;
+      break;
+    case 'n':
+      if (!consume_word("null")) {
+        error("unexpected identifier");
+      }
+      break;
+    case -1:
+      error("unexpected end of text");
+    default:
+      value = parse_number();
+      break;
+    }
+    return value;
+  }
+
+  void parse_object(JsonValue& value, int depth)
+  {
+    value.set_object();
+    ++ptr;
+    for (;;) {
+      skip_spaces();
+      if (peek() == '}') {
+        ++ptr;
+        return;
+      }
+      JsonString key;
+      if ((peek() == '"') || (peek() == '\'')) {
+        key = parse_string().as_string();
+      } else if ((ptr < end) && is_identifier_start(*ptr)) {
+        const char *start = ptr;
+        while ((ptr < end) && is_identifier_char(*ptr)) {
+          ++ptr;
+        }
+        key = JsonString(start, ptr - start);
+      } else {
+        error("expected member name");
+      }
+      skip_spaces();
+      if (peek() != ':') {
+        error("expected ':'");
+      }
+      ++ptr;
+      JsonValue member = parse_value(depth + 1);
+      add_member(value, key, member);
+      skip_spaces();
+      if (peek() == ',') {
+        ++ptr;
+      } else if (peek() != '}') {
+        error("expected ',' or '}'");
+      }
+    }
+  }
+
+  void parse_array(JsonValue& value, int depth)
+  {
+    value.set_array();
+    ++ptr;
+    for (;;) {
+      skip_spaces();
+      if (peek() == ']') {
+        ++ptr;
+        return;
+      }
+      value.append() = parse_value(depth + 1);
+      skip_spaces();
+      if (peek() == ',') {
+        ++ptr;
+      } else if (peek() != ']') {
+        error("expected ',' or ']'");
+      }
+    }
+  }
+
+  void add_member(JsonValue& object, const JsonString& key, const JsonValue& member)
+  {
+    // Keys refer to the text like strings; the last one wins on duplicates
+    for (std::uint32_t index = 0; index < object.count; ++index) {
+      auto& existing = object.members[index];
+      if ((existing.key.size() == key.size()) &&
+          (std::memcmp(existing.key.data(), key.data(), key.size()) == 0)) {
+        existing.value = member;
+        return;
+      }
+    }
+    if (object.count == object.capacity) {
+      const std::uint32_t capacity = object.capacity ? object.capacity * 2 : 4;
+      auto members = (JsonMember *)arena.allocate(sizeof(JsonMember) * capacity, alignof(JsonMember));
+      if (object.count > 0) {
+        std::memcpy((void *)members, object.members, sizeof(JsonMember) * object.count);
+      }
+      object.members = members;
+      object.capacity = capacity;
+    }
+    object.members[object.count].key = key;
+    object.members[object.count].value = member;
+    ++object.count;
+  }
+
+  static int hex_digit(int ch)
+  {
+    if ((ch >= '0') && (ch <= '9')) {
+      return ch - '0';
+    } else if ((ch >= 'a') && (ch <= 'f')) {
+      return ch - 'a' + 10;
+    } else if ((ch >= 'A') && (ch <= 'F')) {
+      return ch - 'A' + 10;
+    }
+    return -1;
+  }
+
+  unsigned parse_hex(int digits)
+  {
+    unsigned code = 0;
+    for (int index = 0; index < digits; ++index) {
+      const int digit = hex_digit(peek());
+      if (digit < 0) {
+        error("invalid hex escape");
+      }
+      code = (code << 4) | digit;
+      ++ptr;
+    }
+    return code;
+  }
+
+  static char *put_utf8(char *out, unsigned code)
+  {
+    if (code < 0x80) {
+      *out++ = (char)code;
+    } else if (code < 0x800) {
+      *out++ = (char)(0xc0 | (code >> 6));
+      *out++ = (char)(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+      *out++ = (char)(0xe0 | (code >> 12));
+      *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+      *out++ = (char)(0x80 | (code & 0x3f));
+    } else {
+      *out++ = (char)(0xf0 | (code >> 18));
+      *out++ = (char)(0x80 | ((code >> 12) & 0x3f));
+      *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+      *out++ = (char)(0x80 | (code & 0x3f));
+    }
+    return out;
+  }
+
+  JsonValue parse_string()
+  {
+    const char quote = *ptr++;
+    const char *start = ptr;
+    ptr = (quote == '"') ? DoubleQuoteSet::find(ptr, end) : SingleQuoteSet::find(ptr, end);
+    if (ptr >= end) {
+      error("unterminated string");
+    }
+    if ((*ptr == '\n') || (*ptr == '\r')) {
+      error("line break in string");
+    }
+    if (*ptr == quote) {
+      // No escape sequences; refer to the text
+      return JsonValue::view(start, ptr++ - start);
+    }
+
+    // Decoded string is never longer than its source
+    const char *source_end = ptr;
+    for (;;) {
+      source_end = (quote == '"') ? DoubleQuoteSet::find(source_end, end) : SingleQuoteSet::find(source_end, end);
+      if ((source_end >= end) || (*source_end == quote)) {
+        break;
+      }
+      source_end += (*source_end == '\\') ? 2 : 1;
+    }
+    char *buffer = (char *)arena.allocate((std::min)(source_end, end) - start + 1, 1);
+    std::memcpy(buffer, start, ptr - start);
+    char *out = buffer + (ptr - start);
+    for (;;) {
+      const char *run = ptr;
+      ptr = (quote == '"') ? DoubleQuoteSet::find(ptr, end) : SingleQuoteSet::find(ptr, end);
+      std::memcpy(out, run, ptr - run);
+      out += ptr - run;
+      if (ptr >= end) {
+        error("unterminated string");
+      }
+      const char ch = *ptr++;
+      if (ch == quote) {
+        break;
+      }
+      if ((ch == '\n') || (ch == '\r')) {
+        error("line break in string");
+      }
+      if (ptr >= end) {
+        error("unterminated string");
+      }
+      const char escape = *ptr++;
+      switch (escape) {
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      case 't': *out++ = '\t'; break;
+      case 'v': *out++ = '\v'; break;
+      case '0':
+        if ((ptr < end) && (*ptr >= '0') && (*ptr <= '9')) {
+          error("octal escape");
+        }
+        *out++ = '\0';
+        break;
+      case 'x':
+        out = put_utf8(out, parse_hex(2));
+        break;
+      case 'u': {
+        unsigned code = parse_hex(4);
+        if ((code >= 0xd800) && (code < 0xdc00) && (end - ptr >= 6) &&
+            (ptr[0] == '\\') && (ptr[1] == 'u')) {
+          const char *saved = ptr;
+          ptr += 2;
+          const unsigned low = parse_hex(4);
+          if ((low >= 0xdc00) && (low < 0xe000)) {
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          } else {
+            ptr = saved;
+          }
+        }
+        out = put_utf8(out, code);
+        break;
+      }
+      case '\r':
+        if ((ptr < end) && (*ptr == '\n')) {
+          ++ptr;
+        }
+        break;
+      case '\n':
+        break;
+      default:
+        if ((escape >= '1') && (escape <= '9')) {
+          error("invalid escape");
+        }
+        *out++ = escape;
+        break;
+      }
+    }
+    *out = '\0';
+    return JsonValue::view(buffer, out - buffer);
+  }
+
+  JsonValue parse_number()
+  {
+    const char *start = ptr;
+    bool negative = false;
+    if ((peek() == '+') || (peek() == '-')) {
+      negative = (*ptr++ == '-');
+    }
+    double number;
+    if (consume_word("Infinity")) {
+      number = HUGE_VAL;
+    } else if (consume_word("NaN")) {
+      number = NAN;
+    } else if ((end - ptr >= 2) && (ptr[0] == '0') && ((ptr[1] == 'x') || (ptr[1] == 'X'))) {
+      ptr += 2;
+      if (hex_digit(peek()) < 0) {
+        error("invalid number");
+      }
+      number = 0;
+      while (hex_digit(peek()) >= 0) {
+        number = number * 16 + hex_digit(*ptr++);
+      }
+    } else {
+      const char *digits = ptr;
+      while ((ptr < end) && (((*ptr >= '0') && (*ptr <= '9')) || (*ptr == '.') ||
+             (*ptr == 'e') || (*ptr == 'E') ||
+             (((*ptr == '+') || (*ptr == '-')) && ((ptr[-1] == 'e') || (ptr[-1] == 'E'))))) {
+        ++ptr;
+      }
+      char text[64];
+      const std::size_t length = ptr - digits;
+      if ((length == 0) || (length >= sizeof(text))) {
+        error((ptr == start) ? "unexpected character" : "invalid number");
+      }
+      std::memcpy(text, digits, length);
+      text[length] = '\0';
+      char *parsed;
+      number = std::strtod(text, &parsed);
+      if ((parsed != text + length) || (text[0] == 'e') || (text[0] == 'E')) {
+        error("invalid number");
+      }
+    }
+    if ((ptr < end) && is_identifier_char(*ptr)) {
+      error("invalid number");
+    }
+    JsonValue value;
+    value = negative ? -number : number;
+    return value;
+  }
+
+  using DoubleQuoteSet = ByteSet<false, '"', '\\', '\n', '\r'>;
+  using SingleQuoteSet = ByteSet<false, '\'', '\\', '\n', '\r'>;
+
+  Arena& arena;
+  const char *ptr;
+  const char *end;
+};
+
+JsonValue JsonValue::parse(Arena& arena, const char *data, std::size_t length)
+{
+  return JsonParser(arena, data, length).parse();
+}
+
+const JsonValue& JsonValue::at(const char *key, const JsonValue& def) const
+{
+  if (kind != KIND_OBJECT) {
+    return def;
+  }
+  const std::size_t length = std::strlen(key);
+  for (std::uint32_t index = 0; index < count; ++index) {
+    const auto& member = members[index];
+    if ((member.key.size() == length) && (std::memcmp(member.key.data(), key, length) == 0)) {
+      return member.value;
+    }
+  }
+  return def;
+}
+
+JsonValue& JsonValue::operator[](const char *key)
+{
+  check_kind(KIND_OBJECT, "object");
+  const std::size_t length = std::strlen(key);
+  for (std::uint32_t index = 0; index < count; ++index) {
+    auto& member = members[index];
+    if ((member.key.size() == length) && (std::memcmp(member.key.data(), key, length) == 0)) {
+      return member.value;
+    }
+  }
+  if (count == capacity) {
+    capacity = capacity ? capacity * 2 : 4;
+    auto grown = (JsonMember *)arena->allocate(sizeof(JsonMember) * capacity, alignof(JsonMember));
+    if (count > 0) {
+      std::memcpy((void *)grown, members, sizeof(JsonMember) * count);
+    }
+    members = grown;
+  }
+  char *name = (char *)arena->allocate(length + 1, 1);
+  std::memcpy(name, key, length + 1);
+  auto& member = members[count++];
+  member.key = JsonString(name, length);
+  member.value = JsonValue(*arena);
+  return member.value;
+}
+
+void JsonValue::erase(const char *key)
+{
+  check_kind(KIND_OBJECT, "object");
+  const std::size_t length = std::strlen(key);
+  for (std::uint32_t index = 0; index < count; ++index) {
+    const auto& member = members[index];
+    if ((member.key.size() == length) && (std::memcmp(member.key.data(), key, length) == 0)) {
+      std::memmove((void *)&members[index], &members[index + 1], sizeof(JsonMember) * (count - index - 1));
+      --count;
+      return;
+    }
+  }
+}
+
+JsonValue& JsonValue::append()
+{
+  check_kind(KIND_ARRAY, "array");
+  if (count == capacity) {
+    capacity = capacity ? capacity * 2 : 4;
+    auto grown = (JsonValue *)arena->allocate(sizeof(JsonValue) * capacity, alignof(JsonValue));
+    if (count > 0) {
+      std::memcpy((void *)grown, items, sizeof(JsonValue) * count);
+    }
+    items = grown;
+  }
+  auto& item = items[count++];
+  item = JsonValue(*arena);
+  return item;
+}
+
+JsonValue JsonValue::clone(Arena& target) const
+{
+  JsonValue copy(target);
+  switch (kind) {
+  case KIND_STRING:
+  case KIND_BYTES:
+    copy = as_string();
+    copy.kind = kind;
+    break;
+  case KIND_ARRAY:
+    copy.set_array();
+    for (const auto& item : as_array()) {
+      copy.append() = item.clone(target);
+    }
+    break;
+  case KIND_OBJECT:
+    copy.set_object();
+    for (const auto& member : as_object()) {
+      copy[member.key.str().c_str()] = member.value.clone(target);
+    }
+    break;
+  default:
+    copy = *this;
+    copy.arena = &target;
+    break;
+  }
+  return copy;
+}
+
+static void stringify_string(std::string& out, const char *data, std::size_t size)
+{
+  static const char hex[] = "0123456789abcdef";
+  out.push_back('"');
+  const char *end = data + size;
+  const char *run = data;
+  for (const char *ptr = data; ptr < end; ++ptr) {
+    ptr = ByteSet<true, '"', '\\'>::find(ptr, end);
+    if (ptr == end) {
+      break;
+    }
+    const unsigned char ch = *ptr;
+    out.append(run, ptr - run);
+    run = ptr + 1;
+    switch (ch) {
+    case '"':  out.append("\\\""); break;
+    case '\\': out.append("\\\\"); break;
+    case '\n': out.append("\\n"); break;
+    case '\r': out.append("\\r"); break;
+    case '\t': out.append("\\t"); break;
+    default: {
+      const char escape[] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 15] };
+      out.append(escape, sizeof(escape));
+      break;
+    }
+    }
+  }
+  out.append(run, end - run);
+  out.push_back('"');
+}
+
+static void stringify_number(std::string& out, double number)
+{
+  char text[32];
+  if (number != number || std::isinf(number)) {
+    out.append("null");
+    return;
+  }
+  if ((std::floor(number) == number) && (std::fabs(number) < 1e15)) {
+    out.append(text, std::snprintf(text, sizeof(text), "%lld", (long long)number));
+    return;
+  }
+  int length = std::snprintf(text, sizeof(text), "%.15g", number);
+  if (std::strtod(text, nullptr) != number) {
+    length = std::snprintf(text, sizeof(text), "%.17g", number);
+  }
+  out.append(text, length);
+}
+
+void JsonValue::stringify(std::string& out) const
+{
+  switch (kind) {
+  case KIND_NULL:
+    out.append("null");
+    break;
+  case KIND_BOOLEAN:
+    out.append(boolean ? "true" : "false");
+    break;
+  case KIND_NUMBER:
+    stringify_number(out, number);
+    break;
+  case KIND_STRING:
+    stringify_string(out, string.data, string.size);
+    break;
+  case KIND_BYTES: {
+    out.push_back('[');
+    char text[4];
+    for (std::size_t index = 0; index < string.size; ++index) {
+      unsigned value = (unsigned char)string.data[index];
+      char *ptr = text + sizeof(text);
+      do {
+        *--ptr = (char)('0' + value % 10);
+        value /= 10;
+      } while (value > 0);
+      if (index > 0) {
+        out.push_back(',');
+      }
+      out.append(ptr, text + sizeof(text) - ptr);
+    }
+    out.push_back(']');
+    break;
+  }
+  case KIND_ARRAY:
+    out.push_back('[');
+    for (std::uint32_t index = 0; index < count; ++index) {
+      if (index > 0) {
+        out.push_back(',');
+      }
+      items[index].stringify(out);
+    }
+    out.push_back(']');
+    break;
+  case KIND_OBJECT:
+    out.push_back('{');
+    for (std::uint32_t index = 0; index < count; ++index) {
+      if (index > 0) {
+        out.push_back(',');
+      }
+      stringify_string(out, members[index].key.data(), members[index].key.size());
+      out.push_back(':');
+      members[index].value.stringify(out);
+    }
+    out.push_back('}');
+    break;
+  }
+}
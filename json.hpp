@@ -0,0 +1,455 @@
+#ifndef _JSON_HPP_
+#define _JSON_HPP_
+
+#include "arena.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+/**
+ * @brief Non-owning reference to a string
+ */
+class JsonString
+{
+public:
+  JsonString() : ptr(""), length(0) {}
+  JsonString(const char *data, std::size_t size) : ptr(data), length(size) {}
+
+  const char *data() const
+  {
+    return ptr;
+  }
+
+  std::size_t size() const
+  {
+    return length;
+  }
+
+  bool empty() const
+  {
+    return length == 0;
+  }
+
+  std::string str() const
+  {
+    return std::string(ptr, length);
+  }
+
+  operator std::string() const
+  {
+    return str();
+  }
+
+  bool operator==(const char *s) const
+  {
+    return (std::strlen(s) == length) && (std::memcmp(ptr, s, length) == 0);
+  }
+
+  bool operator!=(const char *s) const
+  {
+    return !(*this == s);
+  }
+
+private:
+  const char *ptr;
+  std::size_t length;
+};
+
+/**
+ * @brief Pair of pointers to iterate over elements
+ */
+template <class T>
+struct JsonRange
+{
+  T *first;
+  T *last;
+
+  T *begin() const
+  {
+    return first;
+  }
+
+  T *end() const
+  {
+    return last;
+  }
+};
+
+struct JsonMember;
+
+/**
+ * @brief JSON value allocated in an arena
+ *
+ * A value is a small handle; arrays, objects and copied strings live in
+ * the arena given on construction, and are released together when the
+ * arena is reset. Strings parsed without escape sequences refer to the
+ * parsed text directly, so the text must outlive the value. Copying a
+ * value makes a shallow copy; use clone() to copy into another arena.
+ */
+class JsonValue
+{
+public:
+  enum Kind
+  {
+    KIND_NULL,
+    KIND_BOOLEAN,
+    KIND_NUMBER,
+    KIND_STRING,
+    KIND_BYTES,               ///< String written as an array of byte values
+    KIND_ARRAY,
+    KIND_OBJECT,
+  };
+
+  /**
+   * @brief Construct a null value which cannot hold children
+   */
+  JsonValue() : kind(KIND_NULL), count(0), capacity(0), arena(nullptr) {}
+
+  /**
+   * @brief Construct a null value whose children are allocated in arena
+   */
+  explicit JsonValue(Arena& arena) : kind(KIND_NULL), count(0), capacity(0), arena(&arena) {}
+
+  explicit JsonValue(bool value) : JsonValue()
+  {
+    kind = KIND_BOOLEAN;
+    boolean = value;
+  }
+
+  /**
+   * @brief Make a string value which refers to bytes without copying
+   */
+  static JsonValue view(const char *data, std::size_t size)
+  {
+    JsonValue value;
+    value.kind = KIND_STRING;
+    value.string.data = data;
+    value.string.size = size;
+    return value;
+  }
+
+  /**
+   * @brief Make a value which refers to bytes and is written as an array
+   *        of numbers (0 to 255)
+   */
+  static JsonValue bytes(const char *data, std::size_t size)
+  {
+    JsonValue value = view(data, size);
+    value.kind = KIND_BYTES;
+    return value;
+  }
+
+  /**
+   * @brief Parse JSON5 text
+   *
+   * @param arena Arena to allocate values
+   * @param data Pointer to text
+   * @param length Length of text (one value with optional white spaces)
+   * @return Parsed value
+   */
+  static JsonValue parse(Arena& arena, const char *data, std::size_t length);
+
+  /**
+   * @brief Get a null value
+   */
+  static const JsonValue& null_value()
+  {
+    static const JsonValue value;
+    return value;
+  }
+
+  /**
+   * @brief Get arena to allocate children (nullptr if none)
+   */
+  Arena *get_arena() const
+  {
+    return arena;
+  }
+
+  Kind get_kind() const
+  {
+    return kind;
+  }
+
+  bool is_null() const
+  {
+    return kind == KIND_NULL;
+  }
+
+  bool is_boolean() const
+  {
+    return kind == KIND_BOOLEAN;
+  }
+
+  bool is_number() const
+  {
+    return kind == KIND_NUMBER;
+  }
+
+  bool is_string() const
+  {
+    return (kind == KIND_STRING) || (kind == KIND_BYTES);
+  }
+
+  bool is_array() const
+  {
+    return kind == KIND_ARRAY;
+  }
+
+  bool is_object() const
+  {
+    return kind == KIND_OBJECT;
+  }
+
+  /**
+   * @brief Test truthiness (null, false, 0, NaN and "" are false)
+   */
+  operator bool() const
+  {
+    switch (kind) {
+    case KIND_NULL:
+      return false;
+    case KIND_BOOLEAN:
+      return boolean;
+    case KIND_NUMBER:
+      return (number != 0) && (number == number);
+    case KIND_STRING:
+    case KIND_BYTES:
+      return string.size > 0;
+    default:
+      return true;
+    }
+  }
+
+  bool as_boolean() const
+  {
+    check_kind(KIND_BOOLEAN, "boolean");
+    return boolean;
+  }
+
+  double as_number() const
+  {
+    check_kind(KIND_NUMBER, "number");
+    return number;
+  }
+
+  int as_integer() const
+  {
+    check_kind(KIND_NUMBER, "number");
+    return (int)number;
+  }
+
+  JsonString as_string() const
+  {
+    if (!is_string()) {
+      throw_type_error("string");
+    }
+    return JsonString(string.data, string.size);
+  }
+
+  JsonRange<const JsonValue> as_array() const
+  {
+    check_kind(KIND_ARRAY, "array");
+    return JsonRange<const JsonValue>{items, items + count};
+  }
+
+  JsonRange<const JsonMember> as_object() const;
+
+  /**
+   * @brief Get number of elements of array or members of object
+   */
+  std::size_t size() const
+  {
+    return count;
+  }
+
+  bool empty() const
+  {
+    return count == 0;
+  }
+
+  /**
+   * @brief Get member of object
+   *
+   * @param key Name of member
+   * @param def Value returned if not an object or no such member
+   */
+  const JsonValue& at(const char *key, const JsonValue& def = null_value()) const;
+
+  const JsonValue& operator[](const char *key) const
+  {
+    return at(key);
+  }
+
+  /**
+   * @brief Make this value an empty object
+   */
+  JsonValue& set_object()
+  {
+    check_arena();
+    kind = KIND_OBJECT;
+    count = capacity = 0;
+    members = nullptr;
+    return *this;
+  }
+
+  /**
+   * @brief Make this value an empty array
+   */
+  JsonValue& set_array()
+  {
+    check_arena();
+    kind = KIND_ARRAY;
+    count = capacity = 0;
+    items = nullptr;
+    return *this;
+  }
+
+  /**
+   * @brief Get member of object, adding null member if not exists
+   *
+   * @param key Name of member (copied)
+   */
+  JsonValue& operator[](const char *key);
+
+  /**
+   * @brief Remove member of object
+   */
+  void erase(const char *key);
+
+  /**
+   * @brief Remove all elements or members
+   */
+  void clear()
+  {
+    count = 0;
+  }
+
+  /**
+   * @brief Add null element to array
+   *
+   * @return A reference to the new element
+   */
+  JsonValue& append();
+
+  template <class T>
+  void push_back(const T& value)
+  {
+    append() = value;
+  }
+
+  JsonValue& operator=(bool value)
+  {
+    kind = KIND_BOOLEAN;
+    boolean = value;
+    return *this;
+  }
+
+  template <class T>
+  typename std::enable_if<std::is_arithmetic<T>::value, JsonValue&>::type operator=(T value)
+  {
+    kind = KIND_NUMBER;
+    number = (double)value;
+    return *this;
+  }
+
+  JsonValue& operator=(const char *value)
+  {
+    return assign_string(value, std::strlen(value));
+  }
+
+  JsonValue& operator=(const std::string& value)
+  {
+    return assign_string(value.data(), value.size());
+  }
+
+  JsonValue& operator=(const JsonString& value)
+  {
+    return assign_string(value.data(), value.size());
+  }
+
+  JsonValue& operator=(const JsonValue& value) = default;
+
+  /**
+   * @brief Copy value deeply
+   *
+   * @param target Arena to allocate the copy
+   */
+  JsonValue clone(Arena& target) const;
+
+  /**
+   * @brief Append JSON text
+   *
+   * @param out String to append text
+   */
+  void stringify(std::string& out) const;
+
+private:
+  void check_kind(Kind expected, const char *name) const
+  {
+    if (kind != expected) {
+      throw_type_error(name);
+    }
+  }
+
+  void check_arena() const
+  {
+    if (!arena) {
+      throw std::logic_error("JSON value has no arena");
+    }
+  }
+
+  [[noreturn]] static void throw_type_error(const char *name)
+  {
+    throw std::invalid_argument(std::string("value is not ") + name);
+  }
+
+  JsonValue& assign_string(const char *data, std::size_t size)
+  {
+    check_arena();
+    char *copy = (char *)arena->allocate(size + 1, 1);
+    std::memcpy(copy, data, size);
+    copy[size] = '\0';
+    kind = KIND_STRING;
+    string.data = copy;
+    string.size = size;
+    return *this;
+  }
+
+  Kind kind;
+  std::uint32_t count;
+  std::uint32_t capacity;
+  Arena *arena;
+  union {
+    bool boolean;
+    double number;
+    struct {
+      const char *data;
+      std::size_t size;
+    } string;
+    JsonValue *items;
+    JsonMember *members;
+  };
+
+  friend class JsonParser;
+};
+
+/**
+ * @brief Member of JSON object
+ */
+struct JsonMember
+{
+  JsonString key;
+  JsonValue value;
+};
+
+inline JsonRange<const JsonMember> JsonValue::as_object() const
+{
+  check_kind(KIND_OBJECT, "object");
+  return JsonRange<const JsonMember>{members, members + count};
+}
+
+#endif /* _JSON_HPP_ */
@@ -0,0 +1,458 @@
+#include "log.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Key/value field of a log record
+ */
+struct LogField
+{
+  enum Type
+  {
+    TYPE_NUMBER,
+    TYPE_BOOLEAN,
+    TYPE_STRING,
+  };
+
+  const char *key;            ///< Key (string literal)
+  Type type;                  ///< Type of value
+  std::int64_t number;        ///< Value of number or boolean
+  std::uint16_t offset;       ///< Offset of string in LogRecord::text
+  std::uint16_t length;       ///< Length of string
+};
+
+/**
+ * @brief Log record with fixed capacity
+ *
+ * Strings are copied into the text area of the record and truncated
+ * if it is full, so writing a record costs no heap allocation.
+ */
+struct LogRecord
+{
+  static const std::size_t max_fields = 8;
+  static const std::size_t text_size = 192;
+
+  std::int64_t time;          ///< Microseconds since the Unix epoch
+  LogLevel level;             ///< Severity
+  int thread;                 ///< Serial number of thread (0 if written synchronously)
+  const char *message;        ///< Message (string literal)
+  std::size_t field_count;    ///< Number of fields
+  LogField fields[max_fields];
+  std::size_t text_length;    ///< Bytes used in text
+  char text[text_size];       ///< Storage of string values
+};
+
+/**
+ * @brief Ring buffer of log records written by one thread
+ *
+ * The owner thread advances head after writing a record, and the drain
+ * thread advances tail after formatting it (single producer, single
+ * consumer).
+ */
+struct LogBuffer
+{
+  static const std::size_t capacity = 512;
+
+  LogBuffer(int thread) : thread(thread), head(0), tail(0), dropped(0), closed(false), writing(false) {}
+
+  const int thread;           ///< Serial number of owner thread
+  std::atomic<std::size_t> head;      ///< Records committed (written by owner)
+  std::atomic<std::size_t> tail;      ///< Records drained (written by drain thread)
+  std::atomic<std::uint64_t> dropped; ///< Records dropped while full
+  std::atomic<bool> closed;   ///< Owner thread has exited
+  bool writing;               ///< Owner is writing a record (accessed by owner only)
+  LogRecord records[capacity];
+};
+
+/**
+ * @brief Interval in milliseconds to drain buffers without notification
+ */
+static const int drain_interval = 100;
+
+static std::atomic<int> log_level(LOG_WARNING);
+static std::atomic<bool> log_running(false);
+static std::atomic<bool> log_pending(false);
+static std::mutex log_mutex;
+static std::condition_variable log_condition;
+static std::vector<std::shared_ptr<LogBuffer>> log_buffers;
+static int log_thread_count;
+static bool log_stopping;
+static std::thread log_thread;
+
+/**
+ * @brief Owner of the buffer of a thread, which marks it closed on exit
+ */
+struct LogBufferHolder
+{
+  ~LogBufferHolder()
+  {
+    if (buffer) {
+      buffer->closed = true;
+    }
+  }
+
+  std::shared_ptr<LogBuffer> buffer;
+};
+
+/**
+ * @brief Stopper of the drain thread left running at exit
+ */
+static struct LogStopper
+{
+  ~LogStopper()
+  {
+    Log::stop();
+  }
+} log_stopper;
+
+static thread_local LogBufferHolder log_holder;
+static thread_local LogRecord log_sync_record;
+
+static const char *const level_names[] = { "error", "warning", "info", "debug" };
+
+/**
+ * @brief Get the buffer of the calling thread (registered on first use)
+ */
+static LogBuffer *get_thread_buffer()
+{
+  if (!log_holder.buffer) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log_holder.buffer = std::make_shared<LogBuffer>(++log_thread_count);
+    log_buffers.push_back(log_holder.buffer);
+  }
+  return log_holder.buffer.get();
+}
+
+/**
+ * @brief Get current time for records
+ *
+ * @return Microseconds since the Unix epoch
+ */
+static std::int64_t get_time()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Append a value of logfmt (quoted if needed)
+ */
+static void put_value(const char *value, std::size_t length, std::string& out)
+{
+  bool quote = (length == 0);
+  for (std::size_t index = 0; (index < length) && !quote; ++index) {
+    const unsigned char ch = value[index];
+    quote = (ch <= ' ') || (ch == '=') || (ch == '"') || (ch == '\\');
+  }
+  if (!quote) {
+    out.append(value, length);
+    return;
+  }
+  out += '"';
+  for (std::size_t index = 0; index < length; ++index) {
+    const char ch = value[index];
+    switch (ch) {
+    case '"':   out += "\\\""; break;
+    case '\\':  out += "\\\\"; break;
+    case '\n':  out += "\\n"; break;
+    case '\r':  out += "\\r"; break;
+    case '\t':  out += "\\t"; break;
+    default:    out += ch; break;
+    }
+  }
+  out += '"';
+}
+
+/**
+ * @brief Append a record as a line of logfmt
+ *
+ * @param record A reference to record
+ * @param out String to append text
+ */
+static void format_record(const LogRecord& record, std::string& out)
+{
+  const std::time_t seconds = (std::time_t)(record.time / 1000000);
+  std::tm tm;
+#if defined(_WIN32)
+  gmtime_s(&tm, &seconds);
+#else
+  gmtime_r(&seconds, &tm);
+#endif
+  char time_text[40];
+  const std::size_t length = std::strftime(time_text, sizeof(time_text), "%Y-%m-%dT%H:%M:%S", &tm);
+  std::snprintf(time_text + length, sizeof(time_text) - length, ".%06dZ", (int)(record.time % 1000000));
+  out += time_text;
+  out += " level=";
+  out += level_names[record.level];
+  if (record.thread > 0) {
+    out += " thread=";
+    out += std::to_string(record.thread);
+  }
+  out += " msg=";
+  put_value(record.message, std::strlen(record.message), out);
+  for (std::size_t index = 0; index < record.field_count; ++index) {
+    const auto& field = record.fields[index];
+    out += ' ';
+    out += field.key;
+    out += '=';
+    switch (field.type) {
+    case LogField::TYPE_NUMBER:
+      out += std::to_string(field.number);
+      break;
+    case LogField::TYPE_BOOLEAN:
+      out += field.number ? "true" : "false";
+      break;
+    case LogField::TYPE_STRING:
+      put_value(record.text + field.offset, field.length, out);
+      break;
+    }
+  }
+  out += '\n';
+}
+
+/**
+ * @brief Write text to stderr at once
+ */
+static void write_text(const std::string& text)
+{
+  std::fwrite(text.data(), 1, text.size(), stderr);
+  std::fflush(stderr);
+}
+
+/**
+ * @brief Drain buffers of all threads until stop() is called
+ */
+static void drain_logs()
+{
+  std::string text;
+  std::unique_lock<std::mutex> lock(log_mutex);
+  for (;;) {
+    log_condition.wait_for(lock, std::chrono::milliseconds(drain_interval), []{
+      return log_pending.load() || log_stopping;
+    });
+    const bool stopping = log_stopping;
+    log_pending = false;
+    text.clear();
+    for (auto iter = log_buffers.begin(); iter != log_buffers.end();) {
+      auto& buffer = **iter;
+      const bool closed = buffer.closed;
+      const std::size_t head = buffer.head.load(std::memory_order_acquire);
+      for (std::size_t tail = buffer.tail.load(std::memory_order_relaxed); tail != head; ++tail) {
+        format_record(buffer.records[tail % LogBuffer::capacity], text);
+      }
+      buffer.tail.store(head, std::memory_order_release);
+      if (const std::uint64_t dropped = buffer.dropped.exchange(0)) {
+        LogRecord record;
+        record.time = get_time();
+        record.level = LOG_WARNING;
+        record.thread = buffer.thread;
+        record.message = "log records dropped";
+        record.field_count = 1;
+        record.fields[0] = LogField{"count", LogField::TYPE_NUMBER, (std::int64_t)dropped, 0, 0};
+        format_record(record, text);
+      }
+      iter = closed ? log_buffers.erase(iter) : (iter + 1);
+    }
+    if (!text.empty()) {
+      lock.unlock();
+      write_text(text);
+      lock.lock();
+    }
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Start writing a record
+ *
+ * @param level Severity (nothing is written if above the current level)
+ * @param message Message (string literal)
+ */
+Log::Log(LogLevel level, const char *message)
+: record(nullptr), buffer(nullptr)
+{
+  if (level > log_level.load(std::memory_order_relaxed)) {
+    return;
+  }
+  if (log_running.load(std::memory_order_acquire)) {
+    auto thread_buffer = get_thread_buffer();
+    if (thread_buffer->writing) {
+      // A record written while another is being written is dropped
+      thread_buffer->dropped.fetch_add(1);
+      return;
+    }
+    const std::size_t head = thread_buffer->head.load(std::memory_order_relaxed);
+    if (head - thread_buffer->tail.load(std::memory_order_acquire) >= LogBuffer::capacity) {
+      thread_buffer->dropped.fetch_add(1);
+      return;
+    }
+    buffer = thread_buffer;
+    buffer->writing = true;
+    record = &buffer->records[head % LogBuffer::capacity];
+    record->thread = buffer->thread;
+  } else {
+    record = &log_sync_record;
+    record->thread = 0;
+  }
+  record->time = get_time();
+  record->level = level;
+  record->message = message;
+  record->field_count = 0;
+  record->text_length = 0;
+}
+
+/**
+ * @brief Commit the record
+ */
+Log::~Log()
+{
+  if (!record) {
+    return;
+  }
+  if (!buffer) {
+    std::string text;
+    format_record(*record, text);
+    write_text(text);
+    return;
+  }
+  buffer->writing = false;
+  buffer->head.store(buffer->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  if (!log_pending.load(std::memory_order_relaxed) && !log_pending.exchange(true)) {
+    log_condition.notify_one();
+  }
+}
+
+/**
+ * @brief Add a string field
+ *
+ * @param key Key (string literal)
+ * @param value Value (copied and truncated to the space left)
+ */
+Log& Log::add(const char *key, const char *value)
+{
+  if (!record || (record->field_count >= LogRecord::max_fields)) {
+    return *this;
+  }
+  const std::size_t length = std::min(std::strlen(value), LogRecord::text_size - record->text_length);
+  std::memcpy(record->text + record->text_length, value, length);
+  record->fields[record->field_count++] = LogField{key, LogField::TYPE_STRING, 0,
+    (std::uint16_t)record->text_length, (std::uint16_t)length};
+  record->text_length += length;
+  return *this;
+}
+
+/**
+ * @brief Add a string field
+ */
+Log& Log::add(const char *key, const std::string& value)
+{
+  return add(key, value.c_str());
+}
+
+/**
+ * @brief Add a boolean field
+ */
+Log& Log::add(const char *key, bool value)
+{
+  if (record && (record->field_count < LogRecord::max_fields)) {
+    record->fields[record->field_count++] = LogField{key, LogField::TYPE_BOOLEAN, value, 0, 0};
+  }
+  return *this;
+}
+
+Log& Log::add_number(const char *key, std::int64_t value)
+{
+  if (record && (record->field_count < LogRecord::max_fields)) {
+    record->fields[record->field_count++] = LogField{key, LogField::TYPE_NUMBER, value, 0, 0};
+  }
+  return *this;
+}
+
+/**
+ * @brief Start the drain thread
+ *
+ * Records are written synchronously until this is called.
+ */
+void Log::start()
+{
+  std::lock_guard<std::mutex> lock(log_mutex);
+  if (log_thread.joinable()) {
+    return;
+  }
+  log_stopping = false;
+  log_thread = std::thread(drain_logs);
+  log_running = true;
+}
+
+/**
+ * @brief Drain records left and stop the drain thread
+ *
+ * Other threads should have stopped logging; records committed after
+ * the last drain are lost.
+ */
+void Log::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (!log_thread.joinable()) {
+      return;
+    }
+    log_running = false;
+    log_stopping = true;
+  }
+  log_condition.notify_one();
+  log_thread.join();
+}
+
+/**
+ * @brief Change the level of records to write (thread-safe)
+ *
+ * @param level The least severe level to write
+ */
+void Log::set_level(LogLevel level)
+{
+  log_level = level;
+}
+
+/**
+ * @brief Get the level of records to write (thread-safe)
+ */
+LogLevel Log::get_level()
+{
+  return (LogLevel)log_level.load();
+}
+
+/**
+ * @brief Get name of a level
+ */
+const char *Log::get_level_name(LogLevel level)
+{
+  return level_names[level];
+}
+
+/**
+ * @brief Find a level by name
+ *
+ * @param name Name of level ("error", "warning", "info" or "debug")
+ */
+LogLevel Log::find_level(const std::string& name)
+{
+  for (int level = LOG_ERROR; level <= LOG_DEBUG; ++level) {
+    if (name == level_names[level]) {
+      return (LogLevel)level;
+    }
+  }
+  throw std::invalid_argument("invalid level: " + name);
+}
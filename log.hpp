@@ -0,0 +1,72 @@
+#ifndef _LOG_HPP_
+#define _LOG_HPP_
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+/**
+ * @brief Severity of log records
+ */
+enum LogLevel
+{
+  LOG_ERROR,                  ///< Failure which stops a connection, a port or the server
+  LOG_WARNING,                ///< Failure which the server continues after
+  LOG_INFO,                   ///< Connections, sessions and threads (-v)
+  LOG_DEBUG,                  ///< Details of protocols (-vv)
+};
+
+struct LogRecord;
+struct LogBuffer;
+
+/**
+ * @brief Structured log record being written
+ *
+ * A record has a constant message and key/value fields, and is
+ * committed when this object is destroyed, usually at the end of the
+ * statement:
+ *
+ *   Log(LOG_INFO, "session opened").add("session", session).add("path", path);
+ *
+ * Records are written into a ring buffer of the calling thread without
+ * locks, and a background thread drains all buffers to stderr in
+ * logfmt. A record below the current level costs one atomic load.
+ * When the buffer is full, records are dropped and counted. Before
+ * start() and after stop(), records are written synchronously.
+ *
+ * Keys and messages must be string literals (they are kept by pointer).
+ */
+class Log
+{
+public:
+  Log(LogLevel level, const char *message);
+  ~Log();
+
+  Log(const Log&) = delete;
+  Log& operator=(const Log&) = delete;
+
+  Log& add(const char *key, const char *value);
+  Log& add(const char *key, const std::string& value);
+  Log& add(const char *key, bool value);
+
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value, Log&>::type add(const char *key, T value)
+  {
+    return add_number(key, (std::int64_t)value);
+  }
+
+  static void start();
+  static void stop();
+  static void set_level(LogLevel level);
+  static LogLevel get_level();
+  static const char *get_level_name(LogLevel level);
+  static LogLevel find_level(const std::string& name);
+
+private:
+  Log& add_number(const char *key, std::int64_t value);
+
+  LogRecord *record;          ///< Record being written (null if not logged)
+  LogBuffer *buffer;          ///< Buffer which holds record (null if written synchronously)
+};
+
+#endif /* _LOG_HPP_ */
@@ -1,8 +1,10 @@
 #include "options.hpp"
+#include <algorithm>
 #include <memory>
 #include "osport.hpp"
 #include "socket.hpp"
 #include "server.hpp"
+#include "log.hpp"
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -17,9 +19,22 @@ int main(int argc, char *argv[])
     if (!opt.parse(*os.get(), argc, argv)) {
       return EXIT_FAILURE;
     }
+    Log::set_level((LogLevel)std::min(LOG_WARNING + opt.get_verbosity(), (int)LOG_DEBUG));
+    Log::start();
+
+    // Create pseudo ports
+    if (opt.get_pseudo_ports() > 0) {
+      os->create_pseudo_ports(opt.get_pseudo_ports());
+    }
 
     // Create a new socket
     auto server_socket = os->create_socket_tcp();
+    if (opt.get_threads() != 1) {
+      server_socket->set_reuse_port();
+    }
+    if (opt.get_buffer_size() > 0) {
+      server_socket->set_buffer_size(opt.get_buffer_size());
+    }
 
     // Bind address
     server_socket->bind(opt.get_address(), opt.get_port());
@@ -44,7 +59,8 @@ int main(int argc, char *argv[])
     // Main loop
     Server(*os, opt).run(server_socket);
   } catch (const std::exception &e) {
-    std::cerr << "Error: " << e.what() << std::endl;
+    Log(LOG_ERROR, "server stopped").add("error", e.what());
+    Log::stop();
     return EXIT_FAILURE;
   }
 
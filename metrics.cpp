@@ -0,0 +1,234 @@
+#include "metrics.hpp"
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * @brief Get index of the highest bit set
+ *
+ * @param value Non-zero value
+ */
+static int get_highest_bit(std::uint64_t value)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return (int)index;
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+/**
+ * @brief Count a value
+ *
+ * @param value Value in nanoseconds
+ */
+void Histogram::record(std::uint64_t value)
+{
+  buckets[get_bucket(value)].add();
+  count.add();
+  sum.add(value);
+  if (value > max.get()) {
+    max.set(value);
+  }
+}
+
+/**
+ * @brief Get index of the bucket which counts a value
+ */
+std::size_t Histogram::get_bucket(std::uint64_t value)
+{
+  if (value < ((std::uint64_t)1 << sub_bits)) {
+    return (std::size_t)value;
+  }
+  const int bit = std::min(get_highest_bit(value), range_bits - 1);
+  if (bit == range_bits - 1) {
+    value = std::min(value, ((std::uint64_t)1 << range_bits) - 1);
+  }
+  return ((std::size_t)(bit - sub_bits + 1) << sub_bits) +
+    (std::size_t)((value >> (bit - sub_bits)) & ((1 << sub_bits) - 1));
+}
+
+/**
+ * @brief Get the largest value counted by a bucket
+ */
+std::uint64_t Histogram::get_bucket_limit(std::size_t bucket)
+{
+  const std::size_t block = bucket >> sub_bits;
+  const std::uint64_t sub = bucket & ((1 << sub_bits) - 1);
+  if (block == 0) {
+    return sub;
+  }
+  return ((((std::uint64_t)1 << sub_bits) + sub + 1) << (block - 1)) - 1;
+}
+
+/**
+ * @brief Add counts of a histogram (thread-safe)
+ *
+ * @param histogram A reference to histogram written by any thread
+ */
+void Histogram::Snapshot::add(const Histogram& histogram)
+{
+  for (std::size_t bucket = 0; bucket < bucket_count; ++bucket) {
+    buckets[bucket] += histogram.buckets[bucket].get();
+  }
+  count += histogram.count.get();
+  sum += histogram.sum.get();
+  max = std::max(max, histogram.max.get());
+}
+
+/**
+ * @brief Get the value below which a percentage of values fall
+ *
+ * @param percent Percentage (0 to 100)
+ * @return Value in nanoseconds (0 if empty)
+ */
+std::uint64_t Histogram::Snapshot::get_percentile(double percent) const
+{
+  std::uint64_t total = 0;
+  for (const auto n : buckets) {
+    total += n;
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const std::uint64_t rank = std::max<std::uint64_t>((std::uint64_t)(total * percent / 100.0 + 0.5), 1);
+  std::uint64_t seen = 0;
+  for (std::size_t bucket = 0; bucket < bucket_count; ++bucket) {
+    seen += buckets[bucket];
+    if (seen >= rank) {
+      return std::min(get_bucket_limit(bucket), max);
+    }
+  }
+  return max;
+}
+
+/**
+ * @brief Create metrics of a port opened by the reactor
+ *
+ * @param path Path of port
+ * @return A shared pointer to metrics to update
+ */
+std::shared_ptr<PortMetrics> ReactorMetrics::add_port(const std::string& path)
+{
+  auto port = std::make_shared<PortMetrics>(path);
+  std::lock_guard<std::mutex> lock(mutex);
+  ports.push_back(port);
+  return port;
+}
+
+/**
+ * @brief Stop reporting metrics of a port closed
+ *
+ * @param port Metrics returned by add_port()
+ */
+void ReactorMetrics::remove_port(const std::shared_ptr<PortMetrics>& port)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  ports.erase(std::remove(ports.begin(), ports.end(), port), ports.end());
+}
+
+/**
+ * @brief Add metrics to a report (thread-safe)
+ *
+ * @param reactor Index of the reactor
+ * @param report A reference to report whose operations are given
+ */
+void ReactorMetrics::collect(int reactor, MetricsReport& report) const
+{
+  report.connections += connections.get();
+  for (std::size_t index = 0; (index < report.operations.size()) && (index < max_operations); ++index) {
+    report.operations[index].requests += requests[index].get();
+    report.operations[index].errors += errors[index].get();
+  }
+  report.parse_time.add(parse_time);
+  report.delivery_time.add(delivery_time);
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto& port : ports) {
+    report.ports.push_back(MetricsReport::PortEntry{port->path, reactor, port->rx_bytes.get(),
+      port->tx_bytes.get(), port->dropped_bytes.get(), port->rx_queue.get(), port->tx_queue.get()});
+  }
+}
+
+/**
+ * @brief Write a label value of Prometheus text format
+ */
+static void put_label(std::ostream& out, const std::string& value)
+{
+  out << '"';
+  for (const char ch : value) {
+    switch (ch) {
+    case '\\': out << "\\\\"; break;
+    case '"':  out << "\\\""; break;
+    case '\n': out << "\\n"; break;
+    default:   out << ch; break;
+    }
+  }
+  out << '"';
+}
+
+/**
+ * @brief Write a histogram as a summary of Prometheus text format
+ */
+static void put_summary(std::ostream& out, const char *name, const char *help,
+                        const Histogram::Snapshot& histogram)
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " summary\n";
+  for (const double quantile : quantiles) {
+    out << name << "{quantile=\"" << quantile << "\"} " <<
+      histogram.get_percentile(quantile * 100) * 1e-9 << '\n';
+  }
+  out << name << "_sum " << histogram.sum * 1e-9 << '\n' <<
+    name << "_count " << histogram.count << '\n';
+}
+
+/**
+ * @brief Write the report in Prometheus text exposition format
+ *
+ * @param out A reference to output stream
+ */
+void MetricsReport::write_prometheus(std::ostream& out) const
+{
+  out << "# HELP serialport_connections_total Clients accepted.\n"
+    "# TYPE serialport_connections_total counter\n"
+    "serialport_connections_total " << connections << '\n';
+
+  out << "# HELP serialport_requests_total Requests completed.\n"
+    "# TYPE serialport_requests_total counter\n";
+  for (const auto& operation : operations) {
+    out << "serialport_requests_total{operation=\"" << operation.name << "\"} " << operation.requests << '\n';
+  }
+  out << "# HELP serialport_request_errors_total Requests failed.\n"
+    "# TYPE serialport_request_errors_total counter\n";
+  for (const auto& operation : operations) {
+    out << "serialport_request_errors_total{operation=\"" << operation.name << "\"} " << operation.errors << '\n';
+  }
+
+  put_summary(out, "serialport_parse_seconds", "Time to parse a JSON request.", parse_time);
+  put_summary(out, "serialport_delivery_seconds",
+    "Time from arrival of bytes at a port to handing them to a client.", delivery_time);
+
+  static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+    std::uint64_t PortEntry::*field;
+  } port_metrics[] = {
+    { "serialport_port_rx_bytes_total", "counter", "Bytes received from port.", &PortEntry::rx_bytes },
+    { "serialport_port_tx_bytes_total", "counter", "Bytes written to port.", &PortEntry::tx_bytes },
+    { "serialport_port_dropped_bytes_total", "counter", "Received bytes discarded.", &PortEntry::dropped_bytes },
+    { "serialport_port_rx_queue_bytes", "gauge", "Bytes in the receive buffer.", &PortEntry::rx_queue },
+    { "serialport_port_tx_queue_bytes", "gauge", "Bytes waiting to be written.", &PortEntry::tx_queue },
+  };
+  for (const auto& metric : port_metrics) {
+    out << "# HELP " << metric.name << ' ' << metric.help << "\n# TYPE " << metric.name << ' ' << metric.type << '\n';
+    for (const auto& port : ports) {
+      out << metric.name << "{port=";
+      put_label(out, port.path);
+      out << ",reactor=\"" << port.reactor << "\"} " << port.*metric.field << '\n';
+    }
+  }
+}
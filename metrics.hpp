@@ -0,0 +1,162 @@
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Counter written by one thread and read by any thread
+ *
+ * Only the owner thread updates the value, so an update is a relaxed
+ * load and store without a locked instruction. Also used as a gauge.
+ */
+class Counter
+{
+public:
+  Counter() : value(0) {}
+
+  void add(std::uint64_t delta = 1)
+  {
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+
+  void set(std::uint64_t new_value)
+  {
+    value.store(new_value, std::memory_order_relaxed);
+  }
+
+  std::uint64_t get() const
+  {
+    return value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<std::uint64_t> value;
+};
+
+/**
+ * @brief Histogram of durations in nanoseconds written by one thread
+ *
+ * Buckets are logarithmic with 16 linear sub-buckets for each power of
+ * two (like HdrHistogram), so any value is counted within 6.25% of its
+ * own magnitude. Values beyond range_bits are counted in the last
+ * bucket. Recording costs no allocation and no locked instruction.
+ */
+class Histogram
+{
+public:
+  static const int sub_bits = 4;
+  static const int range_bits = 40;   ///< About 18 minutes in nanoseconds
+  static const std::size_t bucket_count = (std::size_t)(range_bits - sub_bits + 1) << sub_bits;
+
+  /**
+   * @brief Sum of histograms taken for reporting
+   */
+  struct Snapshot
+  {
+    Snapshot() : buckets(bucket_count), count(0), sum(0), max(0) {}
+
+    void add(const Histogram& histogram);
+    std::uint64_t get_percentile(double percent) const;
+
+    std::vector<std::uint64_t> buckets;
+    std::uint64_t count;
+    std::uint64_t sum;
+    std::uint64_t max;
+  };
+
+  void record(std::uint64_t value);
+
+  static std::size_t get_bucket(std::uint64_t value);
+  static std::uint64_t get_bucket_limit(std::size_t bucket);
+
+private:
+  Counter buckets[bucket_count];
+  Counter count;
+  Counter sum;
+  Counter max;
+};
+
+/**
+ * @brief Metrics of an opened port
+ */
+struct PortMetrics
+{
+  PortMetrics(const std::string& path) : path(path) {}
+
+  const std::string path;     ///< Path of port
+  Counter rx_bytes;           ///< Bytes received from port
+  Counter tx_bytes;           ///< Bytes written to port
+  Counter dropped_bytes;      ///< Received bytes discarded before all sessions read them
+  Counter rx_queue;           ///< Bytes in the receive ring (gauge)
+  Counter tx_queue;           ///< Bytes waiting to be written (gauge)
+};
+
+struct MetricsReport;
+
+/**
+ * @brief Metrics of a reactor
+ *
+ * Written only by the thread of the reactor and read by any thread.
+ * Only adding and removing ports takes a lock.
+ */
+class ReactorMetrics
+{
+public:
+  static const std::size_t max_operations = 16;
+
+  std::shared_ptr<PortMetrics> add_port(const std::string& path);
+  void remove_port(const std::shared_ptr<PortMetrics>& port);
+  void collect(int reactor, MetricsReport& report) const;
+
+  Counter connections;                ///< Clients accepted
+  Counter requests[max_operations];   ///< Requests completed per operation (including failed ones)
+  Counter errors[max_operations];     ///< Requests failed per operation
+  Histogram parse_time;               ///< Time to parse a JSON request
+  Histogram delivery_time;            ///< Time from arrival of bytes to handing them to a client
+
+private:
+  mutable std::mutex mutex;
+  std::vector<std::shared_ptr<PortMetrics>> ports;
+};
+
+/**
+ * @brief Metrics of all reactors
+ */
+struct MetricsReport
+{
+  struct OperationEntry
+  {
+    const char *name;
+    std::uint64_t requests;
+    std::uint64_t errors;
+  };
+
+  struct PortEntry
+  {
+    std::string path;
+    int reactor;
+    std::uint64_t rx_bytes;
+    std::uint64_t tx_bytes;
+    std::uint64_t dropped_bytes;
+    std::uint64_t rx_queue;
+    std::uint64_t tx_queue;
+  };
+
+  MetricsReport() : connections(0) {}
+
+  void write_prometheus(std::ostream& out) const;
+
+  std::uint64_t connections;
+  std::vector<OperationEntry> operations;   ///< Operations in order of opcode
+  Histogram::Snapshot parse_time;
+  Histogram::Snapshot delivery_time;
+  std::vector<PortEntry> ports;
+};
+
+#endif /* _METRICS_HPP_ */
@@ -0,0 +1,118 @@
+#ifndef _MODEM_HPP_
+#define _MODEM_HPP_
+
+#include "poller.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Modem lines of a port
+ */
+enum ModemLine
+{
+  MODEM_DTR     = (1<<0),     ///< Data terminal ready (output)
+  MODEM_RTS     = (1<<1),     ///< Request to send (output)
+  MODEM_CTS     = (1<<2),     ///< Clear to send (input)
+  MODEM_DSR     = (1<<3),     ///< Data set ready (input)
+  MODEM_DCD     = (1<<4),     ///< Data carrier detect (input)
+  MODEM_RI      = (1<<5),     ///< Ring indicator (input)
+  MODEM_BREAK   = (1<<6),     ///< Break condition on TxD (output; set only)
+  MODEM_OUTPUTS = MODEM_DTR | MODEM_RTS | MODEM_BREAK,
+  MODEM_INPUTS  = MODEM_CTS | MODEM_DSR | MODEM_DCD | MODEM_RI,
+};
+
+/**
+ * @brief Change of modem input lines
+ */
+struct ModemEvent
+{
+  std::int64_t time;          ///< Microseconds since the Unix epoch when the change was seen
+  int lines;                  ///< Input lines after the change (combination of MODEM_*)
+  int changed;                ///< Input lines which have changed (including pulses already over)
+};
+
+/**
+ * @brief Watcher of modem input lines of a port
+ *
+ * A watcher waits for changes of input lines in a thread of its own, so
+ * that a blocking wait of the OS can be used, and queues timestamped
+ * events. The poller given on creation is woken up when events are
+ * queued, and the reactor takes them in its thread. Watching stops when
+ * the watcher is destroyed, which must be done before closing the port.
+ */
+class ModemWatcher
+{
+public:
+  /**
+   * @brief Type alias definition for unique pointer to this class
+   */
+  using unique_ptr = std::unique_ptr<ModemWatcher>;
+
+  /**
+   * @brief Destroy the ModemWatcher object.
+   */
+  virtual ~ModemWatcher() = default;
+
+  /**
+   * @brief Take events queued so far (thread-safe)
+   *
+   * @param taken A reference to vector to append events to
+   */
+  void take_events(std::vector<ModemEvent>& taken)
+  {
+    if (!pending.exchange(false)) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    taken.insert(taken.end(), events.begin(), events.end());
+    events.clear();
+  }
+
+protected:
+  /**
+   * @brief Construct a new ModemWatcher object.
+   *
+   * @param poller Poller to wake up when events are queued
+   */
+  ModemWatcher(const Poller::shared_ptr& poller)
+  : poller(poller), pending(false) {}
+
+  /**
+   * @brief Queue an event (called from the watching thread)
+   *
+   * @param event A reference to event
+   */
+  void post(const ModemEvent& event)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      events.push_back(event);
+    }
+    if (!pending.exchange(true)) {
+      poller->wakeup();
+    }
+  }
+
+  /**
+   * @brief Get current time for events
+   *
+   * @return Microseconds since the Unix epoch
+   */
+  static std::int64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+private:
+  Poller::shared_ptr poller;
+  std::atomic<bool> pending;
+  std::mutex mutex;
+  std::vector<ModemEvent> events;
+};
+
+#endif /* _MODEM_HPP_ */
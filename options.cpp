@@ -8,7 +8,7 @@ bool Options::parse(OsPort& os, int argc, char *argv[])
   char *optarg = nullptr;
   int optind = 0;
 
-  while ((ch = os.getopt(argc, argv, "a:p:i:m:vh", optarg, optind)) != -1)
+  while ((ch = os.getopt(argc, argv, "a:p:i:s:m:L:t:b:c:M:lvh", optarg, optind)) != -1)
   {
     switch (ch)
     {
@@ -24,10 +24,37 @@ bool Options::parse(OsPort& os, int argc, char *argv[])
       // -i <idfile>
       idfile = optarg;
       break;
+    case 's':
+      // -s <directory>
+      spill_dir = optarg;
+      break;
     case 'm':
       // -m <number>
       max_clients = atoi(optarg);
       break;
+    case 'L':
+      // -L <number>
+      pseudo_ports = atoi(optarg);
+      break;
+    case 't':
+      // -t <number>
+      threads = atoi(optarg);
+      break;
+    case 'b':
+      // -b <bytes>
+      buffer_size = atoi(optarg);
+      break;
+    case 'c':
+      // -c <bytes>
+      capture_size = atoi(optarg);
+      break;
+    case 'M':
+      // -M <number>
+      metrics_port = atoi(optarg);
+      break;
+    case 'l':
+      log_control = true;
+      break;
     case 'v':
       ++verbosity;
       break;
@@ -37,7 +64,16 @@ bool Options::parse(OsPort& os, int argc, char *argv[])
         "  -a <address>      Specify bind address (default: 127.0.0.1)\n"
         "  -p <number>       Specify port (default: assign an arbitrary unused port)\n"
         "  -i <file>         Specify file to write IDs [PID:Address:Port] (default: stdout)\n"
-        "  -m <number>       Specify maximum number of clients (default: 10)\n"
+        "  -s <directory>    Specify directory to create spill files of ports in (default: no spill)\n"
+        "  -m <number>       Specify maximum number of clients (default: unlimited)\n"
+        "  -L <number>       Create loopback pseudo ports for testing (default: 0)\n"
+        "  -t <number>       Specify number of event loop threads (default: 1, 0: number of CPUs)\n"
+        "                    (ports cannot be opened as shared or permanent with more than one)\n"
+        "  -b <bytes>        Specify initial receive buffer size of clients accepted by the listener\n"
+        "                    (default: 65536, grows up to 32MiB; the listener is shared by all threads)\n"
+        "  -c <bytes>        Specify receive buffer size of permanent ports in memory (default: 65536)\n"
+        "  -M <number>       Serve metrics for Prometheus over HTTP on port (default: disabled)\n"
+        "  -l                Allow clients to change log level with \"log\" (default: read only)\n"
         "  -h                Print this help message\n"
         << std::endl;
       return false;
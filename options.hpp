@@ -6,7 +6,7 @@
 class Options
 {
 public:
-  Options() : address("127.0.0.1"), port(0), idfile(nullptr), max_clients(10), verbosity(0) {}
+  Options() : address("127.0.0.1"), port(0), idfile(nullptr), spill_dir(nullptr), max_clients(0), pseudo_ports(0), threads(1), buffer_size(0), capture_size(0), metrics_port(0), log_control(false), verbosity(0) {}
   ~Options() {}
 
   bool parse(OsPort& os, int argc, char *argv[]);
@@ -26,11 +26,46 @@ public:
     return idfile;
   }
 
+  const char *get_spill_dir() const
+  {
+    return spill_dir;
+  }
+
   int get_max_clients() const
   {
     return max_clients;
   }
 
+  int get_pseudo_ports() const
+  {
+    return pseudo_ports;
+  }
+
+  int get_threads() const
+  {
+    return threads;
+  }
+
+  int get_buffer_size() const
+  {
+    return buffer_size;
+  }
+
+  int get_capture_size() const
+  {
+    return capture_size;
+  }
+
+  int get_metrics_port() const
+  {
+    return metrics_port;
+  }
+
+  bool get_log_control() const
+  {
+    return log_control;
+  }
+
   int get_verbosity() const
   {
     return verbosity;
@@ -40,7 +75,14 @@ private:
   const char *address;
   int port;
   const char *idfile;
+  const char *spill_dir;
   int max_clients;
+  int pseudo_ports;
+  int threads;
+  int buffer_size;
+  int capture_size;
+  int metrics_port;
+  bool log_control;
   int verbosity;
 };
 
@@ -3,20 +3,40 @@
 
 #include <string>
 #include "socket.hpp"
+#include "poller.hpp"
+#include "portio.hpp"
+#include "modem.hpp"
+#include "hotplug.hpp"
 #include <memory>
 
 struct SerialPortInfo
 {
   std::string path;
   std::string name;
-  int vendor_id;
-  int product_id;
+  int vendor_id;              ///< USB vendor ID (-1 if unknown)
+  int product_id;             ///< USB product ID (-1 if unknown)
+  std::string serial_number;  ///< Serial number of USB device (empty if unknown)
+  std::string location;       ///< Location on the bus (such as USB port path)
+  std::string driver;         ///< Name of device driver
   int order;
 
   SerialPortInfo(const std::string& path, const std::string& name)
-  : path(path), name(name)
+  : path(path), name(name), vendor_id(-1), product_id(-1), order(0)
   {
   }
+
+  bool operator==(const SerialPortInfo& other) const
+  {
+    return (path == other.path) && (name == other.name) &&
+      (vendor_id == other.vendor_id) && (product_id == other.product_id) &&
+      (serial_number == other.serial_number) && (location == other.location) &&
+      (driver == other.driver);
+  }
+
+  bool operator!=(const SerialPortInfo& other) const
+  {
+    return !(*this == other);
+  }
 };
 
 struct SerialPortConfig
@@ -126,6 +146,21 @@ public:
    */
   virtual Socket::shared_ptr create_socket_tcp() = 0;
 
+  /**
+   * @brief Create a Poller object to wait sockets and ports
+   *
+   * @return A shared pointer to Poller object
+   */
+  virtual Poller::shared_ptr create_poller() = 0;
+
+  /**
+   * @brief Create a PortIo object to transfer bytes of ports
+   *
+   * @param poller Poller to dispatch completions
+   * @return A shared pointer to PortIo object
+   */
+  virtual PortIo::shared_ptr create_port_io(const Poller::shared_ptr& poller);
+
   /**
    * @brief Enumerate serial ports
    * 
@@ -133,6 +168,13 @@ public:
    */
   virtual std::vector<SerialPortInfo> enumerate() = 0;
 
+  /**
+   * @brief Create a monitor to wait for addition and removal of ports
+   *
+   * @return A unique pointer to DeviceMonitor object
+   */
+  virtual DeviceMonitor::unique_ptr create_device_monitor();
+
   /**
    * @brief Open port
    * 
@@ -150,13 +192,78 @@ public:
    */
   virtual void configure_port(handle_type handle, const SerialPortConfig& set, SerialPortConfig& get) = 0;
 
+  /**
+   * @brief Read bytes from port without blocking
+   *
+   * @param handle Port handle
+   * @param buffer Buffer to store bytes
+   * @param length Size of buffer
+   * @return Number of bytes read (0 if no bytes are available; end of
+   *         file such as a hang-up throws an exception)
+   */
+  virtual int read_port(handle_type handle, void* buffer, int length) = 0;
+
+  /**
+   * @brief Write bytes to port without blocking
+   *
+   * @param handle Port handle
+   * @param buffer Bytes to write
+   * @param length Number of bytes to write
+   * @return Number of bytes written (0 if port is not writable now)
+   */
+  virtual int write_port(handle_type handle, const void* buffer, int length) = 0;
+
+  /**
+   * @brief Get number of bytes written but not yet transmitted
+   *
+   * @param handle Port handle
+   * @return Number of bytes which have not left the port
+   */
+  virtual int get_output_size(handle_type handle) = 0;
+
+  /**
+   * @brief Get modem lines
+   *
+   * @param handle Port handle
+   * @return Lines which are active (combination of MODEM_*)
+   */
+  virtual int get_modem_lines(handle_type handle) = 0;
+
+  /**
+   * @brief Set modem output lines
+   *
+   * @param handle Port handle
+   * @param mask Lines to change (combination of MODEM_DTR, MODEM_RTS and MODEM_BREAK)
+   * @param lines Lines to activate among mask
+   */
+  virtual void set_modem_lines(handle_type handle, int mask, int lines) = 0;
+
+  /**
+   * @brief Start watching modem input lines
+   *
+   * @param handle Port handle
+   * @param poller Poller to wake up when lines change
+   * @return A unique pointer to ModemWatcher object (stops watching when destroyed)
+   */
+  virtual ModemWatcher::unique_ptr watch_modem_lines(handle_type handle, const Poller::shared_ptr& poller) = 0;
+
   /**
    * @brief Close port
-   * 
+   *
    * @param handle Port handle
    */
   virtual void close_port(handle_type handle) = 0;
 
+  /**
+   * @brief Create pseudo ports for testing
+   *
+   * Created ports echo back every byte written to them, and are listed
+   * by enumerate() like real ports.
+   *
+   * @param count Number of ports to create
+   */
+  virtual void create_pseudo_ports(int count) = 0;
+
 };
 
 #endif /* _OSPORT_HPP_ */
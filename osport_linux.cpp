@@ -0,0 +1,919 @@
+#include "osport_unix.hpp"
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <cerrno>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+
+/**
+ * @brief Read the first line of a sysfs attribute
+ *
+ * @param path Path of attribute file
+ * @param value Reference to store the value
+ * @return true if succeeded
+ */
+static bool read_sysfs(const std::string& path, std::string& value)
+{
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::getline(file, value);
+  return !file.fail();
+}
+
+/**
+ * @brief Get real path of a file
+ */
+static std::string real_path(const std::string& path)
+{
+  char buffer[PATH_MAX];
+  if (!realpath(path.c_str(), buffer)) {
+    return std::string();
+  }
+  return buffer;
+}
+
+/**
+ * @brief Compare tty names in natural order ("ttyUSB2" < "ttyUSB10")
+ */
+static bool natural_less(const std::string& a, const std::string& b)
+{
+  auto split = [](const std::string& name, std::string& prefix, long& number) {
+    auto pos = name.find_last_not_of("0123456789");
+    pos = (pos == std::string::npos) ? 0 : pos + 1;
+    prefix = name.substr(0, pos);
+    number = (pos < name.size()) ? std::strtol(name.c_str() + pos, nullptr, 10) : -1;
+  };
+  std::string prefix_a, prefix_b;
+  long number_a, number_b;
+  split(a, prefix_a, number_a);
+  split(b, prefix_b, number_b);
+  if (prefix_a != prefix_b) {
+    return prefix_a < prefix_b;
+  }
+  return number_a < number_b;
+}
+
+/**
+ * @brief Poller implementation based on epoll
+ */
+class EpollPoller : public Poller
+{
+public:
+  EpollPoller()
+  {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+      throw std::runtime_error("cannot create epoll: " + std::string(strerror(errno)));
+    }
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = evfd;
+    if ((evfd < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &event) != 0)) {
+      auto message = std::string(strerror(errno));
+      ::close(epfd);
+      throw std::runtime_error("cannot create eventfd: " + message);
+    }
+  }
+
+  virtual ~EpollPoller()
+  {
+    ::close(evfd);
+    ::close(epfd);
+  }
+
+  virtual void add_socket(Socket& socket, int events, const handler_type& handler) override
+  {
+    add_fd(static_cast<UnixSocket&>(socket).get_fd(), events, handler);
+  }
+
+  virtual void modify_socket(Socket& socket, int events) override
+  {
+    modify_fd(static_cast<UnixSocket&>(socket).get_fd(), events);
+  }
+
+  virtual void remove_socket(Socket& socket) override
+  {
+    remove_fd(static_cast<UnixSocket&>(socket).get_fd());
+  }
+
+  virtual void add_port(void* handle, int events, const handler_type& handler) override
+  {
+    add_fd(((UnixPortHandle *)handle)->fd, events, handler);
+  }
+
+  virtual void modify_port(void* handle, int events) override
+  {
+    modify_fd(((UnixPortHandle *)handle)->fd, events);
+  }
+
+  virtual void remove_port(void* handle) override
+  {
+    remove_fd(((UnixPortHandle *)handle)->fd);
+  }
+
+  virtual void wait(int timeout) override
+  {
+    struct epoll_event events[64];
+    int count = epoll_wait(epfd, events, sizeof(events) / sizeof(*events), timeout);
+    if (count < 0) {
+      if (errno == EINTR) {
+        return;
+      }
+      throw std::runtime_error("cannot wait epoll: " + std::string(strerror(errno)));
+    }
+    for (int index = 0; index < count; ++index) {
+      if (events[index].data.fd == evfd) {
+        uint64_t value;
+        (void)!::read(evfd, &value, sizeof(value));
+        continue;
+      }
+      // Handler may be removed by another handler in this loop
+      auto iter = handlers.find(events[index].data.fd);
+      if (iter == handlers.end()) {
+        continue;
+      }
+      auto handler = iter->second;
+      int mask = 0;
+      if (events[index].events & EPOLLIN) {
+        mask |= POLL_IN;
+      }
+      if (events[index].events & EPOLLOUT) {
+        mask |= POLL_OUT;
+      }
+      if (events[index].events & (EPOLLERR | EPOLLHUP)) {
+        mask |= POLL_ERROR;
+      }
+      (*handler)(mask);
+    }
+  }
+
+  virtual void wakeup() override
+  {
+    uint64_t value = 1;
+    (void)!::write(evfd, &value, sizeof(value));
+  }
+
+private:
+  static uint32_t to_epoll(int events)
+  {
+    return ((events & POLL_IN) ? (uint32_t)EPOLLIN : 0) | ((events & POLL_OUT) ? (uint32_t)EPOLLOUT : 0);
+  }
+
+  void add_fd(int fd, int events, const handler_type& handler)
+  {
+    struct epoll_event event;
+    event.events = to_epoll(events);
+    event.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      throw std::runtime_error("cannot add to epoll: " + std::string(strerror(errno)));
+    }
+    handlers[fd] = std::make_shared<handler_type>(handler);
+  }
+
+  void modify_fd(int fd, int events)
+  {
+    struct epoll_event event;
+    event.events = to_epoll(events);
+    event.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &event) != 0) {
+      throw std::runtime_error("cannot modify epoll: " + std::string(strerror(errno)));
+    }
+  }
+
+  void remove_fd(int fd)
+  {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    handlers.erase(fd);
+  }
+
+  int epfd;
+  int evfd;
+  std::unordered_map<int, std::shared_ptr<handler_type>> handlers;
+};
+
+/**
+ * @brief PortIo implementation based on io_uring
+ *
+ * Each request is submitted as a poll linked with a read or write, so
+ * that ports in non-blocking mode wait for readiness in the kernel. All
+ * requests queued in one turn of the event loop are submitted by one
+ * system call, and completions are reaped when the ring descriptor
+ * (watched by the poller) becomes readable. The ring is driven by raw
+ * system calls, so no library is needed.
+ */
+class IoUringPortIo : public PortIo
+{
+public:
+  explicit IoUringPortIo(const Poller::shared_ptr& poller)
+  : poller(poller), last_request(0), sq_tail_local(0), sq_submitted(0)
+  {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring.fd = (int)syscall(__NR_io_uring_setup, ring_entries, &params);
+    if (ring.fd < 0) {
+      throw std::runtime_error("cannot create io_uring: " + std::string(strerror(errno)));
+    }
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+    if (single_mmap) {
+      sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sq_ptr = map(sq_size, IORING_OFF_SQ_RING);
+    cq_ptr = single_mmap ? sq_ptr : map(cq_size, IORING_OFF_CQ_RING);
+    sqes = (struct io_uring_sqe *)map(sqes_size, IORING_OFF_SQES);
+    if ((sq_ptr == MAP_FAILED) || (cq_ptr == MAP_FAILED) || (sqes == MAP_FAILED)) {
+      auto message = std::string(strerror(errno));
+      unmap();
+      throw std::runtime_error("cannot map io_uring: " + message);
+    }
+
+    auto sq = (char *)sq_ptr;
+    sq_head = (unsigned *)(sq + params.sq_off.head);
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sq_flags = (unsigned *)(sq + params.sq_off.flags);
+    sq_array = (unsigned *)(sq + params.sq_off.array);
+    sq_tail_local = sq_submitted = *sq_tail;
+    auto cq = (char *)cq_ptr;
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    try {
+      poller->add_port(&ring, Poller::POLL_IN, [this](int){
+        reap();
+      });
+    } catch (...) {
+      unmap();
+      throw;
+    }
+  }
+
+  virtual ~IoUringPortIo()
+  {
+    poller->remove_port(&ring);
+    // Wait for the kernel to release the buffers of requests in flight
+    std::vector<request_type> targets;
+    for (const auto& item : requests) {
+      targets.push_back(item.first);
+    }
+    for (const auto request : targets) {
+      cancel(request);
+    }
+    flush();
+    while (!requests.empty()) {
+      if ((syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) &&
+          (errno != EINTR)) {
+        break;
+      }
+      reap();
+    }
+    unmap();
+  }
+
+  virtual request_type submit_read(void* handle, void* buffer, int length, const handler_type& handler) override
+  {
+    return submit(handle, false, (char *)buffer, length, handler);
+  }
+
+  virtual request_type submit_write(void* handle, const void* data, int length, const handler_type& handler) override
+  {
+    return submit(handle, true, (char *)data, length, handler);
+  }
+
+  virtual void cancel(request_type request) override
+  {
+    auto iter = requests.find(request);
+    if ((iter == requests.end()) || iter->second.canceled) {
+      return;
+    }
+    // The request and its handler (which keeps the buffer alive) are
+    // forgotten when its final completion arrives
+    iter->second.canceled = true;
+    reserve(2);
+    for (const std::uint64_t target : { (request << 1) | 1, request << 1 }) {
+      auto sqe = get_sqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = target;
+      sqe->user_data = 0;
+    }
+  }
+
+  virtual void release(void* handle) override
+  {
+    const int fd = ((UnixPortHandle *)handle)->fd;
+    std::vector<request_type> targets;
+    for (const auto& item : requests) {
+      if (item.second.fd == fd) {
+        targets.push_back(item.first);
+      }
+    }
+    for (const auto request : targets) {
+      cancel(request);
+    }
+    // Cancel before the descriptor is closed
+    flush();
+  }
+
+  virtual void flush() override
+  {
+    if (sq_submitted == sq_tail_local) {
+      return;
+    }
+    __atomic_store_n(sq_tail, sq_tail_local, __ATOMIC_RELEASE);
+    while (sq_submitted != sq_tail_local) {
+      int result = (int)syscall(__NR_io_uring_enter, ring.fd, sq_tail_local - sq_submitted, 0, 0, nullptr, 0);
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if ((errno == EAGAIN) || (errno == EBUSY)) {
+          // Completion queue is full; make room and retry
+          reap();
+          continue;
+        }
+        throw std::runtime_error("cannot submit io_uring: " + std::string(strerror(errno)));
+      }
+      if (result == 0) {
+        break;
+      }
+      sq_submitted += result;
+    }
+  }
+
+private:
+  static const unsigned ring_entries = 1024;
+
+  struct Request
+  {
+    int fd;                   ///< File descriptor of port
+    bool write;               ///< Write request
+    bool canceled;            ///< Canceled by owner
+    char *buffer;             ///< Bytes to write, or space to read (pinned)
+    unsigned length;          ///< Number of bytes to transfer
+    handler_type handler;     ///< Completion handler
+  };
+
+  void *map(std::size_t size, off_t offset)
+  {
+    return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, offset);
+  }
+
+  void unmap()
+  {
+    if (sqes && (sqes != MAP_FAILED)) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_ptr && (cq_ptr != MAP_FAILED) && !single_mmap) {
+      munmap(cq_ptr, cq_size);
+    }
+    if (sq_ptr && (sq_ptr != MAP_FAILED)) {
+      munmap(sq_ptr, sq_size);
+    }
+    ::close(ring.fd);
+  }
+
+  /**
+   * @brief Make room for SQEs which must be submitted together
+   */
+  void reserve(unsigned count)
+  {
+    if (sq_tail_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + count > sq_entries) {
+      flush();
+      if (sq_tail_local - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + count > sq_entries) {
+        throw std::runtime_error("io_uring submission queue is full");
+      }
+    }
+  }
+
+  struct io_uring_sqe *get_sqe()
+  {
+    const unsigned index = sq_tail_local & sq_mask;
+    auto sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    ++sq_tail_local;
+    return sqe;
+  }
+
+  request_type submit(void* handle, bool write, char *buffer, int length, const handler_type& handler)
+  {
+    const request_type id = ++last_request;
+    auto& request = requests[id];
+    request.fd = ((UnixPortHandle *)handle)->fd;
+    request.write = write;
+    request.canceled = false;
+    request.buffer = buffer;
+    request.length = (unsigned)length;
+    request.handler = handler;
+    try {
+      queue(id, request);
+    } catch (...) {
+      requests.erase(id);
+      throw;
+    }
+    return id;
+  }
+
+  /**
+   * @brief Queue SQEs of a request
+   *
+   * @param id Request ID
+   * @param request A reference to request
+   * @param poll Wait for readiness before the transfer
+   */
+  void queue(request_type id, Request& request, bool poll = true)
+  {
+    reserve(2);
+    if (poll) {
+      auto sqe = get_sqe();
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = request.fd;
+      sqe->poll32_events = request.write ? POLLOUT : POLLIN;
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = (id << 1) | 1;
+    }
+    auto transfer = get_sqe();
+    transfer->opcode = request.write ? IORING_OP_WRITE : IORING_OP_READ;
+    transfer->fd = request.fd;
+    transfer->addr = (std::uint64_t)(std::uintptr_t)request.buffer;
+    transfer->len = request.length;
+    transfer->off = (std::uint64_t)-1;
+    transfer->user_data = id << 1;
+  }
+
+  void reap()
+  {
+    for (;;) {
+      unsigned head = *cq_head;
+      const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      if (head == tail) {
+        if (!(__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)) {
+          return;
+        }
+        // Let the kernel move overflowed completions into the queue
+        syscall(__NR_io_uring_enter, ring.fd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (*cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+          return;
+        }
+        continue;
+      }
+      const auto cqe = cqes[head & cq_mask];
+      __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+      complete(cqe.user_data, cqe.res);
+    }
+  }
+
+  void complete(std::uint64_t user_data, int result)
+  {
+    if ((user_data == 0) || (user_data & 1)) {
+      // Completion of poll or cancel; the linked transfer reports errors
+      return;
+    }
+    const request_type id = user_data >> 1;
+    auto iter = requests.find(id);
+    if (iter == requests.end()) {
+      return;
+    }
+    auto& request = iter->second;
+    if (!request.canceled) {
+      if ((result == -EAGAIN) || (result == -EINTR)) {
+        queue(id, request);
+        return;
+      }
+      if (result == -ECANCELED) {
+        // The poll has failed (it may fail on a spurious wakeup, such as
+        // a change of termios); the transfer itself tells the truth
+        queue(id, request, false);
+        return;
+      }
+    }
+    const auto handler = std::move(request.handler);
+    const char *buffer = request.buffer;
+    const bool write = request.write;
+    const bool canceled = request.canceled;
+    requests.erase(iter);
+    if (!canceled) {
+      Completion completion = { result, buffer, std::string() };
+      if (result < 0) {
+        completion.length = -1;
+        completion.error = std::string(write ? "cannot write port: " : "cannot read port: ") + strerror(-result);
+      } else if (!write && (result == 0)) {
+        // A non-blocking read returns 0 only at end of file (hang-up)
+        completion.length = -1;
+        completion.error = "cannot read port: hung up";
+      }
+      handler(completion);
+    }
+  }
+
+  Poller::shared_ptr poller;
+  UnixPortHandle ring;        ///< Ring descriptor in the form of port handle
+  request_type last_request;
+  std::unordered_map<request_type, Request> requests;
+
+  bool single_mmap;
+  void *sq_ptr = nullptr;
+  void *cq_ptr = nullptr;
+  struct io_uring_sqe *sqes = nullptr;
+  std::size_t sq_size;
+  std::size_t cq_size;
+  std::size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_flags;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_tail_local;     ///< Tail including SQEs not yet published
+  unsigned sq_submitted;      ///< Tail consumed by the kernel
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+/**
+ * @brief DeviceMonitor implementation based on uevents of the kernel
+ *
+ * Uevents are received from a netlink socket without libudev, and ports
+ * may have changed when one of the tty subsystem arrives. Bursts of
+ * uevents (a USB hub with several adapters) are coalesced into one
+ * enumeration.
+ */
+class NetlinkDeviceMonitor : public DeviceMonitor
+{
+public:
+  NetlinkDeviceMonitor()
+  {
+    sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (sock < 0) {
+      throw std::runtime_error("cannot create netlink socket: " + std::string(strerror(errno)));
+    }
+    struct sockaddr_nl addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;         // Uevents from the kernel
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      auto message = std::string(strerror(errno));
+      ::close(sock);
+      throw std::runtime_error("cannot bind netlink socket: " + message);
+    }
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (evfd < 0) {
+      auto message = std::string(strerror(errno));
+      ::close(sock);
+      throw std::runtime_error("cannot create eventfd: " + message);
+    }
+  }
+
+  virtual ~NetlinkDeviceMonitor()
+  {
+    ::close(evfd);
+    ::close(sock);
+  }
+
+  virtual bool wait() override
+  {
+    for (;;) {
+      struct pollfd pfds[2] = { { sock, POLLIN, 0 }, { evfd, POLLIN, 0 } };
+      if (::poll(pfds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      if (pfds[1].revents) {
+        return false;
+      }
+      if (receive()) {
+        return true;
+      }
+    }
+  }
+
+  virtual void interrupt() override
+  {
+    uint64_t value = 1;
+    (void)!::write(evfd, &value, sizeof(value));
+  }
+
+private:
+  /**
+   * @brief Receive all uevents queued
+   *
+   * @return true if any of them may change ports
+   */
+  bool receive()
+  {
+    bool changed = false;
+    char buffer[8192];
+    for (;;) {
+      struct sockaddr_nl addr;
+      socklen_t addr_len = sizeof(addr);
+      ssize_t len = recvfrom(sock, buffer, sizeof(buffer) - 1, 0, (struct sockaddr *)&addr, &addr_len);
+      if (len < 0) {
+        if (errno == ENOBUFS) {
+          // Uevents have been lost
+          changed = true;
+          continue;
+        }
+        if (errno == EINTR) {
+          continue;
+        }
+        return changed;
+      }
+      if (addr.nl_pid != 0) {
+        continue;               // Not from the kernel
+      }
+      buffer[len] = '\0';
+      // "ACTION@DEVPATH" followed by "KEY=VALUE" fields separated by NUL
+      for (const char *field = buffer; field < buffer + len; field += std::strlen(field) + 1) {
+        if (std::strncmp(field, "SUBSYSTEM=tty", sizeof("SUBSYSTEM=tty")) == 0) {
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  int sock;
+  int evfd;
+};
+
+class LinuxOsPort : public UnixOsPort
+{
+public:
+  LinuxOsPort() = default;
+
+  virtual ~LinuxOsPort() = default;
+
+  virtual Poller::shared_ptr create_poller() override
+  {
+    return Poller::shared_ptr(new EpollPoller());
+  }
+
+  /**
+   * @brief Create an engine to transfer bytes of ports asynchronously
+   *
+   * Falls back to the engine based on readiness if io_uring is not
+   * available (old kernel, or disabled by seccomp or sysctl).
+   *
+   * @param poller Poller to dispatch completions
+   * @return A shared pointer to PortIo object
+   */
+  virtual PortIo::shared_ptr create_port_io(const Poller::shared_ptr& poller) override
+  {
+    try {
+      return PortIo::shared_ptr(new IoUringPortIo(poller));
+    } catch (const std::exception&) {
+      return OsPort::create_port_io(poller);
+    }
+  }
+
+  /**
+   * @brief Open serial port
+   *
+   * The driver is asked to pass received bytes without batching them
+   * (ASYNC_LOW_LATENCY; e.g. the latency timer of FTDI is set to 1ms),
+   * so that gaps between frames can be measured. Ports which do not
+   * support it are opened as they are.
+   *
+   * @param path Path of port
+   * @return Port handle
+   */
+  virtual handle_type open_port(const char* path) override
+  {
+    auto handle = UnixOsPort::open_port(path);
+    auto port = (UnixPortHandle *)handle;
+    struct serial_struct serial;
+    if ((ioctl(port->fd, TIOCGSERIAL, &serial) == 0) && !(serial.flags & ASYNC_LOW_LATENCY)) {
+      const int flags = serial.flags;
+      serial.flags |= ASYNC_LOW_LATENCY;
+      if (ioctl(port->fd, TIOCSSERIAL, &serial) == 0) {
+        port->serial_flags = flags;
+      }
+    }
+    return handle;
+  }
+
+  /**
+   * @brief Close port
+   *
+   * Flags of the driver changed by open_port() are restored.
+   *
+   * @param handle Port handle
+   */
+  virtual void close_port(handle_type handle) override
+  {
+    auto port = (UnixPortHandle *)handle;
+    struct serial_struct serial;
+    if (port && (port->serial_flags >= 0) && (ioctl(port->fd, TIOCGSERIAL, &serial) == 0)) {
+      serial.flags = port->serial_flags;
+      ioctl(port->fd, TIOCSSERIAL, &serial);
+    }
+    UnixOsPort::close_port(handle);
+  }
+
+  /**
+   * @brief Get number of bytes written but not yet transmitted
+   *
+   * The output queue does not include bytes in the FIFO and the shift
+   * register of UART, so one more byte is counted until the transmitter
+   * is empty (where the driver tells it).
+   *
+   * @param handle Port handle
+   * @return Number of bytes which have not left the port
+   */
+  virtual int get_output_size(handle_type handle) override
+  {
+    int size = UnixOsPort::get_output_size(handle);
+    unsigned int lsr;
+    if ((size == 0) && (ioctl(((UnixPortHandle *)handle)->fd, TIOCSERGETLSR, &lsr) == 0) &&
+        !(lsr & TIOCSER_TEMT)) {
+      size = 1;
+    }
+    return size;
+  }
+
+  /**
+   * @brief Create a monitor to wait for addition and removal of ports
+   *
+   * Falls back to periodic enumeration if netlink is not available.
+   *
+   * @return A unique pointer to DeviceMonitor object
+   */
+  virtual DeviceMonitor::unique_ptr create_device_monitor() override
+  {
+    try {
+      return DeviceMonitor::unique_ptr(new NetlinkDeviceMonitor());
+    } catch (const std::exception&) {
+      return OsPort::create_device_monitor();
+    }
+  }
+
+  /**
+   * @brief Enumerate serial ports
+   *
+   * Lists ttys in /sys/class/tty which are backed by a device driver.
+   * Legacy UARTs (ttyS*) are listed only if the hardware is present.
+   * For USB devices, IDs and serial number are read from the USB device
+   * above the tty, and the location is its interface (such as
+   * "1-1.4:1.0"); otherwise the location is the name of the device.
+   *
+   * @return A vector
+   */
+  virtual std::vector<SerialPortInfo> enumerate() override
+  {
+    static const std::string class_dir = "/sys/class/tty/";
+    std::vector<std::string> names;
+
+    DIR *dir = opendir(class_dir.c_str());
+    if (dir) {
+      while (struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+          continue;
+        }
+        names.push_back(entry->d_name);
+      }
+      closedir(dir);
+    }
+    std::sort(names.begin(), names.end(), natural_less);
+
+    std::vector<SerialPortInfo> list;
+    for (const auto& name : names) {
+      const auto device_dir = class_dir + name + "/device";
+      const auto driver = real_path(device_dir + "/driver");
+      if (driver.empty()) {
+        continue;
+      }
+      const auto driver_name = driver.substr(driver.rfind('/') + 1);
+      const auto path = "/dev/" + name;
+      if ((name.compare(0, 4, "ttyS") == 0) && !is_uart_present(path)) {
+        continue;
+      }
+
+      SerialPortInfo info(path, std::string());
+      info.driver = driver_name;
+      const auto device = real_path(device_dir);
+      info.location = device.substr(device.rfind('/') + 1);
+      for (auto dir = device; dir.size() > 1; dir.erase(dir.rfind('/'))) {
+        if (info.name.empty()) {
+          read_sysfs(dir + "/product", info.name);
+        }
+        std::string value;
+        if (!read_sysfs(dir + "/idVendor", value)) {
+          continue;
+        }
+        info.vendor_id = (int)std::strtol(value.c_str(), nullptr, 16);
+        if (read_sysfs(dir + "/idProduct", value)) {
+          info.product_id = (int)std::strtol(value.c_str(), nullptr, 16);
+        }
+        read_sysfs(dir + "/serial", info.serial_number);
+        if (device.size() > dir.size()) {
+          const auto child = device.substr(dir.size() + 1);
+          info.location = child.substr(0, child.find('/'));
+        }
+        break;
+      }
+      if (info.name.empty()) {
+        info.name = driver_name;
+      }
+      list.push_back(info);
+      list.back().order = (int)list.size();
+    }
+
+    for (const auto& info : pseudo_ports) {
+      list.push_back(info);
+      list.back().order = (int)list.size();
+    }
+
+    return list;
+  }
+
+  /**
+   * @brief Set baud rate
+   *
+   * Any baud rate supported by the driver can be set by BOTHER.
+   *
+   * @param fd File descriptor of tty device
+   * @param baud_rate Baud rate in bps
+   */
+  virtual void set_baud_rate(int fd, int baud_rate) override
+  {
+    if (baud_rate <= 0) {
+      throw std::invalid_argument("unsupported baud rate: " + std::to_string(baud_rate));
+    }
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) != 0) {
+      throw std::runtime_error("cannot get baud rate: " + get_error_string());
+    }
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= (BOTHER | (BOTHER << IBSHIFT));
+    tio.c_ispeed = baud_rate;
+    tio.c_ospeed = baud_rate;
+    if (ioctl(fd, TCSETS2, &tio) != 0) {
+      throw std::runtime_error("cannot set baud rate: " + get_error_string());
+    }
+  }
+
+  /**
+   * @brief Get baud rate
+   *
+   * @param fd File descriptor of tty device
+   * @return Baud rate in bps
+   */
+  virtual int get_baud_rate(int fd) override
+  {
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) != 0) {
+      throw std::runtime_error("cannot get baud rate: " + get_error_string());
+    }
+    return tio.c_ospeed;
+  }
+
+private:
+  static bool is_uart_present(const std::string& path)
+  {
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    struct serial_struct serial;
+    bool present = (ioctl(fd, TIOCGSERIAL, &serial) == 0) && (serial.type != PORT_UNKNOWN);
+    ::close(fd);
+    return present;
+  }
+};
+
+OsPort::shared_ptr OsPort::create()
+{
+  return shared_ptr(new LinuxOsPort());
+}
@@ -0,0 +1,902 @@
+#include "osport_unix.hpp"
+#include "ring.hpp"
+#include <stdexcept>
+#include <string>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <csignal>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+#if defined(__linux__)
+#include <linux/serial.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static void set_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+    throw std::runtime_error("cannot set non-blocking mode: " + std::string(strerror(errno)));
+  }
+}
+
+static int from_tiocm(int bits)
+{
+  return ((bits & TIOCM_DTR) ? MODEM_DTR : 0) |
+         ((bits & TIOCM_RTS) ? MODEM_RTS : 0) |
+         ((bits & TIOCM_CTS) ? MODEM_CTS : 0) |
+         ((bits & TIOCM_DSR) ? MODEM_DSR : 0) |
+         ((bits & TIOCM_CD) ? MODEM_DCD : 0) |
+         ((bits & TIOCM_RI) ? MODEM_RI : 0);
+}
+
+static int to_tiocm(int lines)
+{
+  return ((lines & MODEM_DTR) ? TIOCM_DTR : 0) |
+         ((lines & MODEM_RTS) ? TIOCM_RTS : 0);
+}
+
+void *map_mirrored_memory(std::size_t size, const char *path)
+{
+  int fd = -1;
+  if (path) {
+    fd = ::open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  } else {
+#if defined(__linux__)
+    fd = memfd_create("ring", MFD_CLOEXEC);
+#endif
+  }
+  if (fd < 0) {
+    return nullptr;
+  }
+  char *base = nullptr;
+  if (ftruncate(fd, size) == 0) {
+    void *area = mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area != MAP_FAILED) {
+      base = (char *)area;
+      if ((mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+          (mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+        munmap(base, size * 2);
+        base = nullptr;
+      }
+    }
+  }
+  ::close(fd);
+  return base;
+}
+
+void unmap_mirrored_memory(void *address, std::size_t size)
+{
+  munmap(address, size * 2);
+}
+
+UnixSocket::UnixSocket(int domain, int type, int protocol)
+{
+  fd = ::socket(domain, type, protocol);
+  if (fd < 0) {
+    throw std::runtime_error("cannot create socket: " + error_string());
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  set_nonblocking(fd);
+  int value = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+}
+
+UnixSocket::UnixSocket(int fd) : fd(fd)
+{
+  assert(fd >= 0);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  set_nonblocking(fd);
+  int value = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+}
+
+UnixSocket::~UnixSocket()
+{
+  close();
+}
+
+void UnixSocket::set_reuse_port()
+{
+  assert(fd >= 0);
+
+#ifdef SO_REUSEPORT
+  int value = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) != 0) {
+    throw std::runtime_error("cannot set SO_REUSEPORT: " + error_string());
+  }
+#else
+  throw std::runtime_error("SO_REUSEPORT is not supported");
+#endif
+}
+
+void UnixSocket::bind(const std::string& address, int port)
+{
+  assert(fd >= 0);
+
+  struct sockaddr_in saddr;
+  std::memset(&saddr, 0, sizeof(saddr));
+  saddr.sin_family = AF_INET;
+  if (inet_pton(AF_INET, address.c_str(), &saddr.sin_addr) != 1) {
+    throw std::invalid_argument("invalid address: " + address);
+  }
+  saddr.sin_port = htons(port);
+
+  if (::bind(fd, (const struct sockaddr *)&saddr, sizeof(saddr)) != 0) {
+    throw std::runtime_error("cannot bind address: " + error_string());
+  }
+}
+
+void UnixSocket::get_address(std::string& address, int& port)
+{
+  assert(fd >= 0);
+
+  struct sockaddr_in saddr;
+  socklen_t saddrlen = sizeof(saddr);
+  if (getsockname(fd, (struct sockaddr *)&saddr, &saddrlen) != 0) {
+    throw std::runtime_error("cannot get socket address: " + error_string());
+  }
+  char buffer[INET_ADDRSTRLEN];
+  address = inet_ntop(AF_INET, &saddr.sin_addr, buffer, sizeof(buffer));
+  port = ntohs(saddr.sin_port);
+}
+
+void UnixSocket::listen()
+{
+  assert(fd >= 0);
+
+  if (::listen(fd, SOMAXCONN) != 0) {
+    throw std::runtime_error("cannot listen socket: " + error_string());
+  }
+}
+
+Socket::shared_ptr UnixSocket::accept()
+{
+  assert(fd >= 0);
+
+  for (;;) {
+    int client = ::accept(fd, nullptr, nullptr);
+    if (client >= 0) {
+      return Socket::shared_ptr(new UnixSocket(client));
+    }
+    if (would_block() || (errno == ECONNABORTED)) {
+      return nullptr;
+    } else if (errno != EINTR) {
+      throw std::runtime_error("cannot accept socket: " + error_string());
+    }
+  }
+}
+
+void UnixSocket::close()
+{
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+std::string UnixSocket::error_string()
+{
+  return strerror(errno);
+}
+
+bool UnixSocket::would_block()
+{
+  return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+}
+
+int UnixSocket::recv_bytes(void *buffer, int length)
+{
+  assert(fd >= 0);
+
+  int len;
+  do {
+    len = ::recv(fd, buffer, length, 0);
+  } while ((len < 0) && (errno == EINTR));
+  return len;
+}
+
+int UnixSocket::send_bytes(const void *buffer, int length, bool more)
+{
+  assert(fd >= 0);
+
+  int flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+  if (more) {
+    flags |= MSG_MORE;
+  }
+#else
+  (void)more;
+#endif
+  int len;
+  do {
+    len = ::send(fd, buffer, length, flags);
+  } while ((len < 0) && (errno == EINTR));
+  return len;
+}
+
+UnixOsPort::UnixOsPort()
+{
+  loopback_pipe[0] = loopback_pipe[1] = -1;
+}
+
+UnixOsPort::~UnixOsPort()
+{
+  if (loopback_thread.joinable()) {
+    char ch = 0;
+    (void)!::write(loopback_pipe[1], &ch, 1);
+    loopback_thread.join();
+    ::close(loopback_pipe[0]);
+    ::close(loopback_pipe[1]);
+  }
+  for (const auto& pty : loopbacks) {
+    ::close(pty.master_fd);
+    ::close(pty.slave_fd);
+  }
+}
+
+std::string UnixOsPort::get_error_string()
+{
+  return strerror(errno);
+}
+
+int UnixOsPort::getopt(int argc, char *argv[], const char *options, char*& optarg, int& optind)
+{
+  if (optind == 0) {
+    ::optind = 1;
+  }
+  int ch = ::getopt(argc, argv, options);
+  optarg = ::optarg;
+  optind = ::optind;
+  return ch;
+}
+
+int UnixOsPort::getpid()
+{
+  return ::getpid();
+}
+
+Socket::shared_ptr UnixOsPort::create_socket_tcp()
+{
+  return Socket::shared_ptr(new UnixSocket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+}
+
+/**
+ * @brief Open port
+ *
+ * The tty is opened in non-blocking raw mode and locked exclusively.
+ *
+ * @param path Path of port
+ * @return Port handle
+ */
+OsPort::handle_type UnixOsPort::open_port(const char* path)
+{
+  int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open port: " + get_error_string());
+  }
+
+  struct termios tio;
+  if ((ioctl(fd, TIOCEXCL) != 0) || (tcgetattr(fd, &tio) != 0)) {
+    auto message = get_error_string();
+    ::close(fd);
+    throw std::runtime_error("cannot initialize port: " + message);
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag |= (CLOCAL | CREAD);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+    auto message = get_error_string();
+    ::close(fd);
+    throw std::runtime_error("cannot initialize port: " + message);
+  }
+  tcflush(fd, TCIOFLUSH);
+
+  return (handle_type)new UnixPortHandle{fd, -1};
+}
+
+/**
+ * @brief Configure port
+ *
+ * @param handle Port handle
+ * @param set Config to change
+ * @param get Reference to store current config
+ */
+void UnixOsPort::configure_port(handle_type handle, const SerialPortConfig& set, SerialPortConfig& get)
+{
+  int fd = ((UnixPortHandle *)handle)->fd;
+  struct termios tio;
+
+  // Read current state
+  if (tcgetattr(fd, &tio) != 0) {
+    throw std::runtime_error("cannot get old state: " + get_error_string());
+  }
+  const struct termios old_tio = tio;
+
+  // Change state
+  if (set.field_mask & SerialPortConfig::SP_FIELD_DATA_BITS) {
+    tio.c_cflag &= ~CSIZE;
+    switch (set.data_bits) {
+    case SerialPortConfig::SP_DATABITS_5:
+      tio.c_cflag |= CS5;
+      break;
+    case SerialPortConfig::SP_DATABITS_6:
+      tio.c_cflag |= CS6;
+      break;
+    case SerialPortConfig::SP_DATABITS_7:
+      tio.c_cflag |= CS7;
+      break;
+    case SerialPortConfig::SP_DATABITS_8:
+      tio.c_cflag |= CS8;
+      break;
+    default:
+      throw std::invalid_argument("unsupported data bits: " + std::to_string(set.data_bits));
+    }
+  }
+  if (set.field_mask & SerialPortConfig::SP_FIELD_PARITY) {
+    tio.c_cflag &= ~(PARENB | PARODD);
+#ifdef CMSPAR
+    tio.c_cflag &= ~CMSPAR;
+#endif
+    switch (set.parity) {
+    case SerialPortConfig::SP_PARITY_NONE:
+      break;
+    case SerialPortConfig::SP_PARITY_ODD:
+      tio.c_cflag |= (PARENB | PARODD);
+      break;
+    case SerialPortConfig::SP_PARITY_EVEN:
+      tio.c_cflag |= PARENB;
+      break;
+#ifdef CMSPAR
+    case SerialPortConfig::SP_PARITY_MARK:
+      tio.c_cflag |= (PARENB | PARODD | CMSPAR);
+      break;
+    case SerialPortConfig::SP_PARITY_SPACE:
+      tio.c_cflag |= (PARENB | CMSPAR);
+      break;
+#endif
+    default:
+      throw std::invalid_argument("unsupported parity mode: " + std::to_string(set.parity));
+    }
+  }
+  if (set.field_mask & SerialPortConfig::SP_FIELD_STOP_BITS) {
+    switch (set.stop_bits) {
+    case SerialPortConfig::SP_STOPBITS_1:
+      tio.c_cflag &= ~CSTOPB;
+      break;
+    case SerialPortConfig::SP_STOPBITS_2:
+      tio.c_cflag |= CSTOPB;
+      break;
+    default:
+      throw std::invalid_argument("unsupported stop bits: " + std::to_string(set.stop_bits));
+    }
+  }
+  if (set.field_mask & SerialPortConfig::SP_FIELD_FLOW_CONTROL) {
+    switch (set.flow_control) {
+    case SerialPortConfig::SP_FLOWCONTROL_NONE:
+      tio.c_cflag &= ~CRTSCTS;
+      break;
+    case SerialPortConfig::SP_FLOWCONTROL_RTS_CTS:
+      tio.c_cflag |= CRTSCTS;
+      break;
+    default:
+      throw std::invalid_argument("unsupported flow control: " + std::to_string(set.flow_control));
+    }
+  }
+  if (set.field_mask & SerialPortConfig::SP_FIELD_XON_CHAR) {
+    tio.c_cc[VSTART] = set.xon_char;
+  }
+  if (set.field_mask & SerialPortConfig::SP_FIELD_XOFF_CHAR) {
+    tio.c_cc[VSTOP] = set.xoff_char;
+  }
+
+  // Touch the device only for changes (setting may reset the UART)
+  bool changed = false;
+  if (std::memcmp(&tio, &old_tio, sizeof(tio)) != 0) {
+    if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+      throw std::runtime_error("cannot set state: " + get_error_string());
+    }
+    changed = true;
+  }
+  if ((set.field_mask & SerialPortConfig::SP_FIELD_BAUD_RATE) && (get_baud_rate(fd) != set.baud_rate)) {
+    set_baud_rate(fd, set.baud_rate);
+    changed = true;
+  }
+
+  if (changed && (tcgetattr(fd, &tio) != 0)) {
+    throw std::runtime_error("cannot get new state: " + get_error_string());
+  }
+
+  get.baud_rate = get_baud_rate(fd);
+  switch (tio.c_cflag & CSIZE) {
+  case CS5:
+    get.data_bits = SerialPortConfig::SP_DATABITS_5;
+    break;
+  case CS6:
+    get.data_bits = SerialPortConfig::SP_DATABITS_6;
+    break;
+  case CS7:
+    get.data_bits = SerialPortConfig::SP_DATABITS_7;
+    break;
+  default:
+    get.data_bits = SerialPortConfig::SP_DATABITS_8;
+    break;
+  }
+  if (!(tio.c_cflag & PARENB)) {
+    get.parity = SerialPortConfig::SP_PARITY_NONE;
+#ifdef CMSPAR
+  } else if (tio.c_cflag & CMSPAR) {
+    get.parity = (tio.c_cflag & PARODD) ?
+      SerialPortConfig::SP_PARITY_MARK : SerialPortConfig::SP_PARITY_SPACE;
+#endif
+  } else {
+    get.parity = (tio.c_cflag & PARODD) ?
+      SerialPortConfig::SP_PARITY_ODD : SerialPortConfig::SP_PARITY_EVEN;
+  }
+  get.stop_bits = (tio.c_cflag & CSTOPB) ?
+    SerialPortConfig::SP_STOPBITS_2 : SerialPortConfig::SP_STOPBITS_1;
+  get.flow_control = (tio.c_cflag & CRTSCTS) ?
+    SerialPortConfig::SP_FLOWCONTROL_RTS_CTS : SerialPortConfig::SP_FLOWCONTROL_NONE;
+  get.xon_char = tio.c_cc[VSTART];
+  get.xoff_char = tio.c_cc[VSTOP];
+  get.error_char = 0;
+}
+
+/**
+ * @brief Read bytes from port without blocking
+ *
+ * @param handle Port handle
+ * @param buffer Buffer to store bytes
+ * @param length Size of buffer
+ * @return Number of bytes read (0 if no bytes are available)
+ */
+int UnixOsPort::read_port(handle_type handle, void* buffer, int length)
+{
+  int fd = ((UnixPortHandle *)handle)->fd;
+  for (;;) {
+    int len = ::read(fd, buffer, length);
+    if ((len == 0) && (length > 0)) {
+      // End of file (hang-up) is an error, unlike no bytes available
+      throw std::runtime_error("cannot read port: hung up");
+    } else if (len >= 0) {
+      return len;
+    }
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      return 0;
+    } else if (errno != EINTR) {
+      throw std::runtime_error("cannot read port: " + get_error_string());
+    }
+  }
+}
+
+/**
+ * @brief Write bytes to port without blocking
+ *
+ * @param handle Port handle
+ * @param buffer Bytes to write
+ * @param length Number of bytes to write
+ * @return Number of bytes written (0 if port is not writable now)
+ */
+int UnixOsPort::write_port(handle_type handle, const void* buffer, int length)
+{
+  int fd = ((UnixPortHandle *)handle)->fd;
+  for (;;) {
+    int len = ::write(fd, buffer, length);
+    if (len >= 0) {
+      return len;
+    }
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      return 0;
+    } else if (errno != EINTR) {
+      throw std::runtime_error("cannot write port: " + get_error_string());
+    }
+  }
+}
+
+/**
+ * @brief Get number of bytes written but not yet transmitted
+ *
+ * @param handle Port handle
+ * @return Number of bytes in the output queue of the driver
+ */
+int UnixOsPort::get_output_size(handle_type handle)
+{
+  int fd = ((UnixPortHandle *)handle)->fd;
+  int size;
+  if (ioctl(fd, TIOCOUTQ, &size) != 0) {
+    throw std::runtime_error("cannot get output queue: " + get_error_string());
+  }
+  return size;
+}
+
+/**
+ * @brief Get modem lines
+ *
+ * @param handle Port handle
+ * @return Lines which are active (combination of MODEM_*)
+ */
+int UnixOsPort::get_modem_lines(handle_type handle)
+{
+  int fd = ((UnixPortHandle *)handle)->fd;
+  int bits;
+  if (ioctl(fd, TIOCMGET, &bits) != 0) {
+    throw std::runtime_error("cannot get modem lines: " + get_error_string());
+  }
+  return from_tiocm(bits);
+}
+
+/**
+ * @brief Set modem output lines
+ *
+ * @param handle Port handle
+ * @param mask Lines to change (combination of MODEM_DTR, MODEM_RTS and MODEM_BREAK)
+ * @param lines Lines to activate among mask
+ */
+void UnixOsPort::set_modem_lines(handle_type handle, int mask, int lines)
+{
+  int fd = ((UnixPortHandle *)handle)->fd;
+  const int set_bits = to_tiocm(mask & lines);
+  const int clear_bits = to_tiocm(mask & ~lines);
+  if ((set_bits && (ioctl(fd, TIOCMBIS, &set_bits) != 0)) ||
+      (clear_bits && (ioctl(fd, TIOCMBIC, &clear_bits) != 0))) {
+    throw std::runtime_error("cannot set modem lines: " + get_error_string());
+  }
+  if ((mask & MODEM_BREAK) && (ioctl(fd, (lines & MODEM_BREAK) ? TIOCSBRK : TIOCCBRK) != 0)) {
+    throw std::runtime_error("cannot set break: " + get_error_string());
+  }
+}
+
+/**
+ * @brief Interval in milliseconds to poll modem lines without TIOCMIWAIT
+ */
+static const int modem_poll_interval = 10;
+
+#if defined(TIOCMIWAIT)
+/**
+ * @brief Signal to interrupt TIOCMIWAIT of watching threads
+ */
+static const int modem_wake_signal = SIGUSR2;
+
+static std::mutex modem_signal_mutex;
+static int modem_signal_users;
+static struct sigaction modem_saved_action;
+
+/**
+ * @brief Take over the wake signal while any watcher exists
+ *
+ * A handler without SA_RESTART lets the signal interrupt TIOCMIWAIT.
+ */
+static void acquire_modem_signal()
+{
+  std::lock_guard<std::mutex> lock(modem_signal_mutex);
+  if (modem_signal_users++ > 0) {
+    return;
+  }
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = [](int){};
+  sigemptyset(&action.sa_mask);
+  sigaction(modem_wake_signal, &action, &modem_saved_action);
+}
+
+/**
+ * @brief Restore the previous handler of the wake signal after the last watcher
+ */
+static void release_modem_signal()
+{
+  std::lock_guard<std::mutex> lock(modem_signal_mutex);
+  if (--modem_signal_users == 0) {
+    sigaction(modem_wake_signal, &modem_saved_action, nullptr);
+  }
+}
+#endif
+
+/**
+ * @brief Watcher of modem input lines for POSIX systems
+ *
+ * Where TIOCMIWAIT is available (Linux), the thread blocks until the
+ * driver reports a change, and the interrupt counters of TIOCGICOUNT
+ * tell pulses which are over before the lines are read. Otherwise, or
+ * if the driver does not support it, lines are polled.
+ *
+ * TIOCMIWAIT can be interrupted only by a signal, so SIGUSR2 is taken
+ * over while any watcher exists, and the previous handler is restored
+ * when the last one is destroyed. The application must not use SIGUSR2
+ * for anything else meanwhile.
+ */
+class UnixModemWatcher : public ModemWatcher
+{
+public:
+  UnixModemWatcher(int fd, const Poller::shared_ptr& poller)
+  : ModemWatcher(poller), fd(fd), stopping(false), finished(false)
+  {
+#if defined(TIOCMIWAIT)
+    acquire_modem_signal();
+#endif
+    thread = std::thread([this]{ run(); });
+  }
+
+  virtual ~UnixModemWatcher()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+    condition.notify_all();
+#if defined(TIOCMIWAIT)
+    // Signal again only if it arrived just before the thread blocked
+    while (!finished) {
+      pthread_kill(thread.native_handle(), modem_wake_signal);
+      condition.wait_for(lock, std::chrono::milliseconds(modem_poll_interval), [this]{ return finished; });
+    }
+#endif
+    lock.unlock();
+    thread.join();
+#if defined(TIOCMIWAIT)
+    release_modem_signal();
+#endif
+  }
+
+private:
+
+  void run()
+  {
+    int bits;
+    if (ioctl(fd, TIOCMGET, &bits) != 0) {
+      finish();
+      return;
+    }
+    int lines = from_tiocm(bits) & MODEM_INPUTS;
+#if defined(TIOCMIWAIT)
+    struct serial_icounter_struct counts;
+    bool counted = (ioctl(fd, TIOCGICOUNT, &counts) == 0);
+    bool interrupt = true;
+#else
+    const bool interrupt = false;
+#endif
+    while (!stopping) {
+      if (interrupt) {
+#if defined(TIOCMIWAIT)
+        if (ioctl(fd, TIOCMIWAIT, TIOCM_CTS | TIOCM_DSR | TIOCM_CD | TIOCM_RNG) != 0) {
+          if (errno != EINTR) {
+            interrupt = false;
+          }
+          continue;
+        }
+#endif
+      } else {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (condition.wait_for(lock, std::chrono::milliseconds(modem_poll_interval), [this]{ return stopping.load(); })) {
+          break;
+        }
+      }
+      const auto time = now();
+      if (ioctl(fd, TIOCMGET, &bits) != 0) {
+        break;
+      }
+      const int current = from_tiocm(bits) & MODEM_INPUTS;
+      int changed = current ^ lines;
+#if defined(TIOCMIWAIT)
+      struct serial_icounter_struct new_counts;
+      if (counted && (ioctl(fd, TIOCGICOUNT, &new_counts) == 0)) {
+        changed |= ((new_counts.cts != counts.cts) ? MODEM_CTS : 0) |
+                   ((new_counts.dsr != counts.dsr) ? MODEM_DSR : 0) |
+                   ((new_counts.dcd != counts.dcd) ? MODEM_DCD : 0) |
+                   ((new_counts.rng != counts.rng) ? MODEM_RI : 0);
+        counts = new_counts;
+      }
+#endif
+      lines = current;
+      if (changed) {
+        post(ModemEvent{time, lines, changed});
+      }
+    }
+    finish();
+  }
+
+  void finish()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished = true;
+    }
+    condition.notify_all();
+  }
+
+  int fd;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::atomic<bool> stopping;
+  bool finished;              ///< The thread has left run() (guarded by mutex)
+};
+
+/**
+ * @brief Start watching modem input lines
+ *
+ * @param handle Port handle
+ * @param poller Poller to wake up when lines change
+ * @return A unique pointer to ModemWatcher object
+ */
+ModemWatcher::unique_ptr UnixOsPort::watch_modem_lines(handle_type handle, const Poller::shared_ptr& poller)
+{
+  int fd = ((UnixPortHandle *)handle)->fd;
+  int bits;
+  if (ioctl(fd, TIOCMGET, &bits) != 0) {
+    throw std::runtime_error("cannot get modem lines: " + get_error_string());
+  }
+  return ModemWatcher::unique_ptr(new UnixModemWatcher(fd, poller));
+}
+
+/**
+ * @brief Close port
+ *
+ * @param handle Port handle
+ */
+void UnixOsPort::close_port(handle_type handle)
+{
+  auto port = (UnixPortHandle *)handle;
+  if (port) {
+    ::close(port->fd);
+    delete port;
+  }
+}
+
+void UnixOsPort::set_baud_rate(int fd, int baud_rate)
+{
+  static const struct {
+    int baud_rate;
+    speed_t speed;
+  } speeds[] = {
+    { 50, B50 }, { 75, B75 }, { 110, B110 }, { 134, B134 }, { 150, B150 },
+    { 200, B200 }, { 300, B300 }, { 600, B600 }, { 1200, B1200 },
+    { 1800, B1800 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+    { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 },
+  };
+
+  for (const auto& entry : speeds) {
+    if (entry.baud_rate == baud_rate) {
+      struct termios tio;
+      if ((tcgetattr(fd, &tio) != 0) ||
+          (cfsetispeed(&tio, entry.speed) != 0) ||
+          (cfsetospeed(&tio, entry.speed) != 0) ||
+          (tcsetattr(fd, TCSANOW, &tio) != 0)) {
+        throw std::runtime_error("cannot set baud rate: " + get_error_string());
+      }
+      return;
+    }
+  }
+  throw std::invalid_argument("unsupported baud rate: " + std::to_string(baud_rate));
+}
+
+int UnixOsPort::get_baud_rate(int fd)
+{
+  static const struct {
+    speed_t speed;
+    int baud_rate;
+  } speeds[] = {
+    { B50, 50 }, { B75, 75 }, { B110, 110 }, { B134, 134 }, { B150, 150 },
+    { B200, 200 }, { B300, 300 }, { B600, 600 }, { B1200, 1200 },
+    { B1800, 1800 }, { B2400, 2400 }, { B4800, 4800 }, { B9600, 9600 },
+    { B19200, 19200 }, { B38400, 38400 }, { B57600, 57600 },
+    { B115200, 115200 }, { B230400, 230400 },
+  };
+
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    throw std::runtime_error("cannot get baud rate: " + get_error_string());
+  }
+  auto speed = cfgetospeed(&tio);
+  for (const auto& entry : speeds) {
+    if (entry.speed == speed) {
+      return entry.baud_rate;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Create pseudo ports for testing
+ *
+ * Each port is a pty whose master side echoes back every byte written
+ * to the slave side. The slave side appears in enumerate().
+ *
+ * @param count Number of ports to create
+ */
+void UnixOsPort::create_pseudo_ports(int count)
+{
+  if (loopback_thread.joinable()) {
+    throw std::logic_error("pseudo ports are already created");
+  }
+
+  for (int index = 0; index < count; ++index) {
+    PseudoPort pty;
+    if (openpty(&pty.master_fd, &pty.slave_fd, nullptr, nullptr, nullptr) != 0) {
+      throw std::runtime_error("cannot create pseudo terminal: " + get_error_string());
+    }
+    loopbacks.push_back(pty);
+    fcntl(pty.master_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(pty.slave_fd, F_SETFD, FD_CLOEXEC);
+    set_nonblocking(pty.master_fd);
+
+    struct termios tio;
+    if (tcgetattr(pty.slave_fd, &tio) == 0) {
+      cfmakeraw(&tio);
+      tcsetattr(pty.slave_fd, TCSANOW, &tio);
+    }
+
+    char name[256];
+    if (ttyname_r(pty.slave_fd, name, sizeof(name)) != 0) {
+      throw std::runtime_error("cannot get pseudo terminal name: " + get_error_string());
+    }
+    pseudo_ports.emplace_back(name, "Pseudo terminal (loopback)");
+  }
+
+  if (::pipe(loopback_pipe) != 0) {
+    throw std::runtime_error("cannot create pipe: " + get_error_string());
+  }
+  loopback_thread = std::thread([this]{ run_loopback(); });
+}
+
+void UnixOsPort::run_loopback()
+{
+  std::vector<struct pollfd> pfds(loopbacks.size() + 1);
+  char buffer[4096];
+
+  for (;;) {
+    for (std::size_t index = 0; index < loopbacks.size(); ++index) {
+      pfds[index].fd = loopbacks[index].master_fd;
+      pfds[index].events = loopbacks[index].pending.empty() ? POLLIN : POLLOUT;
+    }
+    pfds.back().fd = loopback_pipe[0];
+    pfds.back().events = POLLIN;
+
+    if (::poll(pfds.data(), pfds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if (pfds.back().revents) {
+      return;
+    }
+
+    for (std::size_t index = 0; index < loopbacks.size(); ++index) {
+      auto& pty = loopbacks[index];
+      if (!pfds[index].revents) {
+        continue;
+      }
+      if (pty.pending.empty()) {
+        int len = ::read(pty.master_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+          continue;
+        }
+        pty.pending.assign(buffer, len);
+      }
+      int len = ::write(pty.master_fd, pty.pending.data(), pty.pending.size());
+      if (len > 0) {
+        pty.pending.erase(0, len);
+      }
+    }
+  }
+}
@@ -0,0 +1,112 @@
+#ifndef _OSPORT_UNIX_HPP_
+#define _OSPORT_UNIX_HPP_
+
+#include "socket.hpp"
+#include "osport.hpp"
+#include <vector>
+#include <thread>
+
+/**
+ * @brief Socket implementation for POSIX systems
+ *
+ * The descriptor is always in non-blocking mode.
+ */
+class UnixSocket : public Socket
+{
+public:
+  UnixSocket(int domain, int type, int protocol);
+  UnixSocket(int fd);
+  virtual ~UnixSocket();
+
+  virtual void set_reuse_port() override;
+  virtual void bind(const std::string& address, int port) override;
+  virtual void get_address(std::string& address, int& port) override;
+  virtual void listen() override;
+  virtual Socket::shared_ptr accept() override;
+  virtual void close() override;
+  virtual std::string error_string() override;
+  virtual bool would_block() override;
+  virtual int recv_bytes(void *buffer, int length) override;
+  virtual int send_bytes(const void *buffer, int length, bool more) override;
+
+  /**
+   * @brief Get file descriptor
+   */
+  int get_fd() const
+  {
+    return fd;
+  }
+
+private:
+  int fd;
+};
+
+/**
+ * @brief Port handle for POSIX systems
+ */
+struct UnixPortHandle
+{
+  int fd;                     ///< File descriptor of tty device
+  int serial_flags;           ///< Flags of serial_struct to restore on close (-1 if unchanged; Linux)
+};
+
+/**
+ * @brief OsPort implementation for POSIX systems
+ */
+class UnixOsPort : public OsPort
+{
+protected:
+  UnixOsPort();
+
+  static std::string get_error_string();
+
+  /**
+   * @brief Set baud rate
+   *
+   * @param fd File descriptor of tty device
+   * @param baud_rate Baud rate in bps
+   */
+  virtual void set_baud_rate(int fd, int baud_rate);
+
+  /**
+   * @brief Get baud rate
+   *
+   * @param fd File descriptor of tty device
+   * @return Baud rate in bps
+   */
+  virtual int get_baud_rate(int fd);
+
+  std::vector<SerialPortInfo> pseudo_ports;
+
+public:
+  virtual ~UnixOsPort();
+
+  virtual int getopt(int argc, char *argv[], const char *options, char*& optarg, int& optind) override;
+  virtual int getpid() override;
+  virtual Socket::shared_ptr create_socket_tcp() override;
+  virtual handle_type open_port(const char* path) override;
+  virtual void configure_port(handle_type handle, const SerialPortConfig& set, SerialPortConfig& get) override;
+  virtual int read_port(handle_type handle, void* buffer, int length) override;
+  virtual int write_port(handle_type handle, const void* buffer, int length) override;
+  virtual int get_output_size(handle_type handle) override;
+  virtual int get_modem_lines(handle_type handle) override;
+  virtual void set_modem_lines(handle_type handle, int mask, int lines) override;
+  virtual ModemWatcher::unique_ptr watch_modem_lines(handle_type handle, const Poller::shared_ptr& poller) override;
+  virtual void close_port(handle_type handle) override;
+  virtual void create_pseudo_ports(int count) override;
+
+private:
+  void run_loopback();
+
+  struct PseudoPort
+  {
+    int master_fd;            ///< Master side (loopback end)
+    int slave_fd;             ///< Slave side (kept open to avoid hangup)
+    std::string pending;      ///< Bytes not yet echoed back
+  };
+  std::vector<PseudoPort> loopbacks;
+  std::thread loopback_thread;
+  int loopback_pipe[2];
+};
+
+#endif /* _OSPORT_UNIX_HPP_ */
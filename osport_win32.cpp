@@ -1,12 +1,19 @@
 #include "socket.hpp"
 #include "osport.hpp"
+#include "ring.hpp"
 #include <stdexcept>
 #include <string>
 #include <cassert>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
 
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #include "winsock2.h"
 #include "setupapi.h"
+#include "cfgmgr32.h"
 #include "windows.h"
 
 static std::string MultiByteToUtf8(const std::string& src)
@@ -29,6 +36,15 @@ static std::string MultiByteToUtf8(const std::string& src)
   return buf8;
 }
 
+void *map_mirrored_memory(std::size_t size, const char *path)
+{
+  return nullptr;
+}
+
+void unmap_mirrored_memory(void *address, std::size_t size)
+{
+}
+
 class Win32Socket : public Socket
 {
 public:
@@ -51,11 +67,13 @@ public:
     if (socket < 0) {
       throw std::runtime_error("cannot create socket: " + error_string());
     }
+    set_nonblocking();
   }
 
   Win32Socket(SOCKET socket) : socket(socket)
   {
     assert(socket >= 0);
+    set_nonblocking();
   }
 
   virtual ~Win32Socket()
@@ -63,6 +81,11 @@ public:
     close();
   }
 
+  virtual void set_reuse_port() override
+  {
+    throw std::runtime_error("SO_REUSEPORT is not supported on Windows");
+  }
+
   virtual void bind(const std::string& address, int port) override
   {
     assert(socket >= 0);
@@ -104,7 +127,10 @@ public:
     assert(socket >= 0);
     
     SOCKET client = ::accept(socket, nullptr, nullptr);
-    if (client < 0) {
+    if (client == INVALID_SOCKET) {
+      if (would_block()) {
+        return nullptr;
+      }
       throw std::runtime_error("cannot accept socket: " + error_string());
     }
     return Socket::shared_ptr(new Win32Socket(client));
@@ -118,6 +144,16 @@ public:
     }
   }
 
+  virtual bool would_block() override
+  {
+    return (WSAGetLastError() == WSAEWOULDBLOCK);
+  }
+
+  SOCKET get_socket() const
+  {
+    return socket;
+  }
+
 protected:
 
   virtual int recv_bytes(void *buffer, int length) override
@@ -127,10 +163,11 @@ protected:
     return ::recv(socket, (char *)buffer, length, 0);
   }
 
-  virtual int send_bytes(const void *buffer, int length) override
+  virtual int send_bytes(const void *buffer, int length, bool more) override
   {
     assert(socket >= 0);
 
+    (void)more;
     return ::send(socket, (const char *)buffer, length, 0);
   }
 
@@ -145,9 +182,180 @@ private:
     return std::to_string(WSAGetLastError());
   }
 
+  void set_nonblocking()
+  {
+    u_long mode = 1;
+    if (ioctlsocket(socket, FIONBIO, &mode) != 0) {
+      throw std::runtime_error("cannot set non-blocking mode: " + error_string());
+    }
+  }
+
   SOCKET socket;
 };
 
+/**
+ * @brief Poller implementation based on WSAPoll
+ *
+ * Serial ports cannot be waited by WSAPoll. While any port is watched,
+ * the wait is limited to port_interval and the ports are reported as
+ * ready on every wait, so that their handlers can poll them.
+ */
+class Win32Poller : public Poller
+{
+public:
+  Win32Poller()
+  {
+    // Self-connected UDP socket to interrupt WSAPoll
+    struct sockaddr_in saddr = { 0 };
+    int saddrlen = sizeof(saddr);
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    u_long mode = 1;
+    waker = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if ((waker == INVALID_SOCKET) ||
+        (::bind(waker, (const struct sockaddr *)&saddr, sizeof(saddr)) != 0) ||
+        (getsockname(waker, (struct sockaddr *)&saddr, &saddrlen) != 0) ||
+        (::connect(waker, (const struct sockaddr *)&saddr, sizeof(saddr)) != 0) ||
+        (ioctlsocket(waker, FIONBIO, &mode) != 0)) {
+      throw std::runtime_error("cannot create wakeup socket: " + std::to_string(WSAGetLastError()));
+    }
+  }
+
+  virtual ~Win32Poller()
+  {
+    closesocket(waker);
+  }
+
+  virtual void add_socket(Socket& socket, int events, const handler_type& handler) override
+  {
+    sockets.push_back(Entry<SOCKET>{static_cast<Win32Socket&>(socket).get_socket(), events,
+      std::make_shared<handler_type>(handler)});
+  }
+
+  virtual void modify_socket(Socket& socket, int events) override
+  {
+    find(sockets, static_cast<Win32Socket&>(socket).get_socket())->events = events;
+  }
+
+  virtual void remove_socket(Socket& socket) override
+  {
+    sockets.erase(find(sockets, static_cast<Win32Socket&>(socket).get_socket()));
+  }
+
+  virtual void add_port(void* handle, int events, const handler_type& handler) override
+  {
+    ports.push_back(Entry<void*>{handle, events, std::make_shared<handler_type>(handler)});
+  }
+
+  virtual void modify_port(void* handle, int events) override
+  {
+    find(ports, handle)->events = events;
+  }
+
+  virtual void remove_port(void* handle) override
+  {
+    ports.erase(find(ports, handle));
+  }
+
+  virtual void wait(int timeout) override
+  {
+    if (!ports.empty() && ((timeout < 0) || (timeout > port_interval))) {
+      timeout = port_interval;
+    }
+
+    std::vector<WSAPOLLFD> fds;
+    WSAPOLLFD wakefd = { 0 };
+    wakefd.fd = waker;
+    wakefd.events = POLLRDNORM;
+    fds.push_back(wakefd);
+    for (const auto& entry : sockets) {
+      WSAPOLLFD fd = { 0 };
+      fd.fd = entry.key;
+      fd.events = ((entry.events & POLL_IN) ? POLLRDNORM : 0) | ((entry.events & POLL_OUT) ? POLLWRNORM : 0);
+      fds.push_back(fd);
+    }
+
+    std::vector<std::pair<SOCKET, int>> ready_sockets;
+    if (WSAPoll(fds.data(), (ULONG)fds.size(), timeout) > 0) {
+      if (fds.front().revents) {
+        char buffer[16];
+        while (::recv(waker, buffer, sizeof(buffer), 0) > 0);
+      }
+      for (const auto& fd : fds) {
+        if (fd.fd == waker) {
+          continue;
+        }
+        int mask = 0;
+        if (fd.revents & POLLRDNORM) {
+          mask |= POLL_IN;
+        }
+        if (fd.revents & POLLWRNORM) {
+          mask |= POLL_OUT;
+        }
+        if (fd.revents & (POLLERR | POLLHUP)) {
+          mask |= POLL_ERROR;
+        }
+        if (mask) {
+          ready_sockets.emplace_back(fd.fd, mask);
+        }
+      }
+    }
+    std::vector<std::pair<void*, int>> ready_ports;
+    for (const auto& entry : ports) {
+      if (entry.events) {
+        ready_ports.emplace_back(entry.key, entry.events);
+      }
+    }
+
+    // Handler may be removed by another handler in these loops
+    dispatch(sockets, ready_sockets);
+    dispatch(ports, ready_ports);
+  }
+
+  virtual void wakeup() override
+  {
+    char ch = 0;
+    ::send(waker, &ch, 1, 0);
+  }
+
+private:
+  static const int port_interval = 10;
+
+  template <typename T>
+  struct Entry
+  {
+    T key;
+    int events;
+    std::shared_ptr<handler_type> handler;
+  };
+
+  template <typename T>
+  static typename std::vector<Entry<T>>::iterator find(std::vector<Entry<T>>& list, T key)
+  {
+    auto iter = std::find_if(list.begin(), list.end(), [key](const Entry<T>& e){ return e.key == key; });
+    if (iter == list.end()) {
+      throw std::logic_error("not watched by poller");
+    }
+    return iter;
+  }
+
+  template <typename T>
+  static void dispatch(std::vector<Entry<T>>& list, const std::vector<std::pair<T, int>>& ready)
+  {
+    for (const auto& item : ready) {
+      auto iter = std::find_if(list.begin(), list.end(), [&item](const Entry<T>& e){ return e.key == item.first; });
+      if (iter != list.end()) {
+        auto handler = iter->handler;
+        (*handler)(item.second);
+      }
+    }
+  }
+
+  SOCKET waker;
+  std::vector<Entry<SOCKET>> sockets;
+  std::vector<Entry<void*>> ports;
+};
+
 class Win32RegKey
 {
 public:
@@ -186,6 +394,83 @@ protected:
   HKEY hKey;
 };
 
+/**
+ * @brief Watcher of modem input lines for Windows
+ *
+ * The thread waits for changes by WaitCommEvent() on an overlapped
+ * handle, and a stop event ends the wait.
+ */
+class Win32ModemWatcher : public ModemWatcher
+{
+public:
+  Win32ModemWatcher(HANDLE hCom, const Poller::shared_ptr& poller)
+  : ModemWatcher(poller), hCom(hCom), hStop(CreateEvent(nullptr, TRUE, FALSE, nullptr))
+  {
+    thread = std::thread([this]{ run(); });
+  }
+
+  virtual ~Win32ModemWatcher()
+  {
+    SetEvent(hStop);
+    thread.join();
+    CloseHandle(hStop);
+  }
+
+  static int from_status(DWORD status)
+  {
+    return ((status & MS_CTS_ON) ? MODEM_CTS : 0) |
+           ((status & MS_DSR_ON) ? MODEM_DSR : 0) |
+           ((status & MS_RLSD_ON) ? MODEM_DCD : 0) |
+           ((status & MS_RING_ON) ? MODEM_RI : 0);
+  }
+
+private:
+  void run()
+  {
+    DWORD status;
+    if (!SetCommMask(hCom, EV_CTS | EV_DSR | EV_RLSD | EV_RING) ||
+        !GetCommModemStatus(hCom, &status)) {
+      return;
+    }
+    int lines = from_status(status);
+    OVERLAPPED ov = { 0 };
+    ov.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    for (;;) {
+      DWORD mask = 0;
+      DWORD len;
+      ResetEvent(ov.hEvent);
+      BOOL ok = WaitCommEvent(hCom, &mask, &ov);
+      if (!ok && (GetLastError() == ERROR_IO_PENDING)) {
+        HANDLE handles[] = { ov.hEvent, hStop };
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+          // Clearing the mask completes the pending wait
+          SetCommMask(hCom, 0);
+          GetOverlappedResult(hCom, &ov, &len, TRUE);
+          break;
+        }
+        ok = GetOverlappedResult(hCom, &ov, &len, FALSE);
+      }
+      const auto time = now();
+      if (!ok || !GetCommModemStatus(hCom, &status)) {
+        break;
+      }
+      const int current = from_status(status);
+      const int changed = (current ^ lines) |
+        ((mask & EV_CTS) ? MODEM_CTS : 0) | ((mask & EV_DSR) ? MODEM_DSR : 0) |
+        ((mask & EV_RLSD) ? MODEM_DCD : 0) | ((mask & EV_RING) ? MODEM_RI : 0);
+      lines = current;
+      if (changed) {
+        post(ModemEvent{time, lines, changed});
+      }
+    }
+    CloseHandle(ov.hEvent);
+  }
+
+  HANDLE hCom;
+  HANDLE hStop;
+  std::thread thread;
+};
+
 class Win32OsPort : public OsPort
 {
 protected:
@@ -205,6 +490,57 @@ protected:
     return result;
   }
 
+  /**
+   * @brief Get a string property of a device
+   *
+   * @param hDevInfoSet Device information set
+   * @param did Device information
+   * @param property SPDRP_* (REG_SZ, or REG_MULTI_SZ whose first string is taken)
+   * @param value A reference to store the value
+   * @return true if succeeded
+   */
+  static bool get_device_property(HDEVINFO hDevInfoSet, PSP_DEVINFO_DATA did, DWORD property, std::string& value)
+  {
+    DWORD dataType;
+    DWORD length;
+    if (!SetupDiGetDeviceRegistryPropertyA(hDevInfoSet, did, property,
+        &dataType, nullptr, 0, &length)) {
+      if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+        return false;
+      }
+    }
+    std::string buffer(length, '\0');
+    if (!SetupDiGetDeviceRegistryPropertyA(hDevInfoSet, did, property,
+        &dataType, (PBYTE)&buffer[0], length, &length)) {
+      return false;
+    }
+    if ((dataType != REG_SZ) && (dataType != REG_MULTI_SZ)) {
+      return false;
+    }
+    value.assign(buffer.c_str());
+    return true;
+  }
+
+  int transfer(handle_type handle, void* buffer, int length, bool write)
+  {
+    HANDLE hCom = (HANDLE)handle;
+    OVERLAPPED ov = { 0 };
+    DWORD len = 0;
+    ov.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    BOOL ok = write ?
+      WriteFile(hCom, buffer, length, &len, &ov) :
+      ReadFile(hCom, buffer, length, &len, &ov);
+    if (!ok && (GetLastError() == ERROR_IO_PENDING)) {
+      ok = GetOverlappedResult(hCom, &ov, &len, TRUE);
+    }
+    CloseHandle(ov.hEvent);
+    if (!ok) {
+      throw std::runtime_error(std::string(write ? "cannot write port: " : "cannot read port: ") +
+        get_error_string());
+    }
+    return (int)len;
+  }
+
 public:
   Win32OsPort()
   {
@@ -276,6 +612,11 @@ public:
     return Socket::shared_ptr(new Win32Socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
   }
 
+  virtual Poller::shared_ptr create_poller() override
+  {
+    return Poller::shared_ptr(new Win32Poller());
+  }
+
   virtual std::vector<SerialPortInfo> enumerate() override
   {
     std::vector<SerialPortInfo> list;
@@ -313,29 +654,38 @@ public:
       }
 
       std::string desc;
-      do {
-        // Get port description
-        DWORD dataType;
-        DWORD length;
-        if (!SetupDiGetDeviceRegistryPropertyA(hDevInfoSet, &did, SPDRP_DEVICEDESC,
-            &dataType, nullptr, 0, &length)) {
-          if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
-            break;
-          }
+      if (get_device_property(hDevInfoSet, &did, SPDRP_DEVICEDESC, desc)) {
+        desc = MultiByteToUtf8(desc);
+      }
+      list.emplace_back(name, desc);
+      auto& info = list.back();
+      info.order = order;
+
+      // Hardware IDs are like "USB\VID_0403&PID_6001&REV_0600"
+      std::string ids;
+      if (get_device_property(hDevInfoSet, &did, SPDRP_HARDWAREID, ids)) {
+        const auto vid = ids.find("VID_");
+        const auto pid = ids.find("PID_");
+        if (vid != std::string::npos) {
+          info.vendor_id = (int)std::strtol(ids.substr(vid + 4, 4).c_str(), nullptr, 16);
         }
-        desc.resize(length);
-        if (!SetupDiGetDeviceRegistryPropertyA(hDevInfoSet, &did, SPDRP_DEVICEDESC,
-            &dataType, (PBYTE)&desc[0], length, &length)) {
-          break;
+        if (pid != std::string::npos) {
+          info.product_id = (int)std::strtol(ids.substr(pid + 4, 4).c_str(), nullptr, 16);
         }
-        if (dataType != REG_SZ) {
-          break;
+      }
+      // Instance ID of USB device ends with its serial number, or with
+      // an ID generated by Windows (containing '&') if it has none
+      char instance[MAX_DEVICE_ID_LEN];
+      if (SetupDiGetDeviceInstanceIdA(hDevInfoSet, &did, instance, sizeof(instance), nullptr)) {
+        const std::string id(instance);
+        const auto pos = id.rfind('\\');
+        if ((id.compare(0, 4, "USB\\") == 0) && (pos != std::string::npos) &&
+            (id.find('&', pos) == std::string::npos)) {
+          info.serial_number = id.substr(pos + 1);
         }
-        desc.resize(length - 1);
-        desc = MultiByteToUtf8(desc);
-      } while (0);
-      list.emplace_back(name, desc);
-      list.back().order = order;
+      }
+      get_device_property(hDevInfoSet, &did, SPDRP_LOCATION_INFORMATION, info.location);
+      get_device_property(hDevInfoSet, &did, SPDRP_SERVICE, info.driver);
     }
 
     return list;
@@ -362,8 +712,18 @@ public:
       nullptr
     );
     if (hCom == INVALID_HANDLE_VALUE) {
-      // TODO: exceptions
-      return nullptr;
+      throw std::runtime_error("cannot open port: " + get_error_string());
+    }
+
+    // Make ReadFile return immediately with available bytes,
+    // and WriteFile return shortly with bytes accepted by driver
+    COMMTIMEOUTS timeouts = { 0 };
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.WriteTotalTimeoutConstant = 1;
+    if (!SetCommTimeouts(hCom, &timeouts)) {
+      auto message = get_error_string();
+      CloseHandle(hCom);
+      throw std::runtime_error("cannot set timeouts: " + message);
     }
 
     return (handle_type)hCom;
@@ -385,7 +745,8 @@ public:
     if (!GetCommState(hCom, &dcb)) {
       throw std::runtime_error("cannot get old state: " + get_error_string());
     }
-    
+    const DCB old_dcb = dcb;
+
     // Change state
     if (set.field_mask & SerialPortConfig::SP_FIELD_BAUD_RATE) {
       dcb.BaudRate = set.baud_rate;
@@ -454,12 +815,14 @@ public:
       dcb.ErrorChar = set.error_char;
     }
 
-    if (!SetCommState(hCom, &dcb)) {
-      throw std::runtime_error("cannot set state: " + get_error_string());
-    }
-
-    if (!GetCommState(hCom, &dcb)) {
-      throw std::runtime_error("cannot get new state: " + get_error_string());
+    // SetCommState() may reset the UART and flush FIFOs, so call it only for changes
+    if (std::memcmp(&dcb, &old_dcb, sizeof(dcb)) != 0) {
+      if (!SetCommState(hCom, &dcb)) {
+        throw std::runtime_error("cannot set state: " + get_error_string());
+      }
+      if (!GetCommState(hCom, &dcb)) {
+        throw std::runtime_error("cannot get new state: " + get_error_string());
+      }
     }
 
     get.baud_rate = dcb.BaudRate;
@@ -516,6 +879,54 @@ public:
     get.error_char = dcb.ErrorChar;
   }
 
+  virtual int get_modem_lines(handle_type handle) override
+  {
+    HANDLE hCom = (HANDLE)handle;
+    DWORD status;
+    DCB dcb;
+    dcb.DCBlength = sizeof(dcb);
+    if (!GetCommModemStatus(hCom, &status) || !GetCommState(hCom, &dcb)) {
+      throw std::runtime_error("cannot get modem lines: " + get_error_string());
+    }
+    // Output lines are known from the state which set_modem_lines() has set
+    return Win32ModemWatcher::from_status(status) |
+      ((dcb.fDtrControl != DTR_CONTROL_DISABLE) ? MODEM_DTR : 0) |
+      ((dcb.fRtsControl != RTS_CONTROL_DISABLE) ? MODEM_RTS : 0);
+  }
+
+  virtual void set_modem_lines(handle_type handle, int mask, int lines) override
+  {
+    HANDLE hCom = (HANDLE)handle;
+    if (mask & (MODEM_DTR | MODEM_RTS)) {
+      DCB dcb;
+      dcb.DCBlength = sizeof(dcb);
+      if (!GetCommState(hCom, &dcb)) {
+        throw std::runtime_error("cannot get old state: " + get_error_string());
+      }
+      if (((mask & MODEM_DTR) && (dcb.fDtrControl == DTR_CONTROL_HANDSHAKE)) ||
+          ((mask & MODEM_RTS) && (dcb.fRtsControl == RTS_CONTROL_HANDSHAKE))) {
+        throw std::invalid_argument("cannot set modem lines used by flow control");
+      }
+      if (mask & MODEM_DTR) {
+        dcb.fDtrControl = (lines & MODEM_DTR) ? DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
+      }
+      if (mask & MODEM_RTS) {
+        dcb.fRtsControl = (lines & MODEM_RTS) ? RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
+      }
+      if (!SetCommState(hCom, &dcb)) {
+        throw std::runtime_error("cannot set modem lines: " + get_error_string());
+      }
+    }
+    if ((mask & MODEM_BREAK) && !EscapeCommFunction(hCom, (lines & MODEM_BREAK) ? SETBREAK : CLRBREAK)) {
+      throw std::runtime_error("cannot set break: " + get_error_string());
+    }
+  }
+
+  virtual ModemWatcher::unique_ptr watch_modem_lines(handle_type handle, const Poller::shared_ptr& poller) override
+  {
+    return ModemWatcher::unique_ptr(new Win32ModemWatcher((HANDLE)handle, poller));
+  }
+
   /**
    * @brief Close port
    * 
@@ -523,7 +934,59 @@ public:
    */
   virtual void close_port(handle_type handle) override
   {
+    CloseHandle((HANDLE)handle);
+  }
+
+  /**
+   * @brief Read bytes from port without blocking
+   *
+   * @param handle Port handle
+   * @param buffer Buffer to store bytes
+   * @param length Size of buffer
+   * @return Number of bytes read (0 if no bytes are available)
+   */
+  virtual int read_port(handle_type handle, void* buffer, int length) override
+  {
+    return transfer(handle, buffer, length, false);
+  }
+
+  /**
+   * @brief Write bytes to port without blocking
+   *
+   * @param handle Port handle
+   * @param buffer Bytes to write
+   * @param length Number of bytes to write
+   * @return Number of bytes written (0 if port is not writable now)
+   */
+  virtual int write_port(handle_type handle, const void* buffer, int length) override
+  {
+    return transfer(handle, const_cast<void*>(buffer), length, true);
+  }
+
+  /**
+   * @brief Get number of bytes written but not yet transmitted
+   *
+   * @param handle Port handle
+   * @return Number of bytes in the output queue of the driver
+   */
+  virtual int get_output_size(handle_type handle) override
+  {
+    DWORD errors;
+    COMSTAT stat;
+    if (!ClearCommError((HANDLE)handle, &errors, &stat)) {
+      throw std::runtime_error("cannot get output queue: " + get_error_string());
+    }
+    return (int)stat.cbOutQue;
+  }
 
+  /**
+   * @brief Create pseudo ports for testing
+   *
+   * @param count Number of ports to create
+   */
+  virtual void create_pseudo_ports(int count) override
+  {
+    throw std::runtime_error("pseudo ports are not supported on Windows");
   }
 
 };
@@ -0,0 +1,111 @@
+#ifndef _POLLER_HPP_
+#define _POLLER_HPP_
+
+#include "socket.hpp"
+#include <functional>
+#include <memory>
+
+/**
+ * @brief An abstract class to wait I/O readiness of sockets and ports
+ *
+ * Handlers are called from wait() in the thread which calls wait().
+ * Readiness is level-triggered; a handler is called again while the
+ * condition remains. Except for wakeup(), a poller must be used only
+ * from one thread.
+ */
+class Poller
+{
+protected:
+  /**
+   * @brief Construct a new Poller object.
+   */
+  Poller() = default;
+
+public:
+  /**
+   * @brief Type alias definition for shared pointer to this class
+   */
+  using shared_ptr = std::shared_ptr<Poller>;
+
+  /**
+   * @brief Type alias definition for event handler
+   */
+  using handler_type = std::function<void(int events)>;
+
+  /**
+   * @brief Event bits
+   */
+  enum EventMask
+  {
+    POLL_IN     = (1<<0),     ///< Readable (or acceptable)
+    POLL_OUT    = (1<<1),     ///< Writable
+    POLL_ERROR  = (1<<2),     ///< Error or hang-up (always reported)
+  };
+
+  /**
+   * @brief Destroy the Poller object.
+   */
+  virtual ~Poller() = default;
+
+  /**
+   * @brief Start watching a socket
+   *
+   * @param socket Socket to watch
+   * @param events Combination of POLL_IN and POLL_OUT
+   * @param handler Handler to be called when ready
+   */
+  virtual void add_socket(Socket& socket, int events, const handler_type& handler) = 0;
+
+  /**
+   * @brief Change events to watch for a socket
+   *
+   * @param socket Socket to watch
+   * @param events Combination of POLL_IN and POLL_OUT
+   */
+  virtual void modify_socket(Socket& socket, int events) = 0;
+
+  /**
+   * @brief Stop watching a socket
+   *
+   * @param socket Socket to unwatch
+   */
+  virtual void remove_socket(Socket& socket) = 0;
+
+  /**
+   * @brief Start watching a port
+   *
+   * @param handle Port handle returned by OsPort::open_port()
+   * @param events Combination of POLL_IN and POLL_OUT
+   * @param handler Handler to be called when ready
+   */
+  virtual void add_port(void* handle, int events, const handler_type& handler) = 0;
+
+  /**
+   * @brief Change events to watch for a port
+   *
+   * @param handle Port handle
+   * @param events Combination of POLL_IN and POLL_OUT
+   */
+  virtual void modify_port(void* handle, int events) = 0;
+
+  /**
+   * @brief Stop watching a port
+   *
+   * @param handle Port handle
+   */
+  virtual void remove_port(void* handle) = 0;
+
+  /**
+   * @brief Wait for events and call handlers
+   *
+   * @param timeout Timeout in milliseconds (-1 for infinite)
+   */
+  virtual void wait(int timeout) = 0;
+
+  /**
+   * @brief Make wait() return immediately (thread-safe)
+   */
+  virtual void wakeup() = 0;
+};
+
+#endif /* _POLLER_HPP_ */
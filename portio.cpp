@@ -0,0 +1,159 @@
+#include "portio.hpp"
+#include "osport.hpp"
+#include <stdexcept>
+
+/**
+ * @brief Create an engine to transfer bytes of ports asynchronously
+ *
+ * The default implementation is based on readiness of ports.
+ *
+ * @param poller Poller to dispatch completions
+ * @return A shared pointer to PortIo object
+ */
+PortIo::shared_ptr OsPort::create_port_io(const Poller::shared_ptr& poller)
+{
+  return PortIo::shared_ptr(new ReadinessPortIo(*this, poller));
+}
+
+ReadinessPortIo::ReadinessPortIo(OsPort& os, const Poller::shared_ptr& poller)
+: os(os), poller(poller), last_request(0)
+{
+}
+
+ReadinessPortIo::~ReadinessPortIo()
+{
+  for (const auto& item : entries) {
+    poller->remove_port(item.first);
+  }
+}
+
+PortIo::request_type ReadinessPortIo::submit_read(void* handle, void* buffer, int length, const handler_type& handler)
+{
+  auto& request = get_entry(handle).read;
+  if (request.id) {
+    throw std::logic_error("port is already being read");
+  }
+  request.id = ++last_request;
+  request.buffer = (char *)buffer;
+  request.length = length;
+  request.handler = handler;
+  requests[request.id] = handle;
+  update_events(handle);
+  return request.id;
+}
+
+PortIo::request_type ReadinessPortIo::submit_write(void* handle, const void* data, int length, const handler_type& handler)
+{
+  auto& request = get_entry(handle).write;
+  if (request.id) {
+    throw std::logic_error("port is already being written");
+  }
+  request.id = ++last_request;
+  request.buffer = (char *)data;
+  request.length = length;
+  request.handler = handler;
+  requests[request.id] = handle;
+  update_events(handle);
+  return request.id;
+}
+
+void ReadinessPortIo::cancel(request_type request)
+{
+  auto iter = requests.find(request);
+  if (iter == requests.end()) {
+    return;
+  }
+  void* handle = iter->second;
+  requests.erase(iter);
+  auto& entry = entries.at(handle);
+  for (auto r : { &entry.read, &entry.write }) {
+    if (r->id == request) {
+      r->id = 0;
+      r->handler = nullptr;
+    }
+  }
+  update_events(handle);
+}
+
+void ReadinessPortIo::release(void* handle)
+{
+  auto iter = entries.find(handle);
+  if (iter == entries.end()) {
+    return;
+  }
+  requests.erase(iter->second.read.id);
+  requests.erase(iter->second.write.id);
+  poller->remove_port(handle);
+  entries.erase(iter);
+}
+
+void ReadinessPortIo::flush()
+{
+  // Requests are carried out when ports become ready
+}
+
+ReadinessPortIo::Entry& ReadinessPortIo::get_entry(void* handle)
+{
+  auto iter = entries.find(handle);
+  if (iter != entries.end()) {
+    return iter->second;
+  }
+  poller->add_port(handle, 0, [this, handle](int events){
+    handle_ready(handle, events);
+  });
+  auto& entry = entries[handle];
+  entry.read.id = 0;
+  entry.write.id = 0;
+  entry.events = 0;
+  return entry;
+}
+
+void ReadinessPortIo::handle_ready(void* handle, int events)
+{
+  const bool read = (events & (Poller::POLL_IN | Poller::POLL_ERROR));
+  const bool write = (events & (Poller::POLL_OUT | Poller::POLL_ERROR));
+  for (int pass = 0; pass < 2; ++pass) {
+    // Handlers may submit, cancel or release requests of this port
+    auto iter = entries.find(handle);
+    if (iter == entries.end()) {
+      return;
+    }
+    auto& request = pass ? iter->second.write : iter->second.read;
+    if (!request.id || !(pass ? write : read)) {
+      continue;
+    }
+    Completion completion = { 0, nullptr, std::string() };
+    try {
+      if (pass) {
+        completion.length = os.write_port(handle, request.buffer, request.length);
+      } else {
+        completion.length = os.read_port(handle, request.buffer, request.length);
+      }
+    } catch (const std::exception& e) {
+      completion.length = -1;
+      completion.error = e.what();
+    }
+    if (completion.length == 0) {
+      continue;
+    }
+    const auto handler = std::move(request.handler);
+    requests.erase(request.id);
+    request.id = 0;
+    request.handler = nullptr;
+    completion.data = request.buffer;
+    handler(completion);
+  }
+  if (entries.count(handle)) {
+    update_events(handle);
+  }
+}
+
+void ReadinessPortIo::update_events(void* handle)
+{
+  auto& entry = entries.at(handle);
+  const int events = (entry.read.id ? Poller::POLL_IN : 0) | (entry.write.id ? Poller::POLL_OUT : 0);
+  if (events != entry.events) {
+    poller->modify_port(handle, events);
+    entry.events = events;
+  }
+}
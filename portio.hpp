@@ -0,0 +1,160 @@
+#ifndef _PORTIO_HPP_
+#define _PORTIO_HPP_
+
+#include "poller.hpp"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+class OsPort;
+
+/**
+ * @brief An abstract class to transfer bytes of ports asynchronously
+ *
+ * A read or write request is submitted with a completion handler, which
+ * is called later from Poller::wait() of the poller given on creation.
+ * Requests submitted during one turn of the event loop are passed to the
+ * OS together by flush(). At most one read and one write may be in
+ * flight per port.
+ *
+ * Bytes are transferred directly from and to the caller's buffers, which
+ * are pinned until the request completes: they must stay valid, and the
+ * space being read into must not be used, until the handler is called.
+ * A canceled request never calls its handler, but the engine keeps the
+ * handler until the OS has released the buffer, so the caller binds the
+ * owner of the buffer to the handler to keep it alive.
+ */
+class PortIo
+{
+protected:
+  /**
+   * @brief Construct a new PortIo object.
+   */
+  PortIo() = default;
+
+public:
+  /**
+   * @brief Type alias definition for shared pointer to this class
+   */
+  using shared_ptr = std::shared_ptr<PortIo>;
+
+  /**
+   * @brief Type alias definition for request ID
+   */
+  using request_type = std::uint64_t;
+
+  /**
+   * @brief Result of a request
+   */
+  struct Completion
+  {
+    int length;               ///< Number of bytes transferred (-1 on error)
+    const char *data;         ///< Bytes read (the buffer given to submit_read())
+    std::string error;        ///< Error message (if length < 0)
+  };
+
+  /**
+   * @brief Type alias definition for completion handler
+   */
+  using handler_type = std::function<void(const Completion& completion)>;
+
+  /**
+   * @brief Destroy the PortIo object.
+   */
+  virtual ~PortIo() = default;
+
+  /**
+   * @brief Read bytes when at least one byte is available
+   *
+   * @param handle Port handle
+   * @param buffer Buffer to store bytes (pinned until completion)
+   * @param length Maximum number of bytes to read
+   * @param handler Handler to be called on completion
+   * @return Request ID
+   */
+  virtual request_type submit_read(void* handle, void* buffer, int length, const handler_type& handler) = 0;
+
+  /**
+   * @brief Write bytes when the port accepts them
+   *
+   * The request may complete with fewer bytes than requested.
+   *
+   * @param handle Port handle
+   * @param data Bytes to write (pinned until completion)
+   * @param length Number of bytes to write
+   * @param handler Handler to be called on completion
+   * @return Request ID
+   */
+  virtual request_type submit_write(void* handle, const void* data, int length, const handler_type& handler) = 0;
+
+  /**
+   * @brief Cancel a request (no effect if completed)
+   *
+   * @param request Request ID
+   */
+  virtual void cancel(request_type request) = 0;
+
+  /**
+   * @brief Cancel all requests of a port before closing it
+   *
+   * @param handle Port handle
+   */
+  virtual void release(void* handle) = 0;
+
+  /**
+   * @brief Pass requests submitted so far to the OS
+   *
+   * Called once per turn of the event loop before waiting.
+   */
+  virtual void flush() = 0;
+};
+
+/**
+ * @brief PortIo implementation based on readiness of ports
+ *
+ * Ports are watched by the poller, and bytes are transferred by
+ * OsPort::read_port() and OsPort::write_port() when they are ready.
+ * Used where the OS has no suitable asynchronous interface.
+ */
+class ReadinessPortIo : public PortIo
+{
+public:
+  ReadinessPortIo(OsPort& os, const Poller::shared_ptr& poller);
+  virtual ~ReadinessPortIo();
+
+  virtual request_type submit_read(void* handle, void* buffer, int length, const handler_type& handler) override;
+  virtual request_type submit_write(void* handle, const void* data, int length, const handler_type& handler) override;
+  virtual void cancel(request_type request) override;
+  virtual void release(void* handle) override;
+  virtual void flush() override;
+
+private:
+  struct Request
+  {
+    request_type id;          ///< Request ID (0 if none)
+    char *buffer;             ///< Bytes to write, or space to read
+    int length;               ///< Number of bytes to transfer
+    handler_type handler;     ///< Completion handler
+  };
+
+  struct Entry
+  {
+    Request read;             ///< Read request
+    Request write;            ///< Write request
+    int events;               ///< Events watched by poller
+  };
+
+  Entry& get_entry(void* handle);
+  void handle_ready(void* handle, int events);
+  void update_events(void* handle);
+
+  OsPort& os;
+  Poller::shared_ptr poller;
+  std::map<void*, Entry> entries;
+  std::map<request_type, void*> requests;
+  request_type last_request;
+};
+
+#endif /* _PORTIO_HPP_ */
@@ -0,0 +1,1213 @@
+#include "reactor.hpp"
+#include "server.hpp"
+#include "osport.hpp"
+#include "options.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <cstring>
+
+/**
+ * @brief Maximum number of received bytes buffered per port
+ *
+ * The port is not read while the buffer is full, so that the flow
+ * control of the port can stop the device.
+ */
+static const std::size_t rx_buffer_limit = 64 * 1024;
+
+/**
+ * @brief Interval to retry accepting while the number of clients is full
+ */
+static const int accept_retry_interval = 100;
+
+/**
+ * @brief Get fields of a configuration to change which differ from another
+ *
+ * @param current A reference to configuration to compare with
+ * @param set A reference to configuration to change
+ * @return Combination of SerialPortConfig::SP_FIELD_*
+ */
+static int get_changed_fields(const SerialPortConfig& current, const SerialPortConfig& set)
+{
+  const int mask = set.field_mask;
+  return
+    (((mask & SerialPortConfig::SP_FIELD_BAUD_RATE) && (set.baud_rate != current.baud_rate)) ?
+      SerialPortConfig::SP_FIELD_BAUD_RATE : 0) |
+    (((mask & SerialPortConfig::SP_FIELD_PARITY) && (set.parity != current.parity)) ?
+      SerialPortConfig::SP_FIELD_PARITY : 0) |
+    (((mask & SerialPortConfig::SP_FIELD_DATA_BITS) && (set.data_bits != current.data_bits)) ?
+      SerialPortConfig::SP_FIELD_DATA_BITS : 0) |
+    (((mask & SerialPortConfig::SP_FIELD_STOP_BITS) && (set.stop_bits != current.stop_bits)) ?
+      SerialPortConfig::SP_FIELD_STOP_BITS : 0) |
+    (((mask & SerialPortConfig::SP_FIELD_FLOW_CONTROL) && (set.flow_control != current.flow_control)) ?
+      SerialPortConfig::SP_FIELD_FLOW_CONTROL : 0) |
+    (((mask & SerialPortConfig::SP_FIELD_XON_CHAR) && (set.xon_char != current.xon_char)) ?
+      SerialPortConfig::SP_FIELD_XON_CHAR : 0) |
+    (((mask & SerialPortConfig::SP_FIELD_XOFF_CHAR) && (set.xoff_char != current.xoff_char)) ?
+      SerialPortConfig::SP_FIELD_XOFF_CHAR : 0) |
+    (((mask & SerialPortConfig::SP_FIELD_ERROR_CHAR) && (set.error_char != current.error_char)) ?
+      SerialPortConfig::SP_FIELD_ERROR_CHAR : 0);
+}
+
+/**
+ * @brief Copy fields of a configuration which have been changed
+ *
+ * @param target A reference to configuration to update
+ * @param set A reference to configuration changed
+ */
+static void merge_config(SerialPortConfig& target, const SerialPortConfig& set)
+{
+  const int mask = set.field_mask;
+  if (mask & SerialPortConfig::SP_FIELD_BAUD_RATE) {
+    target.baud_rate = set.baud_rate;
+  }
+  if (mask & SerialPortConfig::SP_FIELD_PARITY) {
+    target.parity = set.parity;
+  }
+  if (mask & SerialPortConfig::SP_FIELD_DATA_BITS) {
+    target.data_bits = set.data_bits;
+  }
+  if (mask & SerialPortConfig::SP_FIELD_STOP_BITS) {
+    target.stop_bits = set.stop_bits;
+  }
+  if (mask & SerialPortConfig::SP_FIELD_FLOW_CONTROL) {
+    target.flow_control = set.flow_control;
+  }
+  if (mask & SerialPortConfig::SP_FIELD_XON_CHAR) {
+    target.xon_char = set.xon_char;
+  }
+  if (mask & SerialPortConfig::SP_FIELD_XOFF_CHAR) {
+    target.xoff_char = set.xoff_char;
+  }
+  if (mask & SerialPortConfig::SP_FIELD_ERROR_CHAR) {
+    target.error_char = set.error_char;
+  }
+}
+
+Reactor::Reactor(Server& server, int index, const Socket::shared_ptr& socket)
+: server(server), index(index), poller(server.os.create_poller()),
+  port_io(server.os.create_port_io(poller)), server_socket(socket), accepting(false), stopping(false),
+  modem_watchers(0), port_snapshot(server.catalog.get_snapshot())
+{
+  server.catalog.add_poller(poller);
+}
+
+Reactor::~Reactor()
+{
+  server.catalog.remove_poller(poller);
+  for (const int session : sessions.get_ids()) {
+    close_session(session);
+  }
+  while (!ports.empty()) {
+    close_port(*ports.begin()->second);
+  }
+}
+
+/**
+ * @brief Run event loop until stop() is called
+ */
+void Reactor::run()
+{
+  poller->add_socket(*server_socket, Poller::POLL_IN, [this](int){
+    accept_clients();
+  });
+  accepting = true;
+
+  while (!stopping) {
+    int timeout = timers.get_timeout();
+    if (!accepting && ((timeout < 0) || (accept_retry_interval < timeout))) {
+      timeout = accept_retry_interval;
+    }
+    port_io->flush();
+    poller->wait(timeout);
+    if (modem_watchers > 0) {
+      dispatch_modem_events();
+    }
+    if (server.catalog.get_generation() != port_snapshot->generation) {
+      dispatch_port_changes();
+    }
+    timers.run();
+    cleanup_clients();
+    if (!accepting) {
+      resume_accept();
+    }
+  }
+}
+
+/**
+ * @brief Request to stop event loop (thread-safe)
+ */
+void Reactor::stop()
+{
+  stopping = true;
+  poller->wakeup();
+}
+
+/**
+ * @brief Open a new session
+ *
+ * A shared session is attached to the port if the port has already
+ * been opened by another shared session in this reactor. Any session
+ * can be attached to a permanent port which has no sessions.
+ *
+ * Ports are owned by the reactor which opened them, and the kernel
+ * decides which reactor accepts a client. So shared and permanent
+ * sessions are refused while more than one reactor runs.
+ *
+ * @param owner Client which opens the session
+ * @param path Path of port
+ * @param options Options of session
+ * @return Session ID (>= 1)
+ */
+int Reactor::open_session(Client& owner, const std::string& path, const SessionOptions& options)
+{
+  if ((options.shared || options.permanent) && (server.get_reactor_count() > 1)) {
+    throw std::invalid_argument("shared and permanent ports need a single thread (-t 1)");
+  }
+  auto& os = server.os;
+  std::shared_ptr<Port> port;
+  auto port_iter = ports.find(path);
+  if (port_iter != ports.end()) {
+    port = port_iter->second;
+    if (!(port->permanent && port->sessions.empty()) &&
+        !(options.shared && port->shared)) {
+      throw std::runtime_error("port is busy: " + path);
+    }
+    port->shared = options.shared;
+    port->permanent = port->permanent || options.permanent;
+  } else {
+    auto handle = os.open_port(path.c_str());
+    if (!handle) {
+      throw std::runtime_error("cannot open port: " + path);
+    }
+    try {
+      const bool spill = !options.spill_path.empty();
+      std::size_t capacity = rx_buffer_limit;
+      if (spill) {
+        capacity = options.spill_size;
+      } else if (options.permanent && (server.opt.get_capture_size() > 0)) {
+        capacity = server.opt.get_capture_size();
+      }
+      port = std::make_shared<Port>(handle, path, options.shared, options.permanent,
+        capacity, spill ? options.spill_path.c_str() : nullptr);
+    } catch (...) {
+      os.close_port(handle);
+      throw;
+    }
+    port->metrics = metrics.add_port(path);
+    ports.emplace(path, port);
+  }
+
+  std::uint64_t cursor = port->get_rx_end();
+  if (options.offset >= 0) {
+    cursor = std::max<std::uint64_t>(std::min<std::uint64_t>(options.offset, cursor), port->rx_offset);
+  }
+  const int session = sessions.add(std::unique_ptr<Session>(
+    new Session{port, &owner, options.readable, options.writable, cursor}));
+  port->sessions.push_back(session);
+  update_port_io(*port);
+
+  Log(LOG_INFO, "session opened").add("reactor", index).add("session", session).add("path", path)
+    .add("shared", options.shared).add("permanent", port->permanent);
+  return session;
+}
+
+/**
+ * @brief Get session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @return A reference to session
+ */
+Session& Reactor::get_session(Client& owner, int session)
+{
+  auto s = sessions.find(session);
+  if (!s || (s->owner != &owner)) {
+    throw std::invalid_argument("invalid session: " + std::to_string(session));
+  }
+  return *s;
+}
+
+/**
+ * @brief Take received bytes from session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param buffer Buffer to store bytes
+ * @param length Maximum number of bytes to take
+ * @return Number of bytes taken
+ */
+std::size_t Reactor::read_session(Client& owner, int session, char *buffer, std::size_t length)
+{
+  auto& s = get_session(owner, session);
+  const std::size_t size = std::min(s.get_unread_size(), length);
+  std::memcpy(buffer, s.get_unread_data(), size);
+  consume_session(owner, session, size);
+  return size;
+}
+
+/**
+ * @brief Mark received bytes as read
+ *
+ * Used after taking bytes directly from Session::get_unread_data().
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param length Number of bytes (up to the unread size)
+ */
+void Reactor::consume_session(Client& owner, int session, std::size_t length)
+{
+  auto& s = get_session(owner, session);
+  length = std::min(s.get_unread_size(), length);
+  if (length > 0) {
+    record_delivery(*s.port);
+  }
+  s.rx_cursor += length;
+  trim_port(*s.port);
+}
+
+/**
+ * @brief Set framing of a session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param framer A reference to framer
+ */
+void Reactor::set_framer(Client& owner, int session, const Framer& framer)
+{
+  auto& s = get_session(owner, session);
+  s.framer = framer;
+  s.scan_cursor = s.rx_cursor;
+  s.frame_overflow = false;
+}
+
+/**
+ * @brief Test if a read on a session can complete now
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param condition A reference to condition
+ * @param expired true if the read must complete now (no wait or timed out)
+ * @param length Reference to store the number of bytes to read
+ * @return true if the read completes
+ */
+bool Reactor::check_read(Client& owner, int session, const ReadCondition& condition, bool expired, std::size_t& length)
+{
+  return match_read(get_session(owner, session), condition, expired, length);
+}
+
+/**
+ * @brief Let the owner wait until a read condition is met
+ *
+ * The condition is tested by the reactor whenever bytes arrive, and the
+ * owner is resumed (see Client::resume()) only when it is met, so that
+ * a frame received in many pieces wakes the owner once.
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param condition A reference to condition
+ */
+void Reactor::wait_session(Client& owner, int session, const ReadCondition& condition)
+{
+  auto& s = get_session(owner, session);
+  s.waiting = true;
+  s.read_condition = condition;
+  if ((condition.gap > TimerQueue::clock::duration::zero()) && (s.get_unread_size() > 0)) {
+    schedule_gap(session);
+  }
+}
+
+/**
+ * @brief Configure the port of a session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param set A reference to configuration to change
+ * @param get A reference to store the current configuration
+ */
+void Reactor::configure_session(Client& owner, int session, const SerialPortConfig& set, SerialPortConfig& get)
+{
+  configure_port(*get_session(owner, session).port, set, get);
+}
+
+/**
+ * @brief Get time to transfer one character on the port of a session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @return Duration (zero if the baud rate is unknown)
+ */
+TimerQueue::clock::duration Reactor::get_char_time(Client& owner, int session)
+{
+  return get_char_time(*get_session(owner, session).port);
+}
+
+/**
+ * @brief Test if bytes queued on a session have been transmitted
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param offset Absolute offset of the end of bytes
+ * @param drained true to test if they have left the port, false to test
+ *                if they have been written to the driver
+ * @return true if transmitted
+ */
+bool Reactor::check_transmit(Client& owner, int session, std::uint64_t offset, bool drained)
+{
+  auto& port = *get_session(owner, session).port;
+  if (port.tx_offset < offset) {
+    return false;
+  }
+  return !drained || (get_drained_offset(port) >= offset);
+}
+
+/**
+ * @brief Let the owner wait until bytes queued on a session are transmitted
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param offset Absolute offset of the end of bytes
+ * @param drained true to wait until they have left the port
+ */
+void Reactor::wait_transmit(Client& owner, int session, std::uint64_t offset, bool drained)
+{
+  auto& s = get_session(owner, session);
+  s.tx_wait = offset;
+  s.tx_drain = drained;
+  if (drained && (s.port->tx_offset >= offset)) {
+    notify_transmit(*s.port);
+  }
+}
+
+/**
+ * @brief Configure port through the cache of its configuration
+ *
+ * The device is touched only for fields which differ from both the
+ * effective value and the value requested last (a driver may round the
+ * baud rate), because reconfiguring may reset the UART. Reading the
+ * configuration is answered from the cache.
+ *
+ * @param port A reference to port
+ * @param set Configuration to change
+ * @param get A reference to store the current configuration
+ */
+void Reactor::configure_port(Port& port, const SerialPortConfig& set, SerialPortConfig& get)
+{
+  const bool known = port.config_known;
+  SerialPortConfig change = set;
+  if (known) {
+    change.field_mask = get_changed_fields(port.config, set) & get_changed_fields(port.config_request, set);
+    if (change.field_mask == 0) {
+      get = port.config;
+      return;
+    }
+  }
+  port.config_known = false;
+  server.os.configure_port(port.handle, change, get);
+  port.config = get;
+  port.config.field_mask = 0;
+  if (!known) {
+    port.config_request = port.config;
+  }
+  merge_config(port.config_request, change);
+  port.config_known = true;
+  port.char_time = TimerQueue::clock::duration::zero();
+  if (get.baud_rate > 0) {
+    // Start bit, data bits, parity bit and stop bits (in halves)
+    static const int stop_halves[] = { 2, 3, 4 };
+    const int halves = 2 * (1 + (int)get.data_bits + ((get.parity != SerialPortConfig::SP_PARITY_NONE) ? 1 : 0)) +
+      stop_halves[get.stop_bits];
+    port.char_time = std::chrono::duration_cast<TimerQueue::clock::duration>(
+      std::chrono::nanoseconds((std::int64_t)halves * 500000000 / get.baud_rate));
+  }
+}
+
+
+/**
+ * @brief Queue bytes to transmit
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param data Pointer to bytes to transmit
+ * @param length Number of bytes
+ * @return Number of bytes queued
+ */
+std::size_t Reactor::write_session(Client& owner, int session, const char *data, std::size_t length)
+{
+  auto& s = get_session(owner, session);
+  if (!s.writable) {
+    throw std::logic_error("session is not writable");
+  }
+  s.port->tx_buffer.append(data, length);
+  update_port_io(*s.port);
+  return length;
+}
+
+/**
+ * @brief Reserve space to store bytes to transmit
+ *
+ * The caller stores bytes directly and then calls commit_write(), even
+ * if it has failed to store them.
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param length Maximum number of bytes to store
+ * @return Pointer to the space
+ */
+char *Reactor::reserve_write(Client& owner, int session, std::size_t length)
+{
+  auto& s = get_session(owner, session);
+  if (!s.writable) {
+    throw std::logic_error("session is not writable");
+  }
+  auto& tx_buffer = s.port->tx_buffer;
+  const std::size_t size = tx_buffer.size();
+  tx_buffer.resize(size + length);
+  return &tx_buffer[size];
+}
+
+/**
+ * @brief Queue bytes stored in the space reserved by reserve_write()
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param reserved Number of bytes reserved
+ * @param length Number of bytes stored (0 to cancel)
+ * @return Number of bytes queued
+ */
+std::size_t Reactor::commit_write(Client& owner, int session, std::size_t reserved, std::size_t length)
+{
+  auto& s = get_session(owner, session);
+  auto& tx_buffer = s.port->tx_buffer;
+  tx_buffer.resize(tx_buffer.size() - reserved + length);
+  if (length > 0) {
+    update_port_io(*s.port);
+  }
+  return length;
+}
+
+/**
+ * @brief Get modem lines of the port of a session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @return Lines which are active (combination of MODEM_*)
+ */
+int Reactor::get_modem_lines(Client& owner, int session)
+{
+  return server.os.get_modem_lines(get_session(owner, session).port->handle);
+}
+
+/**
+ * @brief Set modem output lines of the port of a session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param mask Lines to change (combination of MODEM_DTR, MODEM_RTS and MODEM_BREAK)
+ * @param lines Lines to activate among mask
+ */
+void Reactor::set_modem_lines(Client& owner, int session, int mask, int lines)
+{
+  auto& s = get_session(owner, session);
+  if (!s.writable) {
+    throw std::logic_error("session is not writable");
+  }
+  server.os.set_modem_lines(s.port->handle, mask, lines);
+}
+
+/**
+ * @brief Start or stop pushing changes of modem lines to the owner
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ * @param enable true to start, false to stop
+ */
+void Reactor::watch_modem(Client& owner, int session, bool enable)
+{
+  auto& s = get_session(owner, session);
+  s.modem_watch = enable;
+  try {
+    update_modem_watcher(*s.port);
+  } catch (...) {
+    s.modem_watch = false;
+    throw;
+  }
+}
+
+/**
+ * @brief Close session
+ *
+ * @param owner Client which opened the session
+ * @param session Session ID
+ */
+void Reactor::close_session(Client& owner, int session)
+{
+  get_session(owner, session);
+  close_session(session);
+}
+
+/**
+ * @brief Push received bytes to the owner of a subscribed session later
+ *
+ * A push already scheduled is rescheduled.
+ *
+ * @param session Session ID
+ * @param delay Delay in milliseconds
+ */
+void Reactor::schedule_push(int session, int delay)
+{
+  auto& s = *sessions.find(session);
+  if (s.push_scheduled) {
+    timers.cancel(s.push_timer);
+  }
+  s.push_timer = timers.add(std::chrono::milliseconds(delay), [this, session](){
+    sessions.find(session)->push_scheduled = false;
+    push_session(session);
+  });
+  s.push_scheduled = true;
+}
+
+/**
+ * @brief Let the owner run requests waiting on a session
+ *
+ * The requests run from the event loop, not from the port handler,
+ * because they may close the port.
+ *
+ * @param session Session ID
+ * @param delay Delay to run them
+ */
+void Reactor::schedule_resume(int session, TimerQueue::clock::duration delay)
+{
+  auto owner = sessions.find(session)->owner;
+  timers.add(delay, [this, session, owner](){
+    auto s = sessions.find(session);
+    if (s && (s->owner == owner)) {
+      owner->resume(session);
+    }
+  });
+}
+
+void Reactor::close_session(int session)
+{
+  auto& s = *sessions.find(session);
+  if (s.push_scheduled) {
+    timers.cancel(s.push_timer);
+  }
+  if (s.gap_scheduled) {
+    timers.cancel(s.gap_timer);
+  }
+  auto port = s.port;
+  const bool modem_watch = s.modem_watch;
+  sessions.remove(session);
+  port->sessions.erase(std::find(port->sessions.begin(), port->sessions.end(), session));
+  if (modem_watch) {
+    update_modem_watcher(*port);
+  }
+
+  Log(LOG_INFO, "session closed").add("reactor", index).add("session", session);
+  if (port->sessions.empty() && !port->permanent) {
+    close_port(*port);
+  } else {
+    trim_port(*port);
+  }
+}
+
+void Reactor::close_port(Port& port)
+{
+  if (port.drain_scheduled) {
+    timers.cancel(port.drain_timer);
+  }
+  if (port.modem_watcher) {
+    port.modem_watcher.reset();
+    --modem_watchers;
+  }
+  metrics.remove_port(port.metrics);
+  port_io->release(port.handle);
+  server.os.close_port(port.handle);
+  ports.erase(port.path);
+}
+
+/**
+ * @brief Remove a client whose connection has been closed
+ *
+ * The client is destroyed after all handlers of the current event
+ * have returned.
+ *
+ * @param client A reference to client
+ */
+void Reactor::remove_client(Client& client)
+{
+  auto iter = std::find_if(active_clients.begin(), active_clients.end(),
+    [&client](const std::unique_ptr<Client>& c){ return c.get() == &client; });
+  if (iter == active_clients.end()) {
+    return;
+  }
+  for (const int session : sessions.get_ids()) {
+    if (sessions.find(session)->owner == &client) {
+      close_session(session);
+    }
+  }
+  dead_clients.splice(dead_clients.begin(), active_clients, iter);
+  server.release_client();
+  Log(LOG_INFO, "client closed").add("reactor", index).add("clients", active_clients.size());
+}
+
+void Reactor::accept_clients()
+{
+  for (;;) {
+    if (!server.acquire_client()) {
+      // Stop accepting until a client leaves
+      poller->modify_socket(*server_socket, 0);
+      accepting = false;
+      return;
+    }
+
+    auto client_socket = server_socket->accept();
+    if (!client_socket) {
+      server.release_client();
+      return;
+    }
+    client_socket->set_buffer_size(server_socket->get_buffer_size());
+    metrics.connections.add();
+    Log(LOG_INFO, "client accepted").add("reactor", index).add("clients", active_clients.size() + 1);
+    active_clients.emplace_front(new Client(*this, client_socket));
+    active_clients.front()->start();
+  }
+}
+
+void Reactor::resume_accept()
+{
+  poller->modify_socket(*server_socket, Poller::POLL_IN);
+  accepting = true;
+}
+
+void Reactor::cleanup_clients()
+{
+  dead_clients.clear();
+}
+
+void Reactor::handle_port_error(Port& port, const std::string& error)
+{
+  Log(LOG_ERROR, "port failed").add("path", port.path).add("error", error);
+  const auto failed = ports.find(port.path)->second;
+  const auto attached = failed->sessions;
+  for (const int session : attached) {
+    sessions.find(session)->owner->fail_requests(session, "port error: " + error);
+    close_session(session);
+  }
+  // A permanent port is left without sessions, but cannot be read any more
+  if (ports.count(failed->path)) {
+    Log(LOG_WARNING, "permanent port closed").add("path", failed->path);
+    close_port(*failed);
+  }
+}
+
+void Reactor::handle_read(Port& port, const PortIo::Completion& completion)
+{
+  port.read_request = 0;
+  if (completion.length < 0) {
+    handle_port_error(port, completion.error);
+    return;
+  }
+  auto& ring = port.rx_ring;
+  if (completion.data != ring.write_ptr()) {
+    // The ring has been emptied and rewound while reading
+    std::memmove(ring.write_ptr(), completion.data, completion.length);
+  }
+  ring.commit(completion.length);
+  port.rx_time = TimerQueue::clock::now();
+  port.metrics->rx_bytes.add(completion.length);
+  for (const int session : port.sessions) {
+    auto& s = *sessions.find(session);
+    if (s.waiting) {
+      // Wake the owner only when its read can complete
+      std::size_t length;
+      if (match_read(s, s.read_condition, false, length)) {
+        s.waiting = false;
+        schedule_resume(session);
+      } else if (s.read_condition.gap > TimerQueue::clock::duration::zero()) {
+        schedule_gap(session);
+      }
+    }
+    const std::size_t unread = s.get_unread_size();
+    if (s.subscribed && (unread > 0)) {
+      if ((unread >= s.push_size) || (s.framer.mode != Framer::FRAMING_NONE)) {
+        push_session(session);
+      } else if (!s.push_scheduled) {
+        schedule_push(session, s.push_latency);
+      }
+    }
+  }
+  update_port_io(port);
+}
+
+void Reactor::handle_write(Port& port, const PortIo::Completion& completion)
+{
+  port.write_request = 0;
+  if (completion.length < 0) {
+    handle_port_error(port, completion.error);
+    return;
+  }
+  port.tx_sent += completion.length;
+  port.tx_offset += completion.length;
+  if (port.tx_sent == port.tx_sending.size()) {
+    port.tx_sending.clear();
+    port.tx_sent = 0;
+  }
+  port.metrics->tx_bytes.add(completion.length);
+  notify_transmit(port);
+  update_port_io(port);
+}
+
+/**
+ * @brief Test a read condition against the unread bytes of a session
+ *
+ * The delimiter is searched only in bytes not searched yet. With
+ * framing, the read completes with a whole frame, whose length (0 if
+ * expired without one) is stored.
+ *
+ * @param s A reference to session
+ * @param condition A reference to condition
+ * @param expired true if the read must complete now
+ * @param length Reference to store the number of bytes to read
+ * @return true if the read completes
+ */
+bool Reactor::match_read(Session& s, const ReadCondition& condition, bool expired, std::size_t& length)
+{
+  if (s.framer.mode != Framer::FRAMING_NONE) {
+    length = find_frame(s);
+    return (length > 0) || expired;
+  }
+  const std::size_t unread = s.get_unread_size();
+  const std::size_t limit = (condition.length > 0) ? std::min(unread, condition.length) : unread;
+  length = limit;
+  if (condition.delimiter >= 0) {
+    const std::size_t scanned = (std::size_t)(std::max(s.scan_cursor, s.rx_cursor) - s.rx_cursor);
+    const char *data = s.get_unread_data();
+    if (scanned < limit) {
+      auto found = (const char *)std::memchr(data + scanned, condition.delimiter, limit - scanned);
+      if (found) {
+        s.scan_cursor = s.rx_cursor + (found - data);
+        length = (found - data) + 1;
+        return true;
+      }
+      s.scan_cursor = s.rx_cursor + limit;
+    }
+  }
+  if (expired) {
+    return true;
+  }
+  if ((condition.length > 0) && (unread >= condition.length)) {
+    return true;
+  }
+  if (unread == 0) {
+    return false;
+  }
+  if (condition.gap > TimerQueue::clock::duration::zero()) {
+    return (TimerQueue::clock::now() - s.port->rx_time >= condition.gap);
+  }
+  return (condition.length == 0) && (condition.delimiter < 0);
+}
+
+/**
+ * @brief Find the first frame in the unread bytes of a session
+ *
+ * Bytes which fill the receive ring without completing a frame are
+ * discarded, so that a broken frame does not stop the port. With
+ * delimited framing, bytes up to the next delimiter are discarded too.
+ *
+ * @param s A reference to session
+ * @return Length of the frame (0 if none)
+ */
+std::size_t Reactor::find_frame(Session& s)
+{
+  for (;;) {
+    const std::size_t unread = s.get_unread_size();
+    std::size_t scanned = (std::size_t)(std::max(s.scan_cursor, s.rx_cursor) - s.rx_cursor);
+    const std::size_t length = s.framer.find(s.get_unread_data(), unread, scanned);
+    s.scan_cursor = s.rx_cursor + scanned;
+    if (length == 0) {
+      if (unread >= s.port->rx_ring.capacity()) {
+        Log(LOG_WARNING, "frame too long").add("path", s.port->path).add("discarded", unread);
+        s.rx_cursor += unread;
+        s.port->metrics->dropped_bytes.add(unread);
+        s.frame_overflow = s.framer.is_delimited();
+        trim_port(*s.port);
+      }
+      return 0;
+    }
+    if (!s.frame_overflow) {
+      return length;
+    }
+    s.frame_overflow = false;
+    s.rx_cursor += length;
+    trim_port(*s.port);
+  }
+}
+
+TimerQueue::clock::duration Reactor::get_char_time(Port& port)
+{
+  if (port.char_time == TimerQueue::clock::duration::zero()) {
+    SerialPortConfig config_change = {0};
+    SerialPortConfig config_current = {0};
+    configure_port(port, config_change, config_current);
+  }
+  return port.char_time;
+}
+
+/**
+ * @brief Get absolute offset of the end of bytes which have left the port
+ *
+ * @param port A reference to port
+ */
+std::uint64_t Reactor::get_drained_offset(Port& port)
+{
+  const std::uint64_t queued = (std::uint64_t)std::max(server.os.get_output_size(port.handle), 0);
+  return (port.tx_offset > queued) ? (port.tx_offset - queued) : 0;
+}
+
+/**
+ * @brief Resume owners whose transmission has completed
+ *
+ * Bytes written to the driver are followed by a timer, which estimates
+ * from the baud rate when they leave the port, instead of a blocking
+ * tcdrain().
+ *
+ * @param port A reference to port
+ */
+void Reactor::notify_transmit(Port& port)
+{
+  std::uint64_t drained = 0;
+  std::uint64_t next_wait = 0;
+  bool drained_known = false;
+  for (const int session : port.sessions) {
+    auto& s = *sessions.find(session);
+    if ((s.tx_wait == 0) || (port.tx_offset < s.tx_wait)) {
+      continue;
+    }
+    if (s.tx_drain) {
+      if (!drained_known) {
+        try {
+          drained = get_drained_offset(port);
+        } catch (const std::exception& e) {
+          // Acknowledge without waiting for the port which cannot tell
+          Log(LOG_WARNING, "cannot get drained offset").add("path", port.path).add("error", e.what());
+          drained = port.tx_offset;
+        }
+        drained_known = true;
+      }
+      if (drained < s.tx_wait) {
+        next_wait = next_wait ? std::min(next_wait, s.tx_wait) : s.tx_wait;
+        continue;
+      }
+    }
+    s.tx_wait = 0;
+    schedule_resume(session);
+  }
+  if ((next_wait == 0) || port.drain_scheduled) {
+    return;
+  }
+  TimerQueue::clock::duration char_time = std::chrono::milliseconds(1);
+  try {
+    if (get_char_time(port) > TimerQueue::clock::duration::zero()) {
+      char_time = get_char_time(port);
+    }
+  } catch (const std::exception&) {
+    // Poll every millisecond
+  }
+  const auto delay = std::max<TimerQueue::clock::duration>(char_time * (std::int64_t)(next_wait - drained),
+    std::chrono::milliseconds(1));
+  auto raw_port = &port;
+  port.drain_timer = timers.add(delay, [this, raw_port](){
+    raw_port->drain_scheduled = false;
+    notify_transmit(*raw_port);
+  });
+  port.drain_scheduled = true;
+}
+
+/**
+ * @brief Complete the read waiting on a session when the port stays silent
+ *
+ * @param session Session ID
+ */
+void Reactor::schedule_gap(int session)
+{
+  auto& s = *sessions.find(session);
+  if (s.gap_scheduled) {
+    timers.cancel(s.gap_timer);
+  }
+  const auto delay = s.port->rx_time + s.read_condition.gap - TimerQueue::clock::now();
+  s.gap_timer = timers.add(std::max(delay, TimerQueue::clock::duration::zero()), [this, session](){
+    auto& s = *sessions.find(session);
+    s.gap_scheduled = false;
+    std::size_t length;
+    if (s.waiting && match_read(s, s.read_condition, false, length)) {
+      s.waiting = false;
+      s.owner->resume(session);
+    }
+  });
+  s.gap_scheduled = true;
+}
+
+/**
+ * @brief Watch modem lines of a port while any session wants their changes
+ *
+ * @param port A reference to port
+ */
+void Reactor::update_modem_watcher(Port& port)
+{
+  const bool watched = std::any_of(port.sessions.begin(), port.sessions.end(),
+    [this](int session){ return sessions.find(session)->modem_watch; });
+  if (watched && !port.modem_watcher) {
+    port.modem_watcher = server.os.watch_modem_lines(port.handle, poller);
+    ++modem_watchers;
+  } else if (!watched && port.modem_watcher) {
+    port.modem_watcher.reset();
+    --modem_watchers;
+  }
+}
+
+/**
+ * @brief Push changes of modem lines taken from watchers
+ *
+ * Events of all ports are taken first, because pushing may close
+ * sessions and ports.
+ */
+void Reactor::dispatch_modem_events()
+{
+  modem_pushes.clear();
+  for (const auto& item : ports) {
+    auto& port = *item.second;
+    if (!port.modem_watcher) {
+      continue;
+    }
+    modem_events.clear();
+    port.modem_watcher->take_events(modem_events);
+    for (const auto& event : modem_events) {
+      for (const int session : port.sessions) {
+        if (sessions.find(session)->modem_watch) {
+          modem_pushes.emplace_back(session, event);
+        }
+      }
+    }
+  }
+  for (const auto& item : modem_pushes) {
+    auto s = sessions.find(item.first);
+    if (s && s->modem_watch) {
+      s->owner->push_modem(item.first, item.second);
+    }
+  }
+}
+
+/**
+ * @brief Push differences of the port list to clients
+ *
+ * Clients of this reactor see snapshots in the same order as the
+ * differences pushed, so a "list" reply and the pushes after it agree.
+ */
+void Reactor::dispatch_port_changes()
+{
+  const auto previous = port_snapshot;
+  port_snapshot = server.catalog.get_snapshot();
+  if (active_clients.empty()) {
+    return;
+  }
+  std::map<std::string, const SerialPortInfo*> old_ports;
+  for (const auto& info : previous->ports) {
+    old_ports.emplace(info.path, &info);
+  }
+  std::vector<const SerialPortInfo*> added;
+  for (const auto& info : port_snapshot->ports) {
+    auto iter = old_ports.find(info.path);
+    if (iter == old_ports.end()) {
+      added.push_back(&info);
+      continue;
+    }
+    if (*iter->second != info) {
+      added.push_back(&info);
+    }
+    old_ports.erase(iter);
+  }
+  std::vector<const SerialPortInfo*> removed;
+  for (const auto& item : old_ports) {
+    removed.push_back(item.second);
+  }
+  if (added.empty() && removed.empty()) {
+    return;
+  }
+  // Pushing may move clients to dead_clients, which keeps them until cleanup
+  std::vector<Client*> clients;
+  for (const auto& client : active_clients) {
+    clients.push_back(client.get());
+  }
+  for (auto client : clients) {
+    client->push_ports(added, removed);
+  }
+}
+
+/**
+ * @brief Push received bytes to the owner as far as its credit allows
+ *
+ * Bytes are pushed directly from the receive ring of the port. Bytes
+ * beyond the credit stay in the ring, so a slow client stops the port
+ * through the receive buffer limit. With framing, whole frames are
+ * pushed one per message, and a frame larger than the credit waits.
+ *
+ * @param session Session ID
+ */
+void Reactor::push_session(int session)
+{
+  auto& s = *sessions.find(session);
+  if (s.push_scheduled) {
+    timers.cancel(s.push_timer);
+    s.push_scheduled = false;
+  }
+  if (s.subscribed && (s.framer.mode != Framer::FRAMING_NONE)) {
+    while (std::size_t length = find_frame(s)) {
+      char *buffer = nullptr;
+      if (s.framer.is_encoded()) {
+        frame_buffer.resize(length);
+        buffer = frame_buffer.data();
+      }
+      std::size_t size;
+      const char *payload = s.framer.get_payload(s.get_unread_data(), length, buffer, size);
+      if (payload && (size > 0)) {
+        if (size > s.push_credit) {
+          break;
+        }
+        s.push_credit -= size;
+        record_delivery(*s.port);
+        s.owner->push(session, payload, size);
+      }
+      s.rx_cursor += length;
+    }
+    trim_port(*s.port);
+    return;
+  }
+  const std::size_t length = std::min(s.get_unread_size(), s.push_credit);
+  if (!s.subscribed || (length == 0)) {
+    return;
+  }
+  s.push_credit -= length;
+  record_delivery(*s.port);
+  s.owner->push(session, s.get_unread_data(), length);
+  s.rx_cursor += length;
+  trim_port(*s.port);
+}
+
+/**
+ * @brief Record time from the last arrival of bytes to handing them to a client
+ *
+ * @param port A reference to port
+ */
+void Reactor::record_delivery(const Port& port)
+{
+  metrics.delivery_time.record((std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    TimerQueue::clock::now() - port.rx_time).count());
+}
+
+/**
+ * @brief Discard received bytes which all readable sessions have read
+ *
+ * @param port A reference to port
+ */
+void Reactor::trim_port(Port& port)
+{
+  if (port.permanent) {
+    update_port_io(port);
+    return;
+  }
+  std::uint64_t head = port.get_rx_end();
+  for (const int session : port.sessions) {
+    const auto& s = *sessions.find(session);
+    if (s.readable) {
+      head = std::min(head, s.rx_cursor);
+    }
+  }
+  port.rx_ring.consume((std::size_t)(head - port.rx_offset));
+  port.rx_offset = head;
+  update_port_io(port);
+}
+
+/**
+ * @brief Drop the oldest received bytes of a permanent port
+ *
+ * Sessions which have not read them skip them.
+ *
+ * @param port A reference to port
+ * @param length Number of bytes to drop
+ */
+void Reactor::drop_port_data(Port& port, std::size_t length)
+{
+  port.rx_ring.consume(length);
+  port.rx_offset += length;
+  port.metrics->dropped_bytes.add(length);
+  for (const int session : port.sessions) {
+    auto& s = *sessions.find(session);
+    s.rx_cursor = std::max(s.rx_cursor, port.rx_offset);
+  }
+}
+
+/**
+ * @brief Submit a read and a write to the port if they are needed
+ *
+ * A read is submitted while any session reads the port and its ring
+ * has room, and a write while bytes are waiting to be transmitted.
+ * A permanent port without readers keeps reading and drops its oldest
+ * bytes, but never drops bytes which an attached reader has not read.
+ * A write takes all bytes queued so far without copying them (they are
+ * moved to tx_sending), and bytes queued meanwhile go out with the next.
+ * Handlers hold the port, so that the buffers stay valid until the OS
+ * releases them even if the port is closed.
+ *
+ * @param port A reference to port
+ */
+void Reactor::update_port_io(Port& port)
+{
+  bool readable = false;
+  std::uint64_t head = port.get_rx_end();
+  for (const int session : port.sessions) {
+    const auto& s = *sessions.find(session);
+    if (s.readable) {
+      readable = true;
+      head = std::min(head, s.rx_cursor);
+    }
+  }
+  auto& ring = port.rx_ring;
+  if ((readable || port.permanent) && !port.read_request) {
+    if (port.permanent) {
+      const std::size_t reserve = std::min<std::size_t>(ring.capacity() / 4, 4096);
+      const std::size_t room = ring.capacity() - ring.size();
+      if ((room < reserve) && readable) {
+        // Make room only with bytes all readers have read, or wait for them
+        const std::size_t length = std::min<std::size_t>(reserve - room, (std::size_t)(head - port.rx_offset));
+        ring.consume(length);
+        port.rx_offset += length;
+      } else if (room < reserve) {
+        drop_port_data(port, reserve - room);
+      }
+    }
+    if (ring.size() < ring.capacity()) {
+      const auto pinned = port.shared_from_this();
+      const std::size_t length = ring.writable();
+      port.read_request = port_io->submit_read(port.handle, ring.write_ptr(), (int)length,
+        [this, pinned](const PortIo::Completion& completion){
+          handle_read(*pinned, completion);
+        });
+    }
+  }
+  if (!port.write_request) {
+    if (port.tx_sending.empty()) {
+      port.tx_sending.swap(port.tx_buffer);
+    }
+    if (!port.tx_sending.empty()) {
+      const auto pinned = port.shared_from_this();
+      port.write_request = port_io->submit_write(port.handle, port.tx_sending.data() + port.tx_sent,
+        (int)(port.tx_sending.size() - port.tx_sent),
+        [this, pinned](const PortIo::Completion& completion){
+          handle_write(*pinned, completion);
+        });
+    }
+  }
+  port.metrics->rx_queue.set(ring.size());
+  port.metrics->tx_queue.set(port.get_tx_size());
+}
@@ -0,0 +1,262 @@
+#ifndef _REACTOR_HPP_
+#define _REACTOR_HPP_
+
+#include "osport.hpp"
+#include "socket.hpp"
+#include "poller.hpp"
+#include "portio.hpp"
+#include "client.hpp"
+#include "timer.hpp"
+#include "ring.hpp"
+#include "framer.hpp"
+#include "registry.hpp"
+#include "catalog.hpp"
+#include "metrics.hpp"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Server;
+
+/**
+ * @brief Opened port and its buffers
+ *
+ * A port is read by one reader into one receive ring shared by all
+ * sessions attached to it. Received bytes are kept until every
+ * readable session has read them.
+ *
+ * A permanent port stays open without sessions and keeps reading.
+ * Its ring keeps bytes already read so that a session can resume from
+ * an older offset. While no session reads it, the oldest bytes are
+ * dropped when it is full; otherwise reading waits for the readers.
+ */
+struct Port : std::enable_shared_from_this<Port>
+{
+  Port(OsPort::handle_type handle, const std::string& path, bool shared, bool permanent,
+       std::size_t rx_capacity, const char *rx_file)
+  : handle(handle), path(path), shared(shared), permanent(permanent), read_request(0),
+    write_request(0), config_known(false), char_time(0), rx_ring(rx_capacity, rx_file),
+    rx_offset(0), tx_sent(0), tx_offset(0), drain_scheduled(false) {}
+
+  /**
+   * @brief Get absolute offset of the end of received bytes
+   */
+  std::uint64_t get_rx_end() const
+  {
+    return rx_offset + rx_ring.size();
+  }
+
+  /**
+   * @brief Get number of bytes not yet written to port
+   */
+  std::size_t get_tx_size() const
+  {
+    return tx_sending.size() - tx_sent + tx_buffer.size();
+  }
+
+  /**
+   * @brief Get absolute offset of the end of bytes to transmit
+   */
+  std::uint64_t get_tx_end() const
+  {
+    return tx_offset + get_tx_size();
+  }
+
+  OsPort::handle_type handle; ///< Port handle
+  std::string path;           ///< Path of port
+  bool shared;                ///< Other sessions can be attached
+  bool permanent;             ///< Keep reading without sessions
+  PortIo::request_type read_request;  ///< Read in flight (0 if none)
+  PortIo::request_type write_request; ///< Write in flight (0 if none)
+  bool config_known;          ///< config and config_request are valid
+  SerialPortConfig config;    ///< Effective configuration of port
+  SerialPortConfig config_request;  ///< Values requested last (may differ from effective ones)
+  TimerQueue::clock::duration char_time;  ///< Time of one character (zero if unknown)
+  TimerQueue::clock::time_point rx_time;  ///< Time when bytes arrived last
+  RingBuffer rx_ring;         ///< Received bytes not yet read by all sessions
+  std::uint64_t rx_offset;    ///< Absolute offset of the head of rx_ring
+  std::string tx_sending;     ///< Bytes given to writes (pinned while a write is in flight)
+  std::size_t tx_sent;        ///< Number of bytes of tx_sending already written
+  std::string tx_buffer;      ///< Bytes queued after tx_sending
+  std::uint64_t tx_offset;    ///< Absolute offset of the first byte not yet written
+  bool drain_scheduled;       ///< Drain timer is running
+  TimerQueue::key_type drain_timer; ///< Key of drain timer
+  ModemWatcher::unique_ptr modem_watcher; ///< Watcher of modem lines (null if not watched)
+  std::shared_ptr<PortMetrics> metrics;   ///< Metrics of port
+  std::vector<int> sessions;  ///< Sessions attached to this port
+};
+
+/**
+ * @brief Condition to complete a read
+ *
+ * A read completes when any of the conditions given is met. Without
+ * "length", "delimiter" and "gap", any byte completes it.
+ */
+struct ReadCondition
+{
+  std::size_t length;         ///< Bytes to complete (and to read at most; 0 for any)
+  int delimiter;              ///< Byte to complete with (-1 if none)
+  TimerQueue::clock::duration gap;  ///< Silence after bytes to complete (zero if none)
+};
+
+/**
+ * @brief Session attached to a port
+ */
+struct Session
+{
+  /**
+   * @brief Get number of received bytes not yet read by this session
+   */
+  std::size_t get_unread_size() const
+  {
+    return (std::size_t)(port->get_rx_end() - rx_cursor);
+  }
+
+  /**
+   * @brief Get received bytes not yet read by this session
+   */
+  const char *get_unread_data() const
+  {
+    return port->rx_ring.read_ptr() + (rx_cursor - port->rx_offset);
+  }
+
+  std::shared_ptr<Port> port; ///< Attached port
+  Client *owner;              ///< Client which opened this session
+  bool readable;              ///< Receive bytes from port
+  bool writable;              ///< Transmit bytes to port
+  std::uint64_t rx_cursor;    ///< Absolute offset of the next byte to read
+  bool subscribed;            ///< Push received bytes to owner
+  std::size_t push_size;      ///< Bytes to push without waiting for latency
+  int push_latency;           ///< Milliseconds to wait for more bytes
+  std::size_t push_credit;    ///< Bytes which owner can still accept
+  bool push_scheduled;        ///< Push timer is running
+  TimerQueue::key_type push_timer;  ///< Key of push timer
+  bool waiting;               ///< Owner has requests waiting for bytes
+  ReadCondition read_condition;     ///< Condition which the owner waits for
+  std::uint64_t scan_cursor;  ///< Absolute offset to search delimiter or frame end from
+  Framer framer;              ///< Splitter of received bytes into frames
+  bool frame_overflow;        ///< Discarding the rest of a frame too long
+  std::uint64_t tx_wait;      ///< Absolute offset of transmission which the owner waits for (0 if none)
+  bool tx_drain;              ///< The owner waits for bytes to leave the port
+  std::uint64_t tx_ack_offset;  ///< End of bytes queued by the write waiting for ack (0 if none)
+  std::size_t tx_ack_length;  ///< Number of bytes queued by the write waiting for ack
+  bool gap_scheduled;         ///< Gap timer is running
+  TimerQueue::key_type gap_timer;   ///< Key of gap timer
+  bool modem_watch;           ///< Push changes of modem lines to owner
+  std::size_t modem_step;     ///< Steps of "modem" run so far (0 if none)
+  TimerQueue::clock::time_point modem_time; ///< Time to run the next step of "modem"
+};
+
+/**
+ * @brief Options to open a session
+ */
+struct SessionOptions
+{
+  bool readable;              ///< Receive bytes from port
+  bool writable;              ///< Transmit bytes to port
+  bool shared;                ///< Allow other sessions to attach to the port
+  bool permanent;             ///< Keep the port open after the session closes
+  std::string spill_path;     ///< File to back receive ring (empty for memory)
+  std::size_t spill_size;     ///< Size of receive ring backed by file
+  std::int64_t offset;        ///< Absolute offset to resume from (-1 for the end)
+};
+
+/**
+ * @brief Event loop which runs in one thread
+ *
+ * A reactor owns its listening socket, the clients accepted from it
+ * and the ports opened by those clients. Nothing owned by a reactor
+ * is touched from other threads, so no lock is needed.
+ */
+class Reactor
+{
+public:
+  Reactor(Server& server, int index, const Socket::shared_ptr& socket);
+  ~Reactor();
+
+  void run();
+  void stop();
+
+  int open_session(Client& owner, const std::string& path, const SessionOptions& options);
+  Session& get_session(Client& owner, int session);
+  std::size_t read_session(Client& owner, int session, char *buffer, std::size_t length);
+  void consume_session(Client& owner, int session, std::size_t length);
+  void set_framer(Client& owner, int session, const Framer& framer);
+  bool check_read(Client& owner, int session, const ReadCondition& condition, bool expired, std::size_t& length);
+  void wait_session(Client& owner, int session, const ReadCondition& condition);
+  void configure_session(Client& owner, int session, const SerialPortConfig& set, SerialPortConfig& get);
+  TimerQueue::clock::duration get_char_time(Client& owner, int session);
+  bool check_transmit(Client& owner, int session, std::uint64_t offset, bool drained);
+  void wait_transmit(Client& owner, int session, std::uint64_t offset, bool drained);
+  std::size_t write_session(Client& owner, int session, const char *data, std::size_t length);
+  int get_modem_lines(Client& owner, int session);
+  void set_modem_lines(Client& owner, int session, int mask, int lines);
+  void watch_modem(Client& owner, int session, bool enable);
+  char *reserve_write(Client& owner, int session, std::size_t length);
+  std::size_t commit_write(Client& owner, int session, std::size_t reserved, std::size_t length);
+  void close_session(Client& owner, int session);
+  void schedule_push(int session, int delay);
+  const PortCatalog::snapshot_ptr& get_port_snapshot() const
+  {
+    return port_snapshot;
+  }
+  void schedule_resume(int session,
+                       TimerQueue::clock::duration delay = TimerQueue::clock::duration::zero());
+
+  void remove_client(Client& client);
+
+private:
+  void accept_clients();
+  void resume_accept();
+  void cleanup_clients();
+  void close_session(int session);
+  void close_port(Port& port);
+  void drop_port_data(Port& port, std::size_t length);
+  void handle_port_error(Port& port, const std::string& error);
+  void handle_read(Port& port, const PortIo::Completion& completion);
+  void handle_write(Port& port, const PortIo::Completion& completion);
+  bool match_read(Session& s, const ReadCondition& condition, bool expired, std::size_t& length);
+  void schedule_gap(int session);
+  std::size_t find_frame(Session& s);
+  void configure_port(Port& port, const SerialPortConfig& set, SerialPortConfig& get);
+  TimerQueue::clock::duration get_char_time(Port& port);
+  std::uint64_t get_drained_offset(Port& port);
+  void notify_transmit(Port& port);
+  void push_session(int session);
+  void record_delivery(const Port& port);
+  void update_modem_watcher(Port& port);
+  void dispatch_modem_events();
+  void dispatch_port_changes();
+  void trim_port(Port& port);
+  void update_port_io(Port& port);
+
+public:
+  Server& server;
+  const int index;
+  Poller::shared_ptr poller;
+  PortIo::shared_ptr port_io;
+  TimerQueue timers;
+  ReactorMetrics metrics;
+
+private:
+  Socket::shared_ptr server_socket;
+  bool accepting;
+  std::atomic<bool> stopping;
+  std::list<std::unique_ptr<Client>> active_clients;
+  std::list<std::unique_ptr<Client>> dead_clients;
+
+  Registry<Session> sessions;
+  std::map<std::string, std::shared_ptr<Port>> ports;
+  std::vector<char> frame_buffer;  ///< Buffer to decode frames to push
+  std::size_t modem_watchers;      ///< Number of ports whose modem lines are watched
+  std::vector<ModemEvent> modem_events;  ///< Buffer to take modem events
+  std::vector<std::pair<int, ModemEvent>> modem_pushes; ///< Modem events to push to sessions
+  PortCatalog::snapshot_ptr port_snapshot;  ///< Ports known to clients of this reactor
+};
+
+#endif  /* _REACTOR_HPP_ */
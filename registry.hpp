@@ -0,0 +1,116 @@
+#ifndef _REGISTRY_HPP_
+#define _REGISTRY_HPP_
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * @brief Table of objects looked up by generation-tagged IDs
+ *
+ * An ID holds a slot index in the lower 16 bits and the generation of
+ * the slot in the upper bits. The generation changes whenever an object
+ * is removed, so a stale ID never reaches an object which reuses the
+ * slot. Lookup, addition and removal take constant time.
+ */
+template <class T>
+class Registry
+{
+public:
+  /**
+   * @brief Add an object
+   *
+   * @param item Object to own
+   * @return ID of the object (>= 1)
+   */
+  int add(std::unique_ptr<T> item)
+  {
+    std::size_t slot;
+    if (!free_slots.empty()) {
+      slot = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      if (slots.size() >= slot_mask) {
+        throw std::runtime_error("too many entries in registry");
+      }
+      slot = slots.size();
+      slots.emplace_back();
+    }
+    slots[slot].item = std::move(item);
+    return make_id(slot);
+  }
+
+  /**
+   * @brief Find an object
+   *
+   * @param id ID of the object
+   * @return Pointer to the object (nullptr if not found)
+   */
+  T *find(int id) const
+  {
+    if (id <= 0) {
+      return nullptr;
+    }
+    const std::size_t slot = (id & slot_mask) - 1;
+    if ((slot >= slots.size()) || (make_id(slot) != id)) {
+      return nullptr;
+    }
+    return slots[slot].item.get();
+  }
+
+  /**
+   * @brief Remove an object (no effect if not found)
+   *
+   * @param id ID of the object
+   */
+  void remove(int id)
+  {
+    if (!find(id)) {
+      return;
+    }
+    const std::size_t slot = (id & slot_mask) - 1;
+    slots[slot].item.reset();
+    slots[slot].generation = (slots[slot].generation + 1) & generation_mask;
+    free_slots.push_back(slot);
+  }
+
+  /**
+   * @brief Get IDs of all objects
+   */
+  std::vector<int> get_ids() const
+  {
+    std::vector<int> ids;
+    for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+      if (slots[slot].item) {
+        ids.push_back(make_id(slot));
+      }
+    }
+    return ids;
+  }
+
+private:
+  static const int slot_bits = 16;
+  static const std::size_t slot_mask = (1u << slot_bits) - 1;
+  static const int generation_mask = 0x7fff;
+
+  struct Slot
+  {
+    Slot() : generation(0) {}
+
+    std::unique_ptr<T> item;
+    int generation;
+  };
+
+  int make_id(std::size_t slot) const
+  {
+    if (!slots[slot].item) {
+      return 0;
+    }
+    return (slots[slot].generation << slot_bits) | (int)(slot + 1);
+  }
+
+  std::vector<Slot> slots;
+  std::vector<std::size_t> free_slots;
+};
+
+#endif /* _REGISTRY_HPP_ */
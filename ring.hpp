@@ -0,0 +1,190 @@
+#ifndef _RING_HPP_
+#define _RING_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief Map memory whose second half mirrors the first half
+ *
+ * Implemented in each OS port. Returns nullptr if not supported.
+ *
+ * @param size Size of buffer (multiple of page size)
+ * @param path New file to back the buffer (nullptr for anonymous memory)
+ * @return Pointer to the head of 2 * size bytes mapping
+ */
+void *map_mirrored_memory(std::size_t size, const char *path = nullptr);
+
+/**
+ * @brief Unmap memory mapped by map_mirrored_memory()
+ *
+ * @param address Pointer returned by map_mirrored_memory()
+ * @param size Size of buffer given to map_mirrored_memory()
+ */
+void unmap_mirrored_memory(void *address, std::size_t size);
+
+/**
+ * @brief Byte ring buffer with power-of-two capacity
+ *
+ * When the OS supports mirrored mapping, both the readable bytes and
+ * the writable space are always contiguous, so the buffer never moves
+ * bytes. Otherwise the unread bytes are moved to the head only when the
+ * write position reaches the end of buffer.
+ */
+class RingBuffer
+{
+public:
+  /**
+   * @brief Construct a new RingBuffer object
+   *
+   * @param capacity Minimum capacity in bytes
+   * @param file File to back the buffer (nullptr for memory)
+   */
+  explicit RingBuffer(std::size_t capacity, const char *file = nullptr)
+  : base(nullptr), read_pos(0), write_pos(0)
+  {
+    allocate(capacity, file);
+  }
+
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  ~RingBuffer()
+  {
+    release();
+  }
+
+  /**
+   * @brief Get capacity in bytes
+   */
+  std::size_t capacity() const
+  {
+    return mask + 1;
+  }
+
+  /**
+   * @brief Get number of readable bytes
+   */
+  std::size_t size() const
+  {
+    return write_pos - read_pos;
+  }
+
+  /**
+   * @brief Get pointer to the readable bytes (contiguous for size())
+   */
+  char *read_ptr() const
+  {
+    return base + (mirrored ? (read_pos & mask) : read_pos);
+  }
+
+  /**
+   * @brief Get pointer to the writable space (contiguous for writable())
+   */
+  char *write_ptr() const
+  {
+    return base + (mirrored ? (write_pos & mask) : write_pos);
+  }
+
+  /**
+   * @brief Get contiguous writable space
+   */
+  std::size_t writable()
+  {
+    if (mirrored) {
+      return capacity() - size();
+    }
+    if ((write_pos == capacity()) && (read_pos > 0)) {
+      std::memmove(base, base + read_pos, size());
+      write_pos -= read_pos;
+      read_pos = 0;
+    }
+    return capacity() - write_pos;
+  }
+
+  /**
+   * @brief Mark bytes written to write_ptr() as readable
+   *
+   * @param length Number of bytes written
+   */
+  void commit(std::size_t length)
+  {
+    write_pos += length;
+  }
+
+  /**
+   * @brief Discard readable bytes
+   *
+   * Without mirroring, the positions are rewound when the buffer becomes
+   * empty, which moves write_ptr().
+   *
+   * @param length Number of bytes to discard
+   */
+  void consume(std::size_t length)
+  {
+    read_pos += length;
+    if ((read_pos == write_pos) && !mirrored) {
+      read_pos = write_pos = 0;
+    }
+  }
+
+  /**
+   * @brief Double the capacity keeping readable bytes
+   */
+  void grow()
+  {
+    RingBuffer larger(capacity() * 2);
+    std::memcpy(larger.base, read_ptr(), size());
+    larger.write_pos = size();
+    std::swap(base, larger.base);
+    std::swap(mask, larger.mask);
+    std::swap(mirrored, larger.mirrored);
+    read_pos = 0;
+    write_pos = larger.write_pos;
+  }
+
+private:
+  void allocate(std::size_t capacity, const char *file)
+  {
+    std::size_t size = 4096;
+    while (size < capacity) {
+      size <<= 1;
+      if (size == 0) {
+        throw std::length_error("ring buffer too large");
+      }
+    }
+    mask = size - 1;
+    base = (char *)map_mirrored_memory(size, file);
+    mirrored = (base != nullptr);
+    if (!mirrored && file) {
+      throw std::runtime_error(std::string("cannot map file: ") + file);
+    }
+    if (!mirrored) {
+      base = new char[size];
+    }
+  }
+
+  void release()
+  {
+    if (!base) {
+      return;
+    }
+    if (mirrored) {
+      unmap_mirrored_memory(base, capacity());
+    } else {
+      delete[] base;
+    }
+    base = nullptr;
+  }
+
+  char *base;
+  std::size_t mask;
+  bool mirrored;
+  std::size_t read_pos;
+  std::size_t write_pos;
+};
+
+#endif /* _RING_HPP_ */
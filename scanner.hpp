@@ -0,0 +1,196 @@
+#ifndef _SCANNER_HPP_
+#define _SCANNER_HPP_
+
+#include "byteset.hpp"
+#include <cstddef>
+#include <stdexcept>
+
+/**
+ * @brief Incremental scanner to find the end of a JSON5 document
+ *
+ * The scanner tracks nesting, strings and comments only, so that a
+ * request can be handed to the parser after it has been received
+ * completely. Bytes already scanned are not scanned again when more
+ * bytes arrive. Runs of bytes which cannot change the state (string
+ * contents, comments, and values inside the document) are skipped in
+ * blocks by ByteSet.
+ *
+ * A request must be an object, so anything else at the top level is
+ * rejected as soon as its first byte arrives.
+ */
+class DocumentScanner
+{
+public:
+  DocumentScanner()
+  {
+    reset();
+  }
+
+  /**
+   * @brief Reset the scanner for the next document
+   */
+  void reset()
+  {
+    offset = 0;
+    depth = 0;
+    state = STATE_VALUE;
+    quote = 0;
+  }
+
+  /**
+   * @brief Scan bytes
+   *
+   * @param data Pointer to the head of the document
+   * @param length Number of bytes available from the head
+   * @return Length of the document if complete, otherwise 0
+   */
+  std::size_t scan(const char *data, std::size_t length)
+  {
+    for (; offset < length; ++offset) {
+      offset = skip(data, offset, length);
+      if (offset >= length) {
+        break;
+      }
+      const char ch = data[offset];
+      switch (state) {
+      case STATE_VALUE:
+        switch (ch) {
+        case '[':
+          if (depth == 0) {
+            throw std::invalid_argument("request must be an object");
+          }
+          // fall through
+        case '{':
+          ++depth;
+          break;
+        case '}':
+        case ']':
+          if (--depth < 0) {
+            throw std::invalid_argument("unbalanced brackets in request");
+          }
+          if (depth == 0) {
+            const std::size_t end = offset + 1;
+            reset();
+            return end;
+          }
+          break;
+        case '"':
+        case '\'':
+          if (depth == 0) {
+            throw std::invalid_argument("request must be an object");
+          }
+          quote = ch;
+          state = STATE_STRING;
+          break;
+        case '/':
+          state = STATE_SLASH;
+          break;
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+          break;
+        default:
+          if (depth == 0) {
+            throw std::invalid_argument("request must be an object");
+          }
+          break;
+        }
+        break;
+      case STATE_STRING:
+        if (ch == '\\') {
+          state = STATE_ESCAPE;
+        } else if (ch == quote) {
+          state = STATE_VALUE;
+        }
+        break;
+      case STATE_ESCAPE:
+        state = STATE_STRING;
+        break;
+      case STATE_SLASH:
+        if (ch == '/') {
+          state = STATE_LINE_COMMENT;
+        } else if (ch == '*') {
+          state = STATE_BLOCK_COMMENT;
+        } else {
+          throw std::invalid_argument("unexpected '/' in request");
+        }
+        break;
+      case STATE_LINE_COMMENT:
+        if (ch == '\n') {
+          state = STATE_VALUE;
+        }
+        break;
+      case STATE_BLOCK_COMMENT:
+        if (ch == '*') {
+          state = STATE_BLOCK_COMMENT_STAR;
+        }
+        break;
+      case STATE_BLOCK_COMMENT_STAR:
+        if (ch == '/') {
+          state = STATE_VALUE;
+        } else if (ch != '*') {
+          state = STATE_BLOCK_COMMENT;
+        }
+        break;
+      }
+    }
+    return 0;
+  }
+
+private:
+  using StructureSet = ByteSet<false, '{', '[', '}', ']', '"', '\'', '/'>;
+  using DoubleQuoteSet = ByteSet<false, '"', '\\'>;
+  using SingleQuoteSet = ByteSet<false, '\'', '\\'>;
+  using LineEndSet = ByteSet<false, '\n'>;
+  using StarSet = ByteSet<false, '*'>;
+
+  /**
+   * @brief Skip bytes which do not change the state
+   *
+   * @return Offset of the next byte to handle (length if none)
+   */
+  std::size_t skip(const char *data, std::size_t offset, std::size_t length) const
+  {
+    const char *ptr = data + offset;
+    const char *end = data + length;
+    switch (state) {
+    case STATE_VALUE:
+      // Outside the document, anything but spaces is an error
+      if (depth > 0) {
+        ptr = StructureSet::find(ptr, end);
+      }
+      break;
+    case STATE_STRING:
+      ptr = (quote == '"') ? DoubleQuoteSet::find(ptr, end) : SingleQuoteSet::find(ptr, end);
+      break;
+    case STATE_LINE_COMMENT:
+      ptr = LineEndSet::find(ptr, end);
+      break;
+    case STATE_BLOCK_COMMENT:
+      ptr = StarSet::find(ptr, end);
+      break;
+    default:
+      break;
+    }
+    return ptr - data;
+  }
+
+  enum State
+  {
+    STATE_VALUE,
+    STATE_STRING,
+    STATE_ESCAPE,
+    STATE_SLASH,
+    STATE_LINE_COMMENT,
+    STATE_BLOCK_COMMENT,
+    STATE_BLOCK_COMMENT_STAR,
+  };
+
+  std::size_t offset;
+  int depth;
+  State state;
+  char quote;
+};
+
+#endif /* _SCANNER_HPP_ */
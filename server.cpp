@@ -1,82 +1,120 @@
 #include "server.hpp"
 #include "osport.hpp"
 #include "options.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <string>
 
 Server::Server(OsPort& os, const Options& opt)
-: os(os), opt(opt)
+: os(os), opt(opt), catalog(os), client_count(0)
 {
 }
 
+Server::~Server()
+{
+  for (auto& reactor : reactors) {
+    reactor->stop();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+/**
+ * @brief Run reactors
+ *
+ * The first reactor runs in the calling thread and uses the given
+ * socket. Other reactors listen on their own sockets bound to the same
+ * address and port (the given socket must have SO_REUSEPORT set).
+ *
+ * @param socket A listening socket
+ */
 void Server::run(const Socket::shared_ptr& socket)
 {
-  for (;;) {
-    auto lock = wait_empty_client();
-    active_clients.emplace_front();
-    auto iter = active_clients.begin();
-    lock.unlock();
+  int count = opt.get_threads();
+  if (count <= 0) {
+    count = std::max<int>(std::thread::hardware_concurrency(), 1);
+  }
 
-    if (opt.get_verbosity() >= 1) {
-      std::cerr << "Info: accept" << std::endl;
-    }
-    auto client_socket = socket->accept();
-    cleanup_clients();
-    iter->reset(new std::thread([this, iter, client_socket](){
-      std::stringstream ss;
-      ss << "(thread #" << std::this_thread::get_id() << ") ";
-      const auto prefix = ss.str();
+  std::string address;
+  int port;
+  socket->get_address(address, port);
 
-      if (opt.get_verbosity() >= 1) {
-        std::cerr << "Info: " << prefix << "started." << std::endl;
-      }
+  catalog.start();
+
+  reactors.emplace_back(new Reactor(*this, 0, socket));
+  for (int index = 1; index < count; ++index) {
+    auto reactor_socket = os.create_socket_tcp();
+    reactor_socket->set_reuse_port();
+    reactor_socket->set_buffer_size(socket->get_buffer_size());
+    reactor_socket->bind(opt.get_address(), port);
+    reactor_socket->listen();
+    reactors.emplace_back(new Reactor(*this, index, reactor_socket));
+  }
 
+  for (int index = 1; index < count; ++index) {
+    auto reactor = reactors[index].get();
+    threads.emplace_back([this, reactor](){
+      Log(LOG_DEBUG, "reactor thread started").add("reactor", reactor->index);
       try {
-        Client(*this).run(client_socket);
+        reactor->run();
       } catch (const std::exception& e) {
-        std::cerr << "Error: " << prefix << e.what() << std::endl;
+        Log(LOG_ERROR, "reactor failed").add("reactor", reactor->index).add("error", e.what());
+        reactors.front()->stop();
       }
-      client_socket->close();
+      Log(LOG_DEBUG, "reactor thread exited").add("reactor", reactor->index);
+    });
+  }
 
-      {
-        std::lock_guard<std::mutex> lock(mutex);
-        dead_clients.splice(dead_clients.begin(), std::move(active_clients), iter);
-      }
-      cond.notify_one();
-      if (opt.get_verbosity() >= 1) {
-        std::cerr << "Info: " << prefix << "exiting." << std::endl;
-      }
-    }));
+  if (opt.get_metrics_port() > 0) {
+    auto metrics_socket = os.create_socket_tcp();
+    metrics_socket->bind(opt.get_address(), opt.get_metrics_port());
+    metrics_socket->listen();
+    exporter.reset(new MetricsExporter(*this, reactors.front()->poller, metrics_socket));
+    exporter->start();
   }
+
+  Log(LOG_INFO, "reactors started").add("count", count).add("metrics_port", opt.get_metrics_port());
+  reactors.front()->run();
+  throw std::runtime_error("reactor stopped");
 }
 
-std::unique_lock<std::mutex> Server::get_session_handle(int session, handle_type& handle)
+/**
+ * @brief Count up clients if the limit allows (thread-safe)
+ *
+ * @return true if a new client can be accepted
+ */
+bool Server::acquire_client()
 {
-  std::unique_lock<std::mutex> lock(handles_mutex);
-  if ((session < 0) || (handles.size() <= session)) {
-    lock.unlock();
-    handle = nullptr;
-    return lock;
-  }
-
-  handle = handles.at(session);
-  return lock;
+  const int max_clients = opt.get_max_clients();
+  int count = client_count.load();
+  do {
+    if ((max_clients > 0) && (count >= max_clients)) {
+      return false;
+    }
+  } while (!client_count.compare_exchange_weak(count, count + 1));
+  return true;
 }
 
-std::unique_lock<std::mutex> Server::wait_empty_client()
+/**
+ * @brief Count down clients (thread-safe)
+ */
+void Server::release_client()
 {
-  std::unique_lock<std::mutex> lock(mutex);
-  cond.wait(lock, [this]{ return (int)active_clients.size() < opt.get_max_clients(); });
-  return lock;
+  --client_count;
 }
 
-void Server::cleanup_clients()
+/**
+ * @brief Collect metrics of all reactors (thread-safe)
+ *
+ * @param report A reference to empty report
+ */
+void Server::collect_metrics(MetricsReport& report) const
 {
-  std::lock_guard<std::mutex> lock(mutex);
-  while (!dead_clients.empty()) {
-    auto id = dead_clients.front()->get_id();
-    dead_clients.front()->join();
-    if (opt.get_verbosity() >= 1) {
-      std::cerr << "Info: thread joined: " << id << std::endl;
-    }
-    dead_clients.pop_front();
+  for (std::size_t index = 0; const char *name = Client::get_operation_name(index); ++index) {
+    report.operations.push_back(MetricsReport::OperationEntry{name, 0, 0});
+  }
+  for (const auto& reactor : reactors) {
+    reactor->metrics.collect(reactor->index, report);
   }
 }
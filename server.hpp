@@ -3,41 +3,56 @@
 
 #include "osport.hpp"
 #include "socket.hpp"
-#include "client.hpp"
-#include <list>
+#include "reactor.hpp"
+#include "catalog.hpp"
+#include "exporter.hpp"
+#include "metrics.hpp"
+#include <atomic>
+#include <memory>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
+#include <vector>
 
 class Options;
 
+/**
+ * @brief Event-driven server
+ *
+ * The server runs one or more reactors. Each reactor has its own
+ * listening socket bound to the same address with SO_REUSEPORT, so
+ * that the kernel distributes connections among reactor threads.
+ */
 class Server
 {
 public:
   using handle_type = OsPort::handle_type;
 
   Server(OsPort& os, const Options& opt);
+  ~Server();
 
   void run(const Socket::shared_ptr& socket);
 
-  std::unique_lock<std::mutex> get_session_handle(int session, handle_type& handle);
+  /**
+   * @brief Get number of reactors (valid after run() has started them)
+   */
+  std::size_t get_reactor_count() const
+  {
+    return reactors.size();
+  }
 
-private:
-  std::unique_lock<std::mutex> wait_empty_client();
-  void cleanup_clients();
+  bool acquire_client();
+  void release_client();
+  void collect_metrics(MetricsReport& report) const;
 
 public:
   OsPort& os;
   const Options& opt;
+  PortCatalog catalog;
 
 private:
-  std::list<std::shared_ptr<std::thread>> active_clients;
-  std::list<std::shared_ptr<std::thread>> dead_clients;
-  std::mutex mutex;
-  std::condition_variable cond;
-
-  std::vector<handle_type> handles;
-  std::mutex handles_mutex;
+  std::vector<std::unique_ptr<Reactor>> reactors;
+  std::vector<std::thread> threads;
+  std::unique_ptr<MetricsExporter> exporter;
+  std::atomic<int> client_count;
 };
 
 #endif  /* _SERVER_HPP_ */
@@ -7,68 +7,243 @@
 #include <vector>
 #include <cstring>
 #include <algorithm>
+#include <stdexcept>
+#include "ring.hpp"
 
+/**
+ * @brief An abstract class of non-blocking stream socket
+ *
+ * The get area is the readable part of a ring buffer filled by
+ * receive(), so parsers read received bytes in place. Reading beyond
+ * the received bytes reaches EOF instead of blocking.
+ *
+ * The put area grows as needed and is never sent implicitly. Flushing
+ * the stream (sync) marks the end of a response, and flush_pending()
+ * sends all completed responses together in one call.
+ */
 class Socket : public std::streambuf
 {
 protected:
-  Socket() = default;
+  Socket() : buffer_size(default_buffer_size), write_committed(0) {}
 
 public:
   typedef std::shared_ptr<Socket> shared_ptr;
 
   virtual ~Socket() = default;
 
+  virtual void set_reuse_port() = 0;
   virtual void bind(const std::string& address, int port) = 0;
   virtual void get_address(std::string& address, int& port) = 0;
   virtual void listen() = 0;
   virtual shared_ptr accept() = 0;
   virtual void close() = 0;
   virtual std::string error_string() = 0;
+  virtual bool would_block() = 0;
   virtual int recv_bytes(void *buffer, int length) = 0;
-  virtual int send_bytes(const void *buffer, int length) = 0;
+  virtual int send_bytes(const void *buffer, int length, bool more) = 0;
 
-protected:
-  virtual int_type underflow() override
+  /**
+   * @brief Default size of receive buffer
+   */
+  static const std::size_t default_buffer_size = 64 * 1024;
+
+  /**
+   * @brief Size which the receive buffer does not grow beyond
+   *
+   * Enough for the largest binary frame (16 MiB of payload and header).
+   */
+  static const std::size_t max_buffer_size = 32 * 1024 * 1024;
+
+  /**
+   * @brief Set size of receive buffer
+   *
+   * The size is rounded up to a power of two. For a listening socket,
+   * the size is inherited by accepted sockets.
+   *
+   * @param size Size in bytes
+   */
+  void set_buffer_size(std::size_t size)
+  {
+    buffer_size = size;
+  }
+
+  /**
+   * @brief Get size of receive buffer
+   */
+  std::size_t get_buffer_size() const
   {
-    if (!gptr() || (gptr() >= egptr())) {
-      auto remainder = std::min<int>(egptr() - eback(), 1);
-      if (remainder > 0) {
-        std::memmove(read_buffer, gptr() - remainder, remainder);
+    return buffer_size;
+  }
+
+  /**
+   * @brief Receive available bytes into the get area without blocking
+   *
+   * All free space of the ring buffer is offered to the kernel in one
+   * call. The buffer grows only when a request does not fit in it, and
+   * std::length_error is thrown if it would grow beyond max_buffer_size.
+   *
+   * @return Number of bytes received (0 if nothing to receive),
+   *         or -1 if the peer has closed the connection
+   */
+  int receive()
+  {
+    if (!read_ring) {
+      read_ring.reset(new RingBuffer(buffer_size));
+    }
+    auto& ring = *read_ring;
+    ring.consume(gptr() - eback());
+    if (ring.writable() == 0) {
+      if (ring.capacity() >= max_buffer_size) {
+        throw std::length_error("request too long");
+      }
+      ring.grow();
+    }
+
+    int len = recv_bytes(ring.write_ptr(), (int)ring.writable());
+    if (len > 0) {
+      ring.commit(len);
+    }
+    setg(ring.read_ptr(), ring.read_ptr(), ring.read_ptr() + ring.size());
+    if (len == 0) {
+      return -1;
+    } else if (len < 0) {
+      if (would_block()) {
+        return 0;
       }
-      int len = recv_bytes(read_buffer + remainder, sizeof(read_buffer) - 1 - remainder);
-      if (len == 0) {
-        return traits_type::eof();
-      } else if (len < 0) {
-        throw std::runtime_error("socket recv failed: " + error_string());
+      throw std::runtime_error("socket recv failed: " + error_string());
+    }
+    return len;
+  }
+
+  /**
+   * @brief Get unread bytes in the get area
+   */
+  const char *get_read_data() const
+  {
+    return gptr();
+  }
+
+  /**
+   * @brief Get number of unread bytes in the get area
+   */
+  std::size_t get_read_size() const
+  {
+    return egptr() - gptr();
+  }
+
+  /**
+   * @brief Discard unread bytes
+   *
+   * @param length Number of bytes to discard
+   */
+  void consume(std::size_t length)
+  {
+    gbump((int)length);
+  }
+
+  /**
+   * @brief Send completed responses without blocking
+   *
+   * @param more true if more responses will follow soon (the OS may
+   *             hold a partial segment back to merge them)
+   * @return true if no completed responses are left pending
+   */
+  bool flush_pending(bool more = false)
+  {
+    while (write_committed > 0) {
+      int len = send_bytes(pbase(), (int)write_committed, more);
+      if (len < 0) {
+        if (would_block()) {
+          return false;
+        }
+        throw std::runtime_error("socket send failed: " + error_string());
       }
-      setg(read_buffer, read_buffer + remainder, read_buffer + remainder + len);
+      discard_put(len);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Get number of bytes waiting to be sent
+   */
+  std::size_t get_pending_size() const
+  {
+    return pptr() - pbase();
+  }
+
+  /**
+   * @brief Get number of bytes of completed responses waiting to be sent
+   */
+  std::size_t get_committed_size() const
+  {
+    return write_committed;
+  }
+
+protected:
+  virtual int_type underflow() override
+  {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
     }
-    return *gptr();
+    return traits_type::eof();
   }
 
   virtual int_type overflow(int_type c = traits_type::eof()) override
   {
     if (traits_type::eq_int_type(c, traits_type::eof())) {
-      return c;
-    }
-    char ch = c;
-    if (xsputn(&ch, 1) < 0) {
-      return traits_type::eof();
+      return traits_type::not_eof(c);
     }
-    return 1;
+    reserve_put(1);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
   }
 
   virtual std::streamsize xsputn(const char_type* s, std::streamsize count) override
   {
-    int len = send_bytes(s, (int)count);
-    if (len < 0) {
-      throw std::runtime_error("socket send failed: " + error_string());
-    }
-    return len;
+    reserve_put(count);
+    std::memcpy(pptr(), s, count);
+    pbump((int)count);
+    return count;
+  }
+
+  virtual int sync() override
+  {
+    write_committed = pptr() - pbase();
+    return 0;
   }
 
 private:
-  char read_buffer[1024 + 1];
+  void reserve_put(std::size_t length)
+  {
+    if ((std::size_t)(epptr() - pptr()) >= length) {
+      return;
+    }
+    const std::size_t used = pptr() - pbase();
+    std::size_t size = std::max<std::size_t>(write_buffer.size() * 2, 4096);
+    while (size < used + length) {
+      size *= 2;
+    }
+    write_buffer.resize(size);
+    setp(write_buffer.data(), write_buffer.data() + size);
+    pbump((int)used);
+  }
+
+  void discard_put(std::size_t length)
+  {
+    const std::size_t remaining = (pptr() - pbase()) - length;
+    if (remaining > 0) {
+      std::memmove(pbase(), pbase() + length, remaining);
+    }
+    setp(pbase(), epptr());
+    pbump((int)remaining);
+    write_committed -= length;
+  }
+
+  std::size_t buffer_size;
+  std::unique_ptr<RingBuffer> read_ring;
+  std::vector<char> write_buffer;
+  std::size_t write_committed;
 };
 
 #endif /* _SOCKET_HPP_ */
@@ -0,0 +1,94 @@
+#ifndef _TIMER_HPP_
+#define _TIMER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+
+/**
+ * @brief One-shot timers run by an event loop
+ *
+ * Timers are ordered by deadline and called from run() in the thread of
+ * the event loop. Like the poller, a timer queue must be used only from
+ * one thread.
+ */
+class TimerQueue
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Type alias definition for timer handler
+   */
+  using handler_type = std::function<void()>;
+
+  /**
+   * @brief Type alias definition for key to cancel a timer
+   */
+  using key_type = std::pair<clock::time_point, std::uint64_t>;
+
+  TimerQueue() : last_id(0) {}
+
+  /**
+   * @brief Start a timer
+   *
+   * @param delay Time to wait before calling handler
+   * @param handler Handler to be called
+   * @return Key to cancel the timer
+   */
+  key_type add(clock::duration delay, const handler_type& handler)
+  {
+    key_type key(clock::now() + delay, ++last_id);
+    timers.emplace(key, handler);
+    return key;
+  }
+
+  /**
+   * @brief Cancel a timer (no effect if already expired)
+   *
+   * @param key Key returned by add()
+   */
+  void cancel(const key_type& key)
+  {
+    timers.erase(key);
+  }
+
+  /**
+   * @brief Get time to wait for the next timer
+   *
+   * @return Timeout in milliseconds (rounded up), or -1 if no timers
+   */
+  int get_timeout() const
+  {
+    if (timers.empty()) {
+      return -1;
+    }
+    const auto remaining = timers.begin()->first.first - clock::now();
+    if (remaining <= clock::duration::zero()) {
+      return 0;
+    }
+    return (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+      remaining + std::chrono::milliseconds(1) - clock::duration(1)).count();
+  }
+
+  /**
+   * @brief Call handlers of expired timers
+   */
+  void run()
+  {
+    const auto now = clock::now();
+    while (!timers.empty() && (timers.begin()->first.first <= now)) {
+      auto handler = std::move(timers.begin()->second);
+      timers.erase(timers.begin());
+      handler();
+    }
+  }
+
+private:
+  std::map<key_type, handler_type> timers;
+  std::uint64_t last_id;
+};
+
+#endif /* _TIMER_HPP_ */